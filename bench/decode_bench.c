@@ -0,0 +1,159 @@
+/*
+ * Copyright 2020 Jetperch LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Benchmark the field-selective status packet decoder.
+ *
+ * Decodes synthetic JS110 status packets with several field masks,
+ * from all fields down to the narrow projections that many consumers
+ * use.  The "update" rows include the work that the polling thread adds
+ * to each decode: clearing the update, keeping the raw packet, and
+ * always decoding the fields used for accumulation and the sketches.
+ *
+ * usage: js110_decode_bench [packets] [iterations]
+ */
+
+#include "status_decode.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Matches FIELDS_INTERNAL in js110_statistics.c.
+#define FIELDS_INTERNAL (JS110_FIELD_SERIAL_NUMBER | JS110_FIELD_SAMPLES_THIS \
+    | JS110_FIELD_SAMPLES_PER_SECOND | JS110_FIELD_SAMPLES_TOTAL \
+    | JS110_FIELD_CHARGE | JS110_FIELD_ENERGY \
+    | JS110_FIELD_CURRENT_MEAN | JS110_FIELD_POWER_MEAN)
+
+#define RUNS (5)
+
+struct update_s {
+    struct js110_statistics_s statistics;
+    uint32_t fields;
+    uint8_t pkt[JS110_STATUS_LENGTH];
+};
+
+struct projection_s {
+    const char * name;
+    uint32_t fields;
+};
+
+static const struct projection_s projections_[] = {
+    {"all", JS110_FIELD_ALL},
+    {"current_mean,charge", JS110_FIELD_CURRENT_MEAN | JS110_FIELD_CHARGE},
+    {"current_mean", JS110_FIELD_CURRENT_MEAN},
+    {"voltage_*", JS110_FIELD_VOLTAGE_MEAN | JS110_FIELD_VOLTAGE_MIN | JS110_FIELD_VOLTAGE_MAX},
+    {"charge,energy", JS110_FIELD_CHARGE | JS110_FIELD_ENERGY},
+};
+#define PROJECTION_COUNT (sizeof(projections_) / sizeof(projections_[0]))
+
+static double time_s(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void generate(uint8_t * pkts, uint32_t count) {
+    srand(1);
+    for (uint32_t i = 0; i < count * JS110_STATUS_LENGTH; ++i) {
+        pkts[i] = (uint8_t) rand();
+    }
+    for (uint32_t k = 0; k < count; ++k) {
+        pkts[k * JS110_STATUS_LENGTH + 56] |= 1;  // samples_this != 0
+    }
+}
+
+/// Decode only, in ns per packet.
+static double bench_decode(const uint8_t * pkts, uint32_t count, uint32_t iterations,
+                           uint32_t fields, double * sum) {
+    struct js110_statistics_s s;
+    double acc = 0.0;
+    memset(&s, 0, sizeof(s));
+    double t_start = time_s();
+    for (uint32_t iter = 0; iter < iterations; ++iter) {
+        for (uint32_t k = 0; k < count; ++k) {
+            js110_status_decode(pkts + k * JS110_STATUS_LENGTH, fields, &s);
+            acc += s.current_mean;
+        }
+    }
+    double t = time_s() - t_start;
+    *sum += acc;
+    return (t * 1e9) / ((double) count * iterations);
+}
+
+/// Decode as the polling thread does, in ns per packet.
+static double bench_update(const uint8_t * pkts, uint32_t count, uint32_t iterations,
+                           uint32_t fields, double * sum) {
+    struct update_s u;
+    double acc = 0.0;
+    double t_start = time_s();
+    for (uint32_t iter = 0; iter < iterations; ++iter) {
+        for (uint32_t k = 0; k < count; ++k) {
+            const uint8_t * pkt = pkts + k * JS110_STATUS_LENGTH;
+            memset(&u.statistics, 0, sizeof(u.statistics));
+            memcpy(u.pkt, pkt, JS110_STATUS_LENGTH);
+            u.fields = fields | FIELDS_INTERNAL;
+            js110_status_decode(pkt, u.fields, &u.statistics);
+            acc += u.statistics.current_mean;
+        }
+    }
+    double t = time_s() - t_start;
+    *sum += acc;
+    return (t * 1e9) / ((double) count * iterations);
+}
+
+int main(int argc, char * argv[]) {
+    uint32_t count = (argc > 1) ? (uint32_t) strtoul(argv[1], NULL, 0) : 1024;
+    uint32_t iterations = (argc > 2) ? (uint32_t) strtoul(argv[2], NULL, 0) : 500;
+    double sum = 0.0;
+    if (!count || !iterations) {
+        printf("usage: js110_decode_bench [packets] [iterations]\n");
+        return 1;
+    }
+    uint8_t * pkts = malloc((size_t) count * JS110_STATUS_LENGTH);
+    if (!pkts) {
+        printf("out of memory\n");
+        return 1;
+    }
+    generate(pkts, count);
+
+    printf("packets:    %u x %u\n", count, iterations);
+    printf("%-22s %12s %12s\n", "fields", "decode ns", "update ns");
+    double decode_all = 0.0;
+    double update_all = 0.0;
+    for (uint32_t i = 0; i < PROJECTION_COUNT; ++i) {
+        const struct projection_s * p = &projections_[i];
+        // Report the fastest of several runs to reduce the scheduling noise.
+        double decode_ns = 0.0;
+        double update_ns = 0.0;
+        for (int run = 0; run < RUNS; ++run) {
+            double d = bench_decode(pkts, count, iterations, p->fields, &sum);
+            double u = bench_update(pkts, count, iterations, p->fields, &sum);
+            decode_ns = (!run || (d < decode_ns)) ? d : decode_ns;
+            update_ns = (!run || (u < update_ns)) ? u : update_ns;
+        }
+        if (0 == i) {
+            decode_all = decode_ns;
+            update_all = update_ns;
+        }
+        printf("%-22s %7.2f %3.0f%% %7.2f %3.0f%%\n", p->name,
+               decode_ns, 100.0 * decode_ns / decode_all,
+               update_ns, 100.0 * update_ns / update_all);
+    }
+    printf("checksum:   %g\n", sum);
+    free(pkts);
+    return 0;
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright 2020 Jetperch LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Send synthetic statistics updates through js110_forward.
+ *
+ * Generates updates for a number of simulated instruments and forwards
+ * them to a collector, such as js110_collector on localhost.  Run
+ * several instances concurrently to simulate many lab hosts.  Stop and
+ * restart the collector while this benchmark runs to exercise the
+ * reconnect and resend.
+ *
+ * usage: js110_forward_bench URL [records] [devices] [rate] [spool_path] [source_id]
+ *
+ * rate is the updates per second over all devices, 0 for as fast as
+ * possible.  Run again with the same spool_path and source_id to
+ * exercise a forwarder restart.
+ */
+
+#include "js110_forward.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define QUEUE_LIMIT (32768)
+
+#if defined(_WIN32)
+#include <Windows.h>
+static void sleep_ms(uint32_t duration_ms) {
+    Sleep(duration_ms);
+}
+#else
+static void sleep_ms(uint32_t duration_ms) {
+    struct timespec ts = {.tv_sec = duration_ms / 1000, .tv_nsec = (long) (duration_ms % 1000) * 1000000L};
+    nanosleep(&ts, NULL);
+}
+#endif
+
+static double time_s(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char * argv[]) {
+    struct js110_forward_config_s config;
+    struct js110_forward_status_s status;
+    struct js110_statistics_s s;
+    if (argc < 2) {
+        fprintf(stderr, "usage: js110_forward_bench URL [records] [devices] [rate] [spool_path] [source_id]\n");
+        return 1;
+    }
+    uint64_t records = (argc > 2) ? strtoull(argv[2], NULL, 0) : 1000000;
+    uint32_t devices = (argc > 3) ? (uint32_t) strtoul(argv[3], NULL, 0) : 64;
+    double rate = (argc > 4) ? strtod(argv[4], NULL) : 0.0;
+    memset(&config, 0, sizeof(config));
+    config.url = argv[1];
+    config.spool_path = (argc > 5) ? argv[5] : NULL;
+    config.source_id = (argc > 6) ? strtoull(argv[6], NULL, 0) : 0;
+    if (!devices) {
+        devices = 1;
+    }
+    if (js110_forward_start(&config)) {
+        fprintf(stderr, "js110_forward_start failed\n");
+        return 1;
+    }
+
+    double t0 = time_s();
+    memset(&s, 0, sizeof(s));
+    s.samples_this = 1000000;
+    s.samples_per_update = 1000000;
+    s.samples_per_second = 2000000;
+    s.voltage_mean = 3.3;
+    s.voltage_min = 3.299;
+    s.voltage_max = 3.301;
+    for (uint64_t k = 0; k < records; ++k) {
+        uint32_t device = (uint32_t) (k % devices);
+        uint64_t window = k / devices;
+        s.serial_number = 100000 + device;
+        s.samples_total = (int64_t) (window + 1) * 1000000;
+        s.current_mean = 0.001 * (1 + device % 97) * (1.0 + 0.001 * (window % 100));
+        s.current_min = s.current_mean * 0.9;
+        s.current_max = s.current_mean * 1.1;
+        s.power_mean = s.current_mean * s.voltage_mean;
+        s.power_min = s.power_mean * 0.9;
+        s.power_max = s.power_mean * 1.1;
+        s.charge = s.current_mean * 0.5 * (window + 1);
+        s.energy = s.power_mean * 0.5 * (window + 1);
+        js110_forward_push(&s);
+        if (rate > 0.0) {
+            double t_target = t0 + (k + 1) / rate;
+            double t_now = time_s();
+            if (t_target > t_now + 0.001) {
+                sleep_ms((uint32_t) ((t_target - t_now) * 1000));
+            }
+        } else if (0 == (k % 1024)) {
+            // Keep the queue below half full, so no records are dropped.
+            while (1) {
+                js110_forward_status(&status);
+                if ((k - status.records_framed - status.records_dropped) < QUEUE_LIMIT) {
+                    break;
+                }
+                sleep_ms(1);
+            }
+        }
+    }
+    double t1 = time_s();
+    js110_forward_stop();
+    double t2 = time_s();
+    js110_forward_status(&status);
+
+    printf("records:          %llu pushed, %llu framed, %llu dropped\n",
+           (unsigned long long) records, (unsigned long long) status.records_framed,
+           (unsigned long long) status.records_dropped);
+    printf("frames:           %llu sent, %llu resent, %llu acked, %llu dropped\n",
+           (unsigned long long) status.frames_sent, (unsigned long long) status.frames_resent,
+           (unsigned long long) status.frames_acked, (unsigned long long) status.frames_dropped);
+    printf("connects:         %llu, spool %llu bytes\n",
+           (unsigned long long) status.connects, (unsigned long long) status.spool_bytes);
+    printf("duration:         %.3f s push, %.3f s total\n", t1 - t0, t2 - t0);
+    printf("throughput:       %.0f records/s\n", records / (t2 - t0));
+    return 0;
+}
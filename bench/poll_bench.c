@@ -0,0 +1,113 @@
+/*
+ * Copyright 2020 Jetperch LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Benchmark the device polling loop overhead with simulated instruments.
+ *
+ * Runs the library against simulated JS110 instruments, which produce a
+ * new window every 500 ms, and reports the polling cycle duration, the
+ * cost per device and the delivered update rate.  The main thread
+ * blocks in js110_wait_for_update() rather than sleeping, and the
+ * benchmark reports the js110_finalize() shutdown latency.
+ *
+ * With callback_ms, the callback sleeps for each update and runs on the
+ * polling thread.  The devices must stay healthy, since only the status
+ * transfer counts towards the device health, so the exit code is 1 for
+ * any health transition.
+ *
+ * usage: js110_poll_bench [devices] [seconds] [callback_ms]
+ */
+
+#include "js110_statistics.h"
+#include "js110_sim.h"
+#include <Windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static volatile LONGLONG updates_ = 0;
+static volatile LONGLONG health_changes_ = 0;
+static uint32_t callback_ms_ = 0;
+
+static void on_statistics(void * user_data, struct js110_statistics_s * statistics) {
+    (void) user_data;
+    (void) statistics;
+    InterlockedIncrement64(&updates_);
+    if (callback_ms_) {
+        Sleep(callback_ms_);
+    }
+}
+
+static void on_health(void * user_data, uint32_t serial_number, enum js110_health_e health, uint32_t retry_ms) {
+    (void) user_data;
+    (void) retry_ms;
+    printf("health:           %u -> %d\n", serial_number, (int) health);
+    InterlockedIncrement64(&health_changes_);
+}
+
+int main(int argc, char * argv[]) {
+    struct js110_poll_status_s status;
+    uint32_t devices = (argc > 1) ? (uint32_t) strtoul(argv[1], NULL, 0) : 512;
+    uint32_t seconds = (argc > 2) ? (uint32_t) strtoul(argv[2], NULL, 0) : 10;
+    callback_ms_ = (argc > 3) ? (uint32_t) strtoul(argv[3], NULL, 0) : 0;
+    if (!devices || !seconds) {
+        fprintf(stderr, "usage: js110_poll_bench [devices] [seconds] [callback_ms]\n");
+        return 1;
+    }
+    if (callback_ms_) {
+        js110_coalesce_set(JS110_COALESCE_MERGE, UINT32_MAX);  // keep the callback on the polling thread
+    }
+    js110_health_callback_set(on_health, NULL);
+    if (js110_sim_configure(devices)) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    if (js110_initialize(on_statistics, NULL)) {
+        fprintf(stderr, "js110_initialize failed\n");
+        return 1;
+    }
+    uint64_t wakeups = 0;
+    ULONGLONG t_end = GetTickCount64() + seconds * 1000ULL;
+    for (ULONGLONG t = GetTickCount64(); t < t_end; t = GetTickCount64()) {
+        if (0 == js110_wait_for_update((uint32_t) (t_end - t))) {
+            ++wakeups;
+        }
+    }
+    js110_poll_status(&status);
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER t_stop_start;
+    LARGE_INTEGER t_stop_end;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&t_stop_start);
+    js110_finalize();
+    QueryPerformanceCounter(&t_stop_end);
+    js110_sim_configure(0);
+    double finalize_ms = ((t_stop_end.QuadPart - t_stop_start.QuadPart) * 1000.0) / frequency.QuadPart;
+
+    double cycles = status.cycles ? (double) status.cycles : 1.0;
+    double cycle_us = status.cycle_duration_us_total / cycles;
+    double scan_us = status.scans ? ((double) status.scan_duration_us_total / status.scans) : 0.0;
+    printf("devices:          %u open, capacity %u\n", status.devices_open, status.device_capacity);
+    printf("cycles:           %llu\n", (unsigned long long) status.cycles);
+    printf("cycle duration:   %.1f us average, %llu us max\n",
+           cycle_us, (unsigned long long) status.cycle_duration_us_max);
+    printf("per device:       %.3f us\n", status.devices_open ? (cycle_us / status.devices_open) : 0.0);
+    printf("scan duration:    %.1f us average over %llu scans\n", scan_us, (unsigned long long) status.scans);
+    printf("updates:          %lld (%.1f expected)\n", (long long) updates_, 2.0 * devices * seconds);
+    printf("wait wakeups:     %llu\n", (unsigned long long) wakeups);
+    printf("finalize:         %.2f ms\n", finalize_ms);
+    printf("health changes:   %lld\n", (long long) health_changes_);
+    return health_changes_ ? 1 : 0;
+}
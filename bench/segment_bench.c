@@ -0,0 +1,193 @@
+/*
+ * Copyright 2020 Jetperch LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Benchmark the segment tracking cost for each update.
+ *
+ * Keeps a number of segments open on a single device track.  Each update
+ * ends the oldest or a random segment and begins a new one, so segments
+ * have a spread of lengths.  Compares the time for each update against
+ * a naive tracker that updates the minimum and maximum of every open
+ * segment, and checks that both report the same statistics.
+ *
+ * usage: js110_segment_bench [updates]
+ */
+
+#include "segment.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define EXTREMA (6)
+
+static const uint32_t OPEN_COUNTS[] = {0, 10, 100, 1000, 10000};
+#define OPEN_COUNTS_LENGTH (sizeof(OPEN_COUNTS) / sizeof(OPEN_COUNTS[0]))
+
+/// The naive tracker state for a single segment.
+struct naive_s {
+    uint32_t handle;
+    double charge;
+    double extrema[EXTREMA];  // min, max pairs
+};
+
+static uint32_t rng_ = 1;
+static struct naive_s * naive_ = NULL;
+
+static uint32_t rng_next(void) {
+    uint32_t x = rng_;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rng_ = x;
+    return x;
+}
+
+static double time_s(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/// Generate the next window as a random walk.
+static void window_next(struct js110_statistics_s * s) {
+    double i = s->current_mean * (0.9 + 0.2 * (rng_next() / 4294967296.0));
+    double v = 3.3 + 0.01 * ((rng_next() & 0xff) / 256.0 - 0.5);
+    s->samples_this = 1000000;
+    s->samples_per_second = 2000000;
+    s->samples_total += s->samples_this;
+    s->current_mean = i;
+    s->current_min = i * 0.5;
+    s->current_max = i * 2.0;
+    s->voltage_mean = v;
+    s->voltage_min = v - 0.01;
+    s->voltage_max = v + 0.01;
+    s->power_mean = i * v;
+    s->power_min = s->current_min * s->voltage_min;
+    s->power_max = s->current_max * s->voltage_max;
+    s->charge += i * 0.5;
+    s->energy += i * v * 0.5;
+}
+
+static void naive_begin(struct naive_s * n, uint32_t handle, const struct js110_statistics_s * s) {
+    n->handle = handle;
+    n->charge = s->charge;
+    for (int k = 0; k < EXTREMA; k += 2) {
+        n->extrema[k] = NAN;
+        n->extrema[k + 1] = NAN;
+    }
+}
+
+static void naive_update(struct naive_s * n, const struct js110_statistics_s * s) {
+    const double values[EXTREMA] = {
+        s->current_min, s->current_max, s->voltage_min, s->voltage_max, s->power_min, s->power_max};
+    for (int k = 0; k < EXTREMA; k += 2) {
+        n->extrema[k] = (isnan(n->extrema[k]) || (values[k] < n->extrema[k])) ? values[k] : n->extrema[k];
+        n->extrema[k + 1] = (isnan(n->extrema[k + 1]) || (values[k + 1] > n->extrema[k + 1]))
+                ? values[k + 1] : n->extrema[k + 1];
+    }
+}
+
+static int naive_check(const struct naive_s * n, const struct js110_segment_s * g, const struct js110_statistics_s * s) {
+    const double values[EXTREMA] = {
+        g->current_min, g->current_max, g->voltage_min, g->voltage_max, g->power_min, g->power_max};
+    for (int k = 0; k < EXTREMA; ++k) {
+        if ((values[k] != n->extrema[k]) && !(isnan(values[k]) && isnan(n->extrema[k]))) {
+            return 1;
+        }
+    }
+    return (g->charge != (s->charge - n->charge)) ? 1 : 0;
+}
+
+/**
+ * @brief Run one configuration.
+ *
+ * @param open The number of open segments.
+ * @param updates The number of updates.
+ * @param naive Also run the naive tracker.
+ * @param[out] errors The number of segments that differ from the naive tracker.
+ * @return The time for each update, in nanoseconds.
+ */
+static double run(uint32_t open, uint32_t updates, int naive, uint64_t * errors) {
+    struct js110_statistics_s s;
+    struct js110_segment_s segment;
+    memset(&s, 0, sizeof(s));
+    s.current_mean = 0.01;
+    rng_ = 1;
+    struct js110_segment_track_s * track = js110_segment_track_alloc(1);
+    window_next(&s);
+    js110_segment_track_update(track, &s);
+    for (uint32_t i = 0; i < open; ++i) {
+        js110_segment_open(track, &naive_[i].handle);
+        naive_begin(&naive_[i], naive_[i].handle, &s);
+    }
+
+    double t_start = time_s();
+    for (uint32_t k = 0; k < updates; ++k) {
+        window_next(&s);
+        js110_segment_track_update(track, &s);
+        if (naive) {
+            for (uint32_t i = 0; i < open; ++i) {
+                naive_update(&naive_[i], &s);
+            }
+        }
+        if (open) {
+            // End the oldest or a random segment, then begin a new one.
+            uint32_t i = (k & 1) ? (rng_next() % open) : (k / 2) % open;
+            struct naive_s * n = &naive_[i];
+            js110_segment_result(n->handle, &segment);
+            if (naive && naive_check(n, &segment, &s)) {
+                ++*errors;
+            }
+            js110_segment_release(n->handle);
+            js110_segment_open(track, &n->handle);
+            naive_begin(n, n->handle, &s);
+        }
+    }
+    double ns = (time_s() - t_start) * 1e9 / updates;
+
+    for (uint32_t i = 0; i < open; ++i) {
+        js110_segment_release(naive_[i].handle);
+    }
+    js110_segment_pool_free();
+    js110_segment_track_free(track);
+    return ns;
+}
+
+int main(int argc, char * argv[]) {
+    uint32_t updates = (argc > 1) ? (uint32_t) strtoul(argv[1], NULL, 0) : 200000;
+    uint64_t errors = 0;
+    if (!updates) {
+        printf("usage: js110_segment_bench [updates]\n");
+        return 1;
+    }
+    naive_ = calloc(OPEN_COUNTS[OPEN_COUNTS_LENGTH - 1], sizeof(struct naive_s));
+    if (!naive_) {
+        return 1;
+    }
+    printf("updates:          %u\n", updates);
+    printf("open segments     deque ns/update  naive +ns/update\n");
+    for (uint32_t i = 0; i < OPEN_COUNTS_LENGTH; ++i) {
+        uint32_t open = OPEN_COUNTS[i];
+        double deque_ns = run(open, updates, 0, &errors);
+        double naive_ns = run(open, updates, 1, &errors) - deque_ns;
+        printf("%13u %17.1f %17.1f\n", open, deque_ns, naive_ns);
+    }
+    printf("errors:           %llu\n", (unsigned long long) errors);
+    free(naive_);
+    return errors ? 1 : 0;
+}
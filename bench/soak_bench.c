@@ -0,0 +1,484 @@
+/*
+ * Copyright 2020 Jetperch LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Soak the library with simulated hotplug churn and faults.
+ *
+ * Runs the library against simulated JS110 instruments while a script
+ * randomly reboots instruments, disconnects them for longer periods,
+ * resets whole hubs of 7 instruments and injects slow status transfers
+ * or failing transfers, which take as long as slow ones like a transfer
+ * timeout.  After the churn, all instruments reconnect and run
+ * without faults for a settling period.
+ *
+ * The soak then compares the delivered updates against the simulator
+ * ground truth for each instrument and reports:
+ *
+ * - missed windows, which the simulator produced but never returned.
+ *   Visible misses are the windows_missed that the library reported.
+ *   Silent misses are not reported, such as the windows that an
+ *   instrument produced before it disconnected.
+ * - library drops, which the library read but never delivered.
+ * - fill records, see js110_gap_fill_set() and the --fill option.
+ * - resyncs, the updates with JS110_FLAG_RESYNC, compared to the number
+ *   of reboots.
+ * - resync errors, where the samples_total step does not match
+ *   samples_this and samples_missed, and charge errors, where the charge
+ *   step of a continuous update or fill record does not match
+ *   current_mean.
+ * - stalled instruments, which are connected but received no updates
+ *   at the end of the settling period.
+ * - the device health transitions and the device scan cost.
+ *
+ * The exit code is 1 for library drops, resync errors, charge errors
+ * or stalled instruments.
+ *
+ * usage: js110_soak_bench [options]
+ */
+
+#include "js110_statistics.h"
+#include "js110_sim.h"
+#include <Windows.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TICK_MS (10)
+#define HUB_SIZE (7)
+#define STALL_MS (1000)
+#define CHARGE_TOLERANCE_ABS (1e-6)
+#define CHARGE_TOLERANCE_REL (1e-3)
+
+static const char USAGE[] =
+    "usage: js110_soak_bench [options]\n"
+    "\n"
+    "Soak the library with simulated hotplug churn and faults.\n"
+    "\n"
+    "options:\n"
+    "  --devices N         The number of simulated instruments.  Default 256.\n"
+    "  --seconds N         The churn duration.  Default 60.\n"
+    "  --settle N          The settling duration after the churn, at least 2.\n"
+    "                      Default 5.\n"
+    "  --churn N           The churn events per second.  Default 5.\n"
+    "  --slow-us N         The slow and failing status transfer duration.\n"
+    "                      Default 2000.\n"
+    "  --fail-ppm N        The failing status transfer probability, in parts\n"
+    "                      per million.  Default 200000.\n"
+    "  --fill N            Fill gaps of up to N windows, 0 disables.\n"
+    "                      Default 0.\n"
+    "  --seed N            The random seed.  Default 1.\n"
+    "  --report-seconds N  Report progress every N seconds, 0 disables.\n"
+    "                      Default 10.\n"
+    "  --help              Display this help and exit.\n";
+
+enum event_e {
+    EVENT_REBOOT,
+    EVENT_DEPART,
+    EVENT_HUB_RESET,
+    EVENT_SLOW,
+    EVENT_FAIL,
+    EVENT_COUNT,
+};
+
+static const char * const EVENT_NAMES[EVENT_COUNT] = {
+    "reboot", "depart", "hub reset", "slow", "fail",
+};
+
+// The relative weight of each event, in percent.
+static const uint32_t EVENT_WEIGHTS[EVENT_COUNT] = {40, 20, 10, 15, 15};
+
+struct config_s {
+    uint32_t devices;
+    uint32_t seconds;
+    uint32_t settle_seconds;
+    uint32_t churn;
+    uint32_t slow_us;
+    uint32_t fail_ppm;
+    uint32_t fill;
+    uint32_t seed;
+    uint32_t report_seconds;
+};
+
+/**
+ * @brief The soak state for a single instrument.
+ *
+ * The script fields belong to the main thread.  The delivered fields
+ * belong to the library thread that calls on_statistics(), and the main
+ * thread only reads them after js110_finalize().
+ */
+struct soak_device_s {
+    // script
+    ULONGLONG arrive_ms;        // the scheduled arrival, 0 for none
+    ULONGLONG fault_end_ms;     // the scheduled fault end, 0 for none
+
+    // delivered
+    bool seen;
+    ULONGLONG delivered_ms;     // the time of the last update
+    int64_t samples_total;
+    double charge;
+    uint64_t updates;
+    uint64_t windows;           // from samples_this
+    uint64_t windows_gap;       // reported in windows_missed
+    int64_t samples_fill;       // filled since the last update
+    uint64_t fills;
+    uint64_t resyncs;
+    uint64_t resync_errors;
+    uint64_t charge_errors;
+};
+
+static struct config_s config_ = {
+    .devices = 256,
+    .seconds = 60,
+    .settle_seconds = 5,
+    .churn = 5,
+    .slow_us = 2000,
+    .fail_ppm = 200000,
+    .fill = 0,
+    .seed = 1,
+    .report_seconds = 10,
+};
+static struct soak_device_s * devices_ = NULL;
+static volatile LONGLONG updates_ = 0;
+static uint32_t rng_ = 1;
+static uint64_t events_[EVENT_COUNT];
+static uint64_t health_[JS110_HEALTH_QUARANTINED + 1];  // polling thread
+
+
+static uint32_t rng_next(void) {
+    uint32_t x = rng_;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rng_ = x;
+    return x;
+}
+
+static uint32_t rng_range(uint32_t lo, uint32_t hi) {
+    return lo + (rng_next() % (hi - lo + 1));
+}
+
+static void on_statistics(void * user_data, struct js110_statistics_s * s) {
+    (void) user_data;
+    InterlockedIncrement64(&updates_);
+    uint32_t idx = (uint32_t) s->serial_number - JS110_SIM_SERIAL_NUMBER_BASE;
+    if (idx >= config_.devices) {
+        return;
+    }
+    struct soak_device_s * d = &devices_[idx];
+    d->delivered_ms = GetTickCount64();
+    int64_t samples_this = s->samples_this;
+    int64_t samples_missed = s->samples_missed;
+    if (s->flags & JS110_FLAG_FILL) {
+        ++d->fills;
+        d->samples_fill += samples_this;
+        samples_missed = 0;
+    } else {
+        ++d->updates;
+        d->windows += (uint64_t) samples_this / JS110_SIM_SAMPLES_PER_WINDOW;
+        d->windows_gap += s->windows_missed;
+        if (s->flags & JS110_FLAG_RESYNC) {
+            ++d->resyncs;
+        }
+        samples_missed -= d->samples_fill;
+        d->samples_fill = 0;
+    }
+    if (d->seen) {
+        int64_t delta = s->samples_total - d->samples_total;
+        if ((delta == samples_this + samples_missed) && !samples_missed && !(s->flags & JS110_FLAG_RESYNC)) {
+            double charge_delta = s->charge - d->charge;
+            double expect = (s->current_mean * samples_this) / s->samples_per_second;
+            if (fabs(charge_delta - expect) > (CHARGE_TOLERANCE_ABS + CHARGE_TOLERANCE_REL * fabs(expect))) {
+                ++d->charge_errors;
+            }
+        } else if (delta == samples_this + samples_missed) {
+            // continuous over the reported gap
+        } else if ((0 == delta) && (s->flags & JS110_FLAG_RESYNC)) {
+            // continued from the accumulators
+        } else {
+            ++d->resync_errors;
+        }
+    }
+    d->seen = true;
+    d->samples_total = s->samples_total;
+    d->charge = s->charge;
+}
+
+static void on_health(void * user_data, uint32_t serial_number, enum js110_health_e health, uint32_t retry_ms) {
+    (void) user_data;
+    (void) serial_number;
+    (void) retry_ms;
+    if ((uint32_t) health <= JS110_HEALTH_QUARANTINED) {
+        ++health_[health];
+    }
+}
+
+static int arg_u32(int argc, char * argv[], int * idx, uint32_t * value) {
+    char * end = NULL;
+    if ((*idx + 1) >= argc) {
+        fprintf(stderr, "%s requires a value\n", argv[*idx]);
+        return 1;
+    }
+    ++*idx;
+    *value = (uint32_t) strtoul(argv[*idx], &end, 0);
+    if (!end || *end) {
+        fprintf(stderr, "invalid value: %s\n", argv[*idx]);
+        return 1;
+    }
+    return 0;
+}
+
+static int args_parse(int argc, char * argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        const char * arg = argv[i];
+        uint32_t * value = NULL;
+        if (0 == strcmp(arg, "--help")) {
+            printf("%s", USAGE);
+            exit(0);
+        } else if (0 == strcmp(arg, "--devices")) {
+            value = &config_.devices;
+        } else if (0 == strcmp(arg, "--seconds")) {
+            value = &config_.seconds;
+        } else if (0 == strcmp(arg, "--settle")) {
+            value = &config_.settle_seconds;
+        } else if (0 == strcmp(arg, "--churn")) {
+            value = &config_.churn;
+        } else if (0 == strcmp(arg, "--slow-us")) {
+            value = &config_.slow_us;
+        } else if (0 == strcmp(arg, "--fail-ppm")) {
+            value = &config_.fail_ppm;
+        } else if (0 == strcmp(arg, "--fill")) {
+            value = &config_.fill;
+        } else if (0 == strcmp(arg, "--seed")) {
+            value = &config_.seed;
+        } else if (0 == strcmp(arg, "--report-seconds")) {
+            value = &config_.report_seconds;
+        } else {
+            fprintf(stderr, "invalid argument: %s\n\n%s", arg, USAGE);
+            return 1;
+        }
+        if (arg_u32(argc, argv, &i, value)) {
+            return 1;
+        }
+    }
+    if (!config_.devices || !config_.seconds || (config_.settle_seconds < 2)) {
+        fprintf(stderr, "invalid --devices, --seconds or --settle\n");
+        return 1;
+    }
+    rng_ = config_.seed ? config_.seed : 1;
+    return 0;
+}
+
+static uint32_t serial_number(uint32_t idx) {
+    return JS110_SIM_SERIAL_NUMBER_BASE + idx;
+}
+
+/// Check if the script can start a new event on an instrument.
+static bool device_idle(uint32_t idx) {
+    return !devices_[idx].arrive_ms && !devices_[idx].fault_end_ms;
+}
+
+static void device_depart(uint32_t idx, ULONGLONG now, uint32_t downtime_ms) {
+    js110_sim_disconnect(serial_number(idx));
+    devices_[idx].arrive_ms = now + downtime_ms;
+}
+
+/// Start a random churn event on a random idle instrument.
+static void event_start(ULONGLONG now) {
+    uint32_t idx = rng_next() % config_.devices;
+    uint32_t pick = rng_next() % 100;
+    enum event_e event = EVENT_REBOOT;
+    for (uint32_t weight = 0; event < EVENT_COUNT; ++event) {
+        weight += EVENT_WEIGHTS[event];
+        if (pick < weight) {
+            break;
+        }
+    }
+    if (!device_idle(idx)) {
+        return;  // busy, skip this event
+    }
+    switch (event) {
+        case EVENT_REBOOT:
+            device_depart(idx, now, rng_range(300, 1500));
+            break;
+        case EVENT_DEPART:
+            device_depart(idx, now, rng_range(2000, 10000));
+            break;
+        case EVENT_HUB_RESET: {
+            uint32_t downtime_ms = rng_range(1000, 3000);
+            uint32_t first = idx - (idx % HUB_SIZE);
+            for (uint32_t i = first; (i < first + HUB_SIZE) && (i < config_.devices); ++i) {
+                if (device_idle(i)) {
+                    device_depart(i, now, downtime_ms);
+                }
+            }
+            break;
+        }
+        case EVENT_SLOW:
+            js110_sim_fault_set(serial_number(idx), config_.slow_us, 0);
+            devices_[idx].fault_end_ms = now + rng_range(1000, 5000);
+            break;
+        case EVENT_FAIL:
+            js110_sim_fault_set(serial_number(idx), config_.slow_us, config_.fail_ppm);
+            devices_[idx].fault_end_ms = now + rng_range(1000, 5000);
+            break;
+        default:
+            return;
+    }
+    ++events_[event];
+}
+
+/// Process the scheduled arrivals and fault ends.
+static void schedule_process(ULONGLONG now, bool force) {
+    for (uint32_t i = 0; i < config_.devices; ++i) {
+        struct soak_device_s * d = &devices_[i];
+        if (d->arrive_ms && (force || (now >= d->arrive_ms))) {
+            js110_sim_connect(serial_number(i));
+            d->arrive_ms = 0;
+        }
+        if (d->fault_end_ms && (force || (now >= d->fault_end_ms))) {
+            js110_sim_fault_set(serial_number(i), 0, 0);
+            d->fault_end_ms = 0;
+        }
+    }
+}
+
+static void progress_report(ULONGLONG elapsed_ms) {
+    struct js110_poll_status_s status;
+    js110_poll_status(&status);
+    fprintf(stderr, "%6.1f s: %u open, %lld updates, %llu scans, %llu us max cycle\n",
+            elapsed_ms / 1000.0, status.devices_open, (long long) updates_,
+            (unsigned long long) status.scans, (unsigned long long) status.cycle_duration_us_max);
+}
+
+int main(int argc, char * argv[]) {
+    struct js110_poll_status_s status;
+    if (args_parse(argc, argv)) {
+        return 1;
+    }
+    devices_ = calloc(config_.devices, sizeof(struct soak_device_s));
+    if (!devices_ || js110_sim_configure(config_.devices)) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    js110_health_callback_set(on_health, NULL);
+    js110_gap_fill_set(config_.fill);
+    if (js110_initialize(on_statistics, NULL)) {
+        fprintf(stderr, "js110_initialize failed\n");
+        return 1;
+    }
+
+    // Churn, then reconnect everything and settle.
+    ULONGLONG t_start = GetTickCount64();
+    ULONGLONG t_churn_end = t_start + config_.seconds * 1000ULL;
+    ULONGLONG t_end = t_churn_end + config_.settle_seconds * 1000ULL;
+    ULONGLONG t_report = t_start + config_.report_seconds * 1000ULL;
+    ULONGLONG t_prev = t_start;
+    double events_due = 0.0;
+    bool settling = false;
+    for (ULONGLONG now = t_start; now < t_end; now = GetTickCount64()) {
+        if (now < t_churn_end) {
+            events_due += (config_.churn * (double) (now - t_prev)) / 1000.0;
+            for (; events_due >= 1.0; events_due -= 1.0) {
+                event_start(now);
+            }
+            schedule_process(now, false);
+        } else if (!settling) {
+            schedule_process(now, true);
+            settling = true;
+        }
+        if (config_.report_seconds && (now >= t_report)) {
+            progress_report(now - t_start);
+            t_report += config_.report_seconds * 1000ULL;
+        }
+        t_prev = now;
+        Sleep(TICK_MS);
+    }
+    // Instruments produce a window every 500 ms, so expect recent updates.
+    ULONGLONG t_stall = GetTickCount64() - STALL_MS;
+    js110_poll_status(&status);
+    js110_finalize();
+
+    // Compare against the ground truth.
+    struct js110_sim_truth_s truth;
+    struct js110_sim_truth_s total;
+    struct soak_device_s sum;
+    uint64_t stalled = 0;
+    uint64_t reboots = 0;
+    double charge_missing = 0.0;
+    memset(&total, 0, sizeof(total));
+    memset(&sum, 0, sizeof(sum));
+    for (uint32_t i = 0; i < config_.devices; ++i) {
+        struct soak_device_s * d = &devices_[i];
+        js110_sim_truth(serial_number(i), &truth);
+        total.boots += truth.boots;
+        total.windows += truth.windows;
+        total.windows_read += truth.windows_read;
+        total.windows_skipped += truth.windows_skipped;
+        total.windows_pending += truth.windows_pending;
+        total.transfer_errors += truth.transfer_errors;
+        total.charge += truth.charge;
+        reboots += truth.boots - 1;
+        charge_missing += truth.charge_read - d->charge;
+        sum.updates += d->updates;
+        sum.windows += d->windows;
+        sum.windows_gap += d->windows_gap;
+        sum.fills += d->fills;
+        sum.resyncs += d->resyncs;
+        sum.resync_errors += d->resync_errors;
+        sum.charge_errors += d->charge_errors;
+        if (truth.connected && (d->delivered_ms < t_stall)) {
+            ++stalled;
+        }
+    }
+    js110_sim_configure(0);
+    int64_t library_drops = (int64_t) (total.windows_read - sum.windows);
+    int64_t silent = (int64_t) total.windows_skipped - (int64_t) sum.windows_gap;
+    double scan_us = status.scans ? ((double) status.scan_duration_us_total / status.scans) : 0.0;
+
+    printf("devices:          %u\n", config_.devices);
+    printf("duration:         %u s churn + %u s settle\n", config_.seconds, config_.settle_seconds);
+    printf("events:          ");
+    for (int k = 0; k < EVENT_COUNT; ++k) {
+        printf(" %s %llu%s", EVENT_NAMES[k], (unsigned long long) events_[k], (k + 1 < EVENT_COUNT) ? "," : "\n");
+    }
+    printf("updates:          %llu\n", (unsigned long long) sum.updates);
+    printf("windows:          %llu produced, %llu read, %llu delivered, %llu pending\n",
+           (unsigned long long) total.windows, (unsigned long long) total.windows_read,
+           (unsigned long long) sum.windows, (unsigned long long) total.windows_pending);
+    printf("missed windows:   %llu (%llu visible, %lld silent)\n",
+           (unsigned long long) total.windows_skipped, (unsigned long long) sum.windows_gap, (long long) silent);
+    printf("library drops:    %lld\n", (long long) library_drops);
+    printf("fill records:     %llu\n", (unsigned long long) sum.fills);
+    printf("resyncs:          %llu for %llu reboots\n",
+           (unsigned long long) sum.resyncs, (unsigned long long) reboots);
+    printf("resync errors:    %llu\n", (unsigned long long) sum.resync_errors);
+    printf("charge errors:    %llu\n", (unsigned long long) sum.charge_errors);
+    printf("charge missing:   %.6f C of %.6f C\n", charge_missing, total.charge);
+    printf("transfer errors:  %llu\n", (unsigned long long) total.transfer_errors);
+    printf("health:           %llu degraded, %llu quarantined, %llu ok, %llu reopens\n",
+           (unsigned long long) health_[JS110_HEALTH_DEGRADED], (unsigned long long) health_[JS110_HEALTH_QUARANTINED],
+           (unsigned long long) health_[JS110_HEALTH_OK], (unsigned long long) status.reopens);
+    printf("stalled devices:  %llu\n", (unsigned long long) stalled);
+    printf("scan duration:    %.1f us average over %llu scans\n", scan_us, (unsigned long long) status.scans);
+    printf("cycle duration:   %.1f us average, %llu us max\n",
+           status.cycles ? ((double) status.cycle_duration_us_total / status.cycles) : 0.0,
+           (unsigned long long) status.cycle_duration_us_max);
+    free(devices_);
+    bool fail = library_drops || sum.resync_errors || sum.charge_errors || stalled;
+    return fail ? 1 : 0;
+}
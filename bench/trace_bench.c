@@ -0,0 +1,100 @@
+/*
+ * Copyright 2020 Jetperch LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Benchmark the trace span overhead.
+ *
+ * Times a small unit of work without spans, with spans while tracing is
+ * disabled, and with spans while recording.  Optionally writes the
+ * recorded trace.
+ *
+ * usage: js110_trace_bench [iterations] [trace_path]
+ */
+
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define RUNS (5)
+
+static volatile uint32_t sink_ = 0;
+
+static double time_s(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// A few nanoseconds of work, like decoding a field.
+static inline void work(uint32_t k) {
+    sink_ = sink_ * 31 + k;
+}
+
+static double bench_none(uint32_t iterations) {
+    double t_start = time_s();
+    for (uint32_t k = 0; k < iterations; ++k) {
+        work(k);
+    }
+    return (time_s() - t_start) * 1e9 / iterations;
+}
+
+static double bench_span(uint32_t iterations) {
+    double t_start = time_s();
+    for (uint32_t k = 0; k < iterations; ++k) {
+        JS110_TRACE_BEGIN(t);
+        work(k);
+        JS110_TRACE_END(t, TRACE_DECODE, k);
+    }
+    return (time_s() - t_start) * 1e9 / iterations;
+}
+
+static double best(double (*fn)(uint32_t), uint32_t iterations) {
+    double result = 0.0;
+    for (int run = 0; run < RUNS; ++run) {
+        double v = fn(iterations);
+        result = (!run || (v < result)) ? v : result;
+    }
+    return result;
+}
+
+int main(int argc, char * argv[]) {
+    uint32_t iterations = (argc > 1) ? (uint32_t) strtoul(argv[1], NULL, 0) : 10000000;
+    const char * path = (argc > 2) ? argv[2] : NULL;
+    if (!iterations) {
+        printf("usage: js110_trace_bench [iterations] [trace_path]\n");
+        return 1;
+    }
+    js110_trace_thread_name("bench");
+    double none_ns = best(bench_none, iterations);
+    double disabled_ns = best(bench_span, iterations);
+    js110_trace_start(0);
+    double enabled_ns = best(bench_span, iterations);
+    js110_trace_stop();
+
+    printf("iterations:       %u\n", iterations);
+    printf("no span:          %.2f ns\n", none_ns);
+    printf("span, disabled:   %.2f ns (+%.2f ns)\n", disabled_ns, disabled_ns - none_ns);
+    printf("span, recording:  %.2f ns (+%.2f ns)\n", enabled_ns, enabled_ns - none_ns);
+    if (path) {
+        if (js110_trace_write(path)) {
+            printf("could not write %s\n", path);
+            return 1;
+        }
+        printf("trace:            %s\n", path);
+    }
+    return 0;
+}
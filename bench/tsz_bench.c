@@ -0,0 +1,304 @@
+/*
+ * Copyright 2020 Jetperch LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Benchmark the js110_tsz compression ratio and throughput.
+ *
+ * Generates a synthetic 2 Hz statistics stream using the same fixed-point
+ * representations as the JS110 status packet, encodes it into blocks, and
+ * then decodes all blocks.
+ *
+ * Before the benchmark, checks that an incompressible block fits in
+ * JS110_TSZ_BLOCK_SIZE_MAX() and that version 1 blocks still decode.
+ *
+ * usage: js110_tsz_bench [records] [block_records]
+ */
+
+#include "js110_tsz.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct stream_s {
+    uint8_t * buf;
+    size_t size;
+    size_t length;
+};
+
+static double time_s(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double fixed(double v, double scale) {
+    return ((double) (int32_t) (v * scale)) / scale;
+}
+
+static double fixed64(double v, double scale) {
+    return ((double) (int64_t) (v * scale)) / scale;
+}
+
+static void generate(struct js110_statistics_s * records, uint32_t count) {
+    double i_level = 0.010;
+    double v_level = 3.3;
+    double charge = 0.0;
+    double energy = 0.0;
+    srand(1);
+    for (uint32_t k = 0; k < count; ++k) {
+        struct js110_statistics_s * s = &records[k];
+        // slowly wandering load with occasional steps
+        i_level += ((rand() % 2001) - 1000) * 1e-8;
+        if (0 == (rand() % 500)) {
+            i_level = (rand() % 1000) * 1e-4;
+        }
+        double noise = (rand() % 1001) * 1e-7;
+        double i_mean = i_level + noise;
+        double v_mean = v_level + ((rand() % 101) - 50) * 1e-5;
+        double p_mean = i_mean * v_mean;
+        charge += i_mean * 0.5;
+        energy += p_mean * 0.5;
+
+        memset(s, 0, sizeof(*s));
+        s->serial_number = 1234;
+        s->samples_this = 1000000;
+        s->samples_per_update = 1000000;
+        s->samples_per_second = 2000000;
+        s->samples_total = (int64_t) (k + 1) * 1000000;
+        s->charge = fixed64(charge, 1LLU << 27);
+        s->energy = fixed64(energy, 1LLU << 27);
+        s->current_mean = fixed(i_mean, 1LU << 27);
+        s->current_min = fixed(i_mean - 10 * noise - 1e-6, 1LU << 27);
+        s->current_max = fixed(i_mean + 10 * noise + 1e-6, 1LU << 27);
+        s->voltage_mean = fixed(v_mean, 1LU << 17);
+        s->voltage_min = fixed(v_mean - 0.001, 1LU << 17);
+        s->voltage_max = fixed(v_mean + 0.001, 1LU << 17);
+        s->power_mean = fixed64(p_mean, 1LLU << 34);
+        s->power_min = fixed(s->current_min * s->voltage_min, 1LU << 21);
+        s->power_max = fixed(s->current_max * s->voltage_max, 1LU << 21);
+    }
+}
+
+static uint64_t rng64_ = 1;
+
+static uint64_t rng64_next(void) {
+    uint64_t x = rng64_;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    rng64_ = x;
+    return x;
+}
+
+/**
+ * @brief Generate records that defeat every encoding.
+ *
+ * The integers alternate between their extremes, so each delta-of-delta
+ * needs 64 bits.  Each double differs from the previous one in a random
+ * pattern whose leading and trailing zero window alternates, so each
+ * XOR entry needs the full window and the full meaningful bits.
+ */
+static void generate_worst(struct js110_statistics_s * records, uint32_t count) {
+    uint64_t bits[11];
+    memset(bits, 0, sizeof(bits));
+    for (uint32_t k = 0; k < count; ++k) {
+        struct js110_statistics_s * s = &records[k];
+        for (int i = 0; i < 11; ++i) {
+            uint64_t x = rng64_next();
+            x = (k & 1) ? ((x | 0x8000000000000002ULL) & ~1ULL) : ((x | 0x4000000000000001ULL) & ~(1ULL << 63));
+            bits[i] ^= x;
+        }
+        s->serial_number = (k & 1) ? 0xffffffffU : 0;
+        s->samples_this = (k & 1) ? INT32_MIN : INT32_MAX;
+        s->samples_per_update = (k & 1) ? INT32_MAX : INT32_MIN;
+        s->samples_per_second = (k & 1) ? INT32_MIN : INT32_MAX;
+        s->samples_total = (k & 1) ? INT64_MIN : INT64_MAX;
+        s->samples_missed = (k & 1) ? INT64_MAX : INT64_MIN;
+        s->windows_missed = (k & 1) ? 0 : 0xffffffffU;
+        s->flags = (k & 1) ? 0xffffffffU : 0;
+        memcpy(&s->charge, &bits[0], 8);
+        memcpy(&s->energy, &bits[1], 8);
+        memcpy(&s->current_mean, &bits[2], 8);
+        memcpy(&s->current_min, &bits[3], 8);
+        memcpy(&s->current_max, &bits[4], 8);
+        memcpy(&s->voltage_mean, &bits[5], 8);
+        memcpy(&s->voltage_min, &bits[6], 8);
+        memcpy(&s->voltage_max, &bits[7], 8);
+        memcpy(&s->power_mean, &bits[8], 8);
+        memcpy(&s->power_min, &bits[9], 8);
+        memcpy(&s->power_max, &bits[10], 8);
+    }
+}
+
+/// Check that the worst case block fits in JS110_TSZ_BLOCK_SIZE_MAX().
+static int check_worst_case(void) {
+    uint32_t count = JS110_TSZ_BLOCK_RECORDS_MAX;
+    uint32_t size_max = JS110_TSZ_BLOCK_SIZE_MAX(JS110_TSZ_BLOCK_RECORDS_MAX);
+    struct js110_statistics_s * records = malloc(sizeof(struct js110_statistics_s) * count);
+    struct js110_statistics_s * decoded = malloc(sizeof(struct js110_statistics_s) * count);
+    uint8_t * block = malloc(size_max);
+    uint32_t block_size = 0;
+    uint32_t n = 0;
+    int rc = 1;
+    if (records && decoded && block) {
+        generate_worst(records, count);
+        if (js110_tsz_encode(records, count, block, size_max, &block_size)) {
+            fprintf(stderr, "worst case: encode failed\n");
+        } else if (js110_tsz_decode(block, block_size, decoded, count, &n) || (n != count)
+                || memcmp(records, decoded, sizeof(struct js110_statistics_s) * count)) {
+            fprintf(stderr, "worst case: decode mismatch\n");
+        } else {
+            printf("worst case:       %u of %u bytes\n", block_size, size_max);
+            rc = 0;
+        }
+    }
+    free(block);
+    free(decoded);
+    free(records);
+    return rc;
+}
+
+/**
+ * @brief Check that version 1 blocks decode.
+ *
+ * A version 1 block is a version 2 block without the last 3 columns,
+ * since the earlier columns use the same encoding.
+ */
+static int check_version_1(void) {
+    struct js110_statistics_s records[64];
+    struct js110_statistics_s decoded[64];
+    uint8_t block[JS110_TSZ_BLOCK_SIZE_MAX(64)];
+    uint32_t block_size = 0;
+    uint32_t n = 0;
+    generate(records, 64);
+    for (uint32_t k = 0; k < 64; ++k) {
+        records[k].samples_missed = k;
+        records[k].windows_missed = k;
+        records[k].flags = JS110_FLAG_GAP;
+    }
+    if (js110_tsz_encode(records, 64, block, sizeof(block), &block_size)) {
+        return 1;
+    }
+    // Find the end of the power_max column.
+    uint32_t offset = JS110_TSZ_HEADER_SIZE;
+    for (int k = 0; k < 16; ++k) {
+        uint32_t sz = block[offset + 1] | (block[offset + 2] << 8) | (block[offset + 3] << 16)
+                | ((uint32_t) block[offset + 4] << 24);
+        offset += 5 + sz;
+    }
+    block[4] = 1;   // version
+    block[5] = 16;  // column count
+    block[8] = (uint8_t) offset;
+    block[9] = (uint8_t) (offset >> 8);
+    block[10] = (uint8_t) (offset >> 16);
+    block[11] = (uint8_t) (offset >> 24);
+    memset(decoded, 0x55, sizeof(decoded));
+    if (js110_tsz_decode(block, offset, decoded, 64, &n) || (64 != n)) {
+        fprintf(stderr, "version 1: decode failed\n");
+        return 1;
+    }
+    for (uint32_t k = 0; k < 64; ++k) {
+        records[k].samples_missed = 0;
+        records[k].windows_missed = 0;
+        records[k].flags = 0;
+    }
+    if (memcmp(records, decoded, sizeof(decoded))) {
+        fprintf(stderr, "version 1: decode mismatch\n");
+        return 1;
+    }
+    printf("version 1:        ok\n");
+    return 0;
+}
+
+static void on_block(void * user_data, const uint8_t * block, uint32_t size) {
+    struct stream_s * stream = (struct stream_s *) user_data;
+    if ((stream->length + size) > stream->size) {
+        fprintf(stderr, "stream overflow\n");
+        exit(1);
+    }
+    memcpy(stream->buf + stream->length, block, size);
+    stream->length += size;
+}
+
+int main(int argc, char * argv[]) {
+    uint32_t count = (argc > 1) ? (uint32_t) strtoul(argv[1], NULL, 0) : 1000000;
+    uint32_t block_records = (argc > 2) ? (uint32_t) strtoul(argv[2], NULL, 0) : JS110_TSZ_BLOCK_RECORDS_MAX;
+    struct js110_statistics_s * records = malloc(sizeof(struct js110_statistics_s) * count);
+    struct js110_statistics_s * decoded = malloc(sizeof(struct js110_statistics_s) * count);
+    struct stream_s stream;
+    if (!count || !block_records || (block_records > JS110_TSZ_BLOCK_RECORDS_MAX)) {
+        fprintf(stderr, "usage: js110_tsz_bench [records] [block_records]\n");
+        return 1;
+    }
+    // XOR encoding can expand incompressible doubles by up to 13 bits.
+    stream.size = 2 * sizeof(struct js110_statistics_s) * (size_t) count
+            + ((size_t) count / block_records + 1) * JS110_TSZ_BLOCK_SIZE_MAX(0);
+    stream.buf = malloc(stream.size);
+    stream.length = 0;
+    if (!records || !decoded || !stream.buf) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    if (check_worst_case() || check_version_1()) {
+        return 1;
+    }
+    generate(records, count);
+    memset(decoded, 0, sizeof(struct js110_statistics_s) * count);
+
+    struct js110_tsz_encoder_s * encoder = js110_tsz_encoder_alloc(block_records, on_block, &stream);
+    double t0 = time_s();
+    for (uint32_t k = 0; k < count; ++k) {
+        js110_tsz_encoder_add(encoder, &records[k]);
+    }
+    js110_tsz_encoder_flush(encoder);
+    double t1 = time_s();
+    js110_tsz_encoder_free(encoder);
+
+    size_t offset = 0;
+    uint32_t decoded_count = 0;
+    while (offset < stream.length) {
+        uint32_t block_size = 0;
+        uint32_t n = 0;
+        if (js110_tsz_block_info(stream.buf + offset, (uint32_t) (stream.length - offset), &block_size, &n)
+                || js110_tsz_decode(stream.buf + offset, block_size, decoded + decoded_count,
+                                    count - decoded_count, &n)) {
+            fprintf(stderr, "decode failed at offset %zu\n", offset);
+            return 1;
+        }
+        offset += block_size;
+        decoded_count += n;
+    }
+    double t2 = time_s();
+
+    if ((decoded_count != count) || memcmp(records, decoded, sizeof(struct js110_statistics_s) * count)) {
+        fprintf(stderr, "decode mismatch\n");
+        return 1;
+    }
+
+    double raw = (double) sizeof(struct js110_statistics_s) * count;
+    printf("records:          %u (%u per block)\n", count, block_records);
+    printf("raw size:         %.0f bytes (%.1f bytes/record)\n", raw, raw / count);
+    printf("compressed size:  %zu bytes (%.2f bytes/record)\n", stream.length, (double) stream.length / count);
+    printf("compression:      %.1fx\n", raw / stream.length);
+    printf("encode:           %.1f Mrecords/s, %.0f MB/s raw\n", count / (t1 - t0) * 1e-6, raw / (t1 - t0) * 1e-6);
+    printf("decode:           %.1f Mrecords/s, %.0f MB/s raw\n", count / (t2 - t1) * 1e-6, raw / (t2 - t1) * 1e-6);
+    free(stream.buf);
+    free(decoded);
+    free(records);
+    return 0;
+}
@@ -0,0 +1,411 @@
+/*
+ * Copyright 2020 Jetperch LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * The reference collector for js110_forward.
+ *
+ * Accepts frames from many forwarders concurrently over TCP and UDP on
+ * the same port, using a single epoll loop.  The collector validates
+ * each frame, tracks the sequence numbers for each source to count lost
+ * and duplicate frames, and optionally writes the records as CSV.  TCP
+ * frames are acknowledged so that the forwarders resend the frames
+ * lost when a connection fails.
+ *
+ * usage: js110_collector [--port N] [--output PATH] [--report-seconds N]
+ */
+
+#include "js110_forward.h"
+#include "js110_tsz.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define EVENTS_MAX (64)
+#define SOURCES_MAX (4096)      // power of 2
+#define RX_SIZE (JS110_FORWARD_FRAME_SIZE_MAX)
+#define UDP_SIZE (65536)
+
+static const char USAGE[] =
+    "usage: js110_collector [options]\n"
+    "\n"
+    "Collect statistics frames from js110_forward forwarders.\n"
+    "\n"
+    "options:\n"
+    "  --port N              The TCP and UDP port.  Default is 9110.\n"
+    "  --output PATH         Write the records as CSV to PATH, - for stdout.\n"
+    "  --report-seconds N    Report the totals to stderr every N seconds.\n"
+    "                        0 disables.  Default is 10.\n"
+    "  --help                Display this help and exit.\n";
+
+/// A TCP connection, which reassembles frames from the byte stream.
+struct conn_s {
+    int fd;
+    uint32_t length;
+    uint8_t * buffer;
+    struct source_s * ack_source;  // the pending acknowledgement or NULL
+};
+
+/// A forwarder, identified by its source id.
+struct source_s {
+    uint64_t source_id;     // 0 for an unused entry
+    uint64_t sequence;      // the last accepted sequence number
+    uint64_t frames;
+    uint64_t records;
+    uint64_t frames_lost;
+    uint64_t frames_duplicate;
+};
+
+struct totals_s {
+    uint64_t connections;
+    uint64_t frames;
+    uint64_t records;
+    uint64_t frames_lost;
+    uint64_t frames_duplicate;
+    uint64_t frames_invalid;
+};
+
+static volatile sig_atomic_t quit_ = 0;
+static struct source_s sources_[SOURCES_MAX];
+static uint32_t source_count_ = 0;
+static struct totals_s totals_;
+static struct js110_statistics_s records_[JS110_TSZ_BLOCK_RECORDS_MAX];
+static FILE * output_ = NULL;
+
+static void on_signal(int signum) {
+    (void) signum;
+    quit_ = 1;
+}
+
+static double time_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int nonblocking_set(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return (flags < 0) ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/// Find or add a source using open addressing.
+static struct source_s * source_get(uint64_t source_id) {
+    uint32_t idx = (uint32_t) ((source_id * 0x9E3779B97F4A7C15LLU) >> 52) & (SOURCES_MAX - 1);
+    for (uint32_t i = 0; i < SOURCES_MAX; ++i) {
+        struct source_s * s = &sources_[(idx + i) & (SOURCES_MAX - 1)];
+        if (s->source_id == source_id) {
+            return s;
+        } else if (!s->source_id) {
+            if (source_count_ >= (SOURCES_MAX * 3 / 4)) {
+                return NULL;
+            }
+            ++source_count_;
+            s->source_id = source_id;
+            return s;
+        }
+    }
+    return NULL;
+}
+
+static void records_write(const struct js110_forward_frame_s * frame, uint32_t count) {
+    for (uint32_t i = 0; i < count; ++i) {
+        const struct js110_statistics_s * r = &records_[i];
+        fprintf(output_, "%016" PRIx64 ",%" PRIu64 ",%u,%d,%d,%d,%" PRId64
+                ",%.6e,%.6e,%.6e,%.6e,%.6e,%.6e,%.6e,%.6e,%.6e,%.6e,%.6e,%" PRId64 ",%u,%u\n",
+                frame->source_id, frame->sequence,
+                r->serial_number, r->samples_this, r->samples_per_update, r->samples_per_second,
+                r->samples_total, r->charge, r->energy,
+                r->current_mean, r->current_min, r->current_max,
+                r->voltage_mean, r->voltage_min, r->voltage_max,
+                r->power_mean, r->power_min, r->power_max,
+                r->samples_missed, r->windows_missed, r->flags);
+    }
+}
+
+/// Process a complete, validated frame, and return its source or NULL.
+static struct source_s * frame_process(const struct js110_forward_frame_s * frame) {
+    uint32_t count = 0;
+    struct source_s * s = source_get(frame->source_id);
+    if (!s || !frame->source_id) {
+        ++totals_.frames_invalid;
+        return NULL;
+    }
+    if (frame->sequence <= s->sequence) {
+        // Resent after a reconnect, or a duplicate UDP datagram.
+        ++s->frames_duplicate;
+        ++totals_.frames_duplicate;
+        return s;
+    }
+    if (js110_tsz_decode(frame->payload, frame->payload_size, records_, JS110_TSZ_BLOCK_RECORDS_MAX, &count)
+            || (count != frame->record_count)) {
+        // Acknowledge anyway, since resending will not help.
+        ++totals_.frames_invalid;
+        s->sequence = frame->sequence;
+        return s;
+    }
+    uint64_t lost = frame->sequence - s->sequence - 1;
+    s->frames_lost += lost;
+    totals_.frames_lost += lost;
+    s->sequence = frame->sequence;
+    ++s->frames;
+    s->records += count;
+    ++totals_.frames;
+    totals_.records += count;
+    if (output_) {
+        records_write(frame, count);
+    }
+    return s;
+}
+
+static void ack_send(struct conn_s * c) {
+    uint8_t ack[JS110_FORWARD_ACK_SIZE];
+    if (c->ack_source) {
+        // Acknowledgements are cumulative, so a failed send is harmless.
+        js110_forward_ack_encode(ack, c->ack_source->source_id, c->ack_source->sequence);
+        send(c->fd, ack, sizeof(ack), MSG_NOSIGNAL);
+        c->ack_source = NULL;
+    }
+}
+
+static void conn_close(int epoll_fd, struct conn_s * c) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    free(c->buffer);
+    free(c);
+}
+
+/// Read from a TCP connection, return nonzero to close the connection.
+static int conn_read(struct conn_s * c) {
+    struct js110_forward_frame_s frame;
+    while (1) {
+        ssize_t sz = recv(c->fd, c->buffer + c->length, RX_SIZE - c->length, 0);
+        if (sz == 0) {
+            return 1;  // closed, discard any partial frame
+        } else if (sz < 0) {
+            return ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) ? 0 : 1;
+        }
+        c->length += (uint32_t) sz;
+        uint32_t offset = 0;
+        while (1) {
+            int rc = js110_forward_frame_parse(c->buffer + offset, c->length - offset, &frame);
+            if (rc == 2) {
+                break;
+            } else if (rc) {
+                ++totals_.frames_invalid;
+                return 1;  // lost framing
+            }
+            struct source_s * s = frame_process(&frame);
+            if (s && (s != c->ack_source)) {
+                ack_send(c);
+                c->ack_source = s;
+            }
+            offset += frame.frame_size;
+        }
+        ack_send(c);
+        if (offset) {
+            memmove(c->buffer, c->buffer + offset, c->length - offset);
+            c->length -= offset;
+        }
+    }
+}
+
+static void udp_read(int fd) {
+    static uint8_t buffer[UDP_SIZE];
+    struct js110_forward_frame_s frame;
+    while (1) {
+        ssize_t sz = recv(fd, buffer, sizeof(buffer), 0);
+        if (sz <= 0) {
+            return;
+        }
+        if (js110_forward_frame_parse(buffer, (uint32_t) sz, &frame) || (frame.frame_size != (uint32_t) sz)) {
+            ++totals_.frames_invalid;
+            continue;
+        }
+        frame_process(&frame);
+    }
+}
+
+static void tcp_accept(int epoll_fd, int listen_fd) {
+    struct epoll_event ev;
+    while (1) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            return;
+        }
+        struct conn_s * c = calloc(1, sizeof(struct conn_s));
+        if (c) {
+            c->buffer = malloc(RX_SIZE);
+        }
+        if (!c || !c->buffer || nonblocking_set(fd)) {
+            if (c) {
+                free(c->buffer);
+            }
+            free(c);
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev)) {
+            free(c->buffer);
+            free(c);
+            close(fd);
+            continue;
+        }
+        ++totals_.connections;
+    }
+}
+
+static int socket_bind(int type, uint16_t port) {
+    struct sockaddr_in addr;
+    int enable = 1;
+    int fd = socket(AF_INET, type, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    if (type == SOCK_DGRAM) {
+        int rcvbuf = 8 << 20;
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr))
+            || ((type == SOCK_STREAM) && listen(fd, SOMAXCONN))
+            || nonblocking_set(fd)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void report(void) {
+    fprintf(stderr, "sources=%u connections=%" PRIu64 " frames=%" PRIu64 " records=%" PRIu64
+            " lost=%" PRIu64 " duplicate=%" PRIu64 " invalid=%" PRIu64 "\n",
+            source_count_, totals_.connections, totals_.frames, totals_.records,
+            totals_.frames_lost, totals_.frames_duplicate, totals_.frames_invalid);
+}
+
+static void report_sources(void) {
+    for (uint32_t i = 0; i < SOURCES_MAX; ++i) {
+        struct source_s * s = &sources_[i];
+        if (s->source_id) {
+            fprintf(stderr, "  source %016" PRIx64 ": frames=%" PRIu64 " records=%" PRIu64
+                    " last_sequence=%" PRIu64 " lost=%" PRIu64 " duplicate=%" PRIu64 "\n",
+                    s->source_id, s->frames, s->records, s->sequence, s->frames_lost, s->frames_duplicate);
+        }
+    }
+}
+
+int main(int argc, char * argv[]) {
+    struct epoll_event ev;
+    struct epoll_event events[EVENTS_MAX];
+    unsigned long port = JS110_FORWARD_PORT_DEFAULT;
+    unsigned long report_seconds = 10;
+    const char * output_path = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if (0 == strcmp(argv[i], "--help")) {
+            printf("%s", USAGE);
+            return 0;
+        } else if ((0 == strcmp(argv[i], "--port")) && ((i + 1) < argc)) {
+            port = strtoul(argv[++i], NULL, 0);
+        } else if ((0 == strcmp(argv[i], "--output")) && ((i + 1) < argc)) {
+            output_path = argv[++i];
+        } else if ((0 == strcmp(argv[i], "--report-seconds")) && ((i + 1) < argc)) {
+            report_seconds = strtoul(argv[++i], NULL, 0);
+        } else {
+            fprintf(stderr, "invalid argument: %s\n\n%s", argv[i], USAGE);
+            return 1;
+        }
+    }
+    if (!port || (port > 65535)) {
+        fprintf(stderr, "invalid port\n");
+        return 1;
+    }
+    if (output_path) {
+        output_ = (0 == strcmp(output_path, "-")) ? stdout : fopen(output_path, "w");
+        if (!output_) {
+            fprintf(stderr, "could not open %s\n", output_path);
+            return 1;
+        }
+        fprintf(output_, "source_id,sequence,serial_number,samples_this,samples_per_update,"
+                "samples_per_second,samples_total,charge,energy,current_mean,current_min,current_max,"
+                "voltage_mean,voltage_min,voltage_max,power_mean,power_min,power_max,"
+                "samples_missed,windows_missed,flags\n");
+    }
+
+    int tcp_fd = socket_bind(SOCK_STREAM, (uint16_t) port);
+    int udp_fd = socket_bind(SOCK_DGRAM, (uint16_t) port);
+    int epoll_fd = epoll_create1(0);
+    if ((tcp_fd < 0) || (udp_fd < 0) || (epoll_fd < 0)) {
+        fprintf(stderr, "could not listen on port %lu\n", port);
+        return 1;
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = &tcp_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, tcp_fd, &ev);
+    ev.data.ptr = &udp_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, udp_fd, &ev);
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    fprintf(stderr, "listening on tcp and udp port %lu\n", port);
+    double report_time = time_s() + report_seconds;
+    while (!quit_) {
+        int n = epoll_wait(epoll_fd, events, EVENTS_MAX, 100);
+        for (int i = 0; i < n; ++i) {
+            void * ptr = events[i].data.ptr;
+            if (ptr == &tcp_fd) {
+                tcp_accept(epoll_fd, tcp_fd);
+            } else if (ptr == &udp_fd) {
+                udp_read(udp_fd);
+            } else {
+                struct conn_s * c = (struct conn_s *) ptr;
+                if (conn_read(c) || (events[i].events & (EPOLLHUP | EPOLLERR))) {
+                    conn_close(epoll_fd, c);
+                }
+            }
+        }
+        if (report_seconds && (time_s() >= report_time)) {
+            report_time += report_seconds;
+            report();
+        }
+    }
+    report();
+    report_sources();
+    if (output_) {
+        fflush(output_);
+        if (output_ != stdout) {
+            fclose(output_);
+        }
+    }
+    close(epoll_fd);
+    close(tcp_fd);
+    close(udp_fd);
+    return 0;
+}
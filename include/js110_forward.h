@@ -0,0 +1,213 @@
+/*
+ * Copyright 2020 Jetperch LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Forward statistics updates to a central collector.
+ *
+ * The forwarder batches updates into compact binary frames and streams
+ * the frames over TCP or UDP.  A private thread builds and sends the
+ * frames, so js110_forward_push() only copies the update into a queue
+ * and is safe to call from the js110_statistics_cbk.
+ *
+ * A frame holds the updates received since the previous frame, up to
+ * the configured record count or time interval.  Each frame carries the
+ * forwarder's source id and a sequence number that increments by one
+ * for each frame, so the collector detects lost and duplicate frames.
+ *
+ * Every frame passes through a spool, which is a local file when
+ * configured and memory otherwise.  Over TCP, the collector acknowledges
+ * frames and a frame leaves the spool once acknowledged.  When the
+ * connection fails, the forwarder reconnects with backoff and resends
+ * all unacknowledged frames in order, so the collector may receive a
+ * frame twice but never loses one while the spool has space.  Collectors
+ * discard frames with a sequence number at or below the last accepted
+ * sequence number for the source.  Over UDP, a frame leaves the spool
+ * once sent.
+ *
+ * Frame format, all values little-endian:
+ *
+ *    0: "JSFW" magic
+ *    4: u16 format version (1)
+ *    6: u16 header size (JS110_FORWARD_HEADER_SIZE)
+ *    8: u32 frame size, including the header
+ *   12: u32 record count
+ *   16: u64 source id
+ *   24: u64 sequence number, starting at 1
+ *   32: i64 frame creation time, in milliseconds since 1970-01-01 UTC
+ *   40: u32 CRC-32 of the payload
+ *   44: u32 reserved (0)
+ *   48: payload, one js110_tsz block with the records
+ *
+ * Over TCP, frames are sent back-to-back.  Over UDP, each datagram holds
+ * exactly one frame.
+ *
+ * Acknowledgement format, sent by the collector over TCP:
+ *
+ *    0: "JSAK" magic
+ *    4: u32 reserved (0)
+ *    8: u64 source id
+ *   16: u64 sequence number, which acknowledges all frames from the
+ *       source up to and including this sequence number
+ */
+
+#ifndef JS110_FORWARD_H__
+#define JS110_FORWARD_H__
+
+#include "js110_statistics.h"
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/// The frame header size, in bytes.
+#define JS110_FORWARD_HEADER_SIZE (48)
+
+/// The maximum frame size, in bytes.
+#define JS110_FORWARD_FRAME_SIZE_MAX (1U << 20)
+
+/// The acknowledgement size, in bytes.
+#define JS110_FORWARD_ACK_SIZE (24)
+
+/// The default collector port.
+#define JS110_FORWARD_PORT_DEFAULT (9110)
+
+/// The forwarder configuration.
+struct js110_forward_config_s {
+    /// The collector as "tcp://host:port" or "udp://host:port".
+    const char * url;
+    /// The source id sent in each frame, or 0 to generate one.  A
+    /// fixed source id needs a spool file, which keeps the sequence
+    /// number across restarts.  Otherwise, the collector discards the
+    /// frames of a restarted forwarder as duplicates.
+    uint64_t source_id;
+    /// The maximum records per frame, or 0 for the default of 256.
+    /// UDP frames are limited to fit in a single datagram.
+    uint32_t batch_records;
+    /// The maximum time to hold a record before sending, in
+    /// milliseconds, or 0 for the default of 1000.
+    uint32_t batch_ms;
+    /// The spool file path, or NULL to spool in memory.  A spool file
+    /// keeps the unsent frames across restarts, and the last sequence
+    /// number in the file with the ".seq" suffix.
+    const char * spool_path;
+    /// The maximum spool size, in bytes, or 0 for 64 MiB.
+    uint64_t spool_bytes_max;
+};
+
+/// The forwarder status.
+struct js110_forward_status_s {
+    /// 1 when connected to the collector, 0 otherwise.
+    int32_t connected;
+    /// The number of records discarded because the queue was full.
+    uint64_t records_dropped;
+    /// The number of records placed into frames.
+    uint64_t records_framed;
+    /// The number of frames sent for the first time.
+    uint64_t frames_sent;
+    /// The number of frames sent again after reconnecting.
+    uint64_t frames_resent;
+    /// The number of frames acknowledged by the collector, TCP only.
+    uint64_t frames_acked;
+    /// The number of frames discarded because the spool was full.
+    uint64_t frames_dropped;
+    /// The number of successful connections.
+    uint64_t connects;
+    /// The current spool size, in bytes, including unacknowledged frames.
+    uint64_t spool_bytes;
+};
+
+/// A parsed frame, see js110_forward_frame_parse().
+struct js110_forward_frame_s {
+    uint32_t frame_size;
+    uint32_t record_count;
+    uint64_t source_id;
+    uint64_t sequence;
+    int64_t time_ms;
+    /// The js110_tsz block, which points into the parsed buffer.
+    const uint8_t * payload;
+    uint32_t payload_size;
+};
+
+/**
+ * @brief Start the forwarder thread.
+ *
+ * @param config The forwarder configuration, which is copied.
+ * @return 0 or error code.
+ *
+ * The frames in an existing spool file are sent once connected.
+ */
+int js110_forward_start(const struct js110_forward_config_s * config);
+
+/**
+ * @brief Queue a statistics update for forwarding.
+ *
+ * @param statistics The statistics update, which is copied.
+ *
+ * Safe to call from the js110_statistics_cbk.  When the queue is full,
+ * the update is discarded and counted.
+ */
+void js110_forward_push(const struct js110_statistics_s * statistics);
+
+/**
+ * @brief Get the forwarder status.
+ *
+ * @param status The status structure to populate.
+ * @return 0 or error code.
+ *
+ * After js110_forward_stop(), returns the final status.
+ */
+int js110_forward_status(struct js110_forward_status_s * status);
+
+/**
+ * @brief Send or spool all queued updates and stop the forwarder thread.
+ *
+ * @return 0 or error code.
+ *
+ * Waits up to one second for the acknowledgements.
+ */
+int js110_forward_stop(void);
+
+/**
+ * @brief Parse and validate a frame.
+ *
+ * @param buffer The received bytes, starting with a frame header.
+ * @param length The number of bytes available at buffer.
+ * @param[out] frame The parsed frame.
+ * @return 0 on success, 1 for an invalid frame, or 2 when buffer does
+ *      not yet contain the entire frame.
+ *
+ * Collectors use this function to find frame boundaries in a TCP stream
+ * and to validate UDP datagrams.  Use js110_tsz_decode() to decode the
+ * payload.
+ */
+int js110_forward_frame_parse(const uint8_t * buffer, uint32_t length, struct js110_forward_frame_s * frame);
+
+/**
+ * @brief Encode an acknowledgement.
+ *
+ * @param buffer The output buffer with at least JS110_FORWARD_ACK_SIZE bytes.
+ * @param source_id The frame source id.
+ * @param sequence The last accepted sequence number for the source.
+ */
+void js110_forward_ack_encode(uint8_t * buffer, uint64_t source_id, uint64_t sequence);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif  /* JS110_FORWARD_H__ */
@@ -0,0 +1,131 @@
+/*
+ * Copyright 2020 Jetperch LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Measure the charge and energy between two points in time.
+ *
+ * A segment latches the device accumulators at js110_segment_begin() and
+ * reports the difference at js110_segment_end(), so test automation does
+ * not need to track the updates itself.  The accumulators are the same
+ * resync-adjusted totals that the updates report, so a segment continues
+ * over device reboots and missed windows.
+ *
+ * The instrument computes its statistics over windows of samples_this
+ * samples, and the library latches the totals of the last window that it
+ * read.  Segment boundaries therefore align to the window boundaries,
+ * and a segment includes the windows that the instrument completes
+ * between the two calls.  Use js110_wait_for_update() to align a test
+ * step to a window.
+ *
+ * The library tracks the minimum and maximum of each open segment with
+ * constant amortized work for each update, regardless of the number of
+ * open segments.
+ */
+
+#ifndef JS110_SEGMENT_H__
+#define JS110_SEGMENT_H__
+
+#include "js110_statistics.h"
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/// The invalid segment handle.
+#define JS110_SEGMENT_HANDLE_INVALID (0U)
+
+/**
+ * @brief The statistics over a segment.
+ *
+ * The minimum and maximum fields are NaN when the segment contains no
+ * window.  They only cover the windows that the library read, so check
+ * flags for JS110_FLAG_GAP.
+ */
+struct js110_segment_s {
+    /// The device serial number.
+    uint32_t serial_number;
+    /// The js110_flag_e bits of the updates in the segment.
+    uint32_t flags;
+    /// The number of windows that the library read.
+    uint32_t windows;
+    /// The sampling frequency, in Hz.
+    int32_t samples_per_second;
+    /// The number of samples, including samples_missed.
+    int64_t samples;
+    /// The number of samples in missed windows.
+    int64_t samples_missed;
+    /// The duration, in seconds, computed from samples.
+    double duration;
+    /// The charge, in coulombs.
+    double charge;
+    /// The energy, in joules.
+    double energy;
+    /// The minimum current of the windows.
+    double current_min;
+    /// The maximum current of the windows.
+    double current_max;
+    /// The minimum voltage of the windows.
+    double voltage_min;
+    /// The maximum voltage of the windows.
+    double voltage_max;
+    /// The minimum power of the windows.
+    double power_min;
+    /// The maximum power of the windows.
+    double power_max;
+};
+
+/**
+ * @brief Begin a segment.
+ *
+ * @param serial_number The device serial number.
+ * @param[out] handle The segment handle for js110_segment_end().
+ * @return 0 or error code.  The call fails when the device has not
+ *      delivered an update since js110_initialize() and when out of
+ *      memory.
+ *
+ * Call from any thread, including js110_statistics_cbk.  The library
+ * supports about one million open segments over all devices.
+ */
+int js110_segment_begin(uint32_t serial_number, uint32_t * handle);
+
+/**
+ * @brief Get the statistics of an open segment.
+ *
+ * @param handle The segment handle from js110_segment_begin().
+ * @param[out] segment The segment statistics so far.
+ * @return 0 or error code, such as for an invalid handle.
+ */
+int js110_segment_get(uint32_t handle, struct js110_segment_s * segment);
+
+/**
+ * @brief End a segment.
+ *
+ * @param handle The segment handle from js110_segment_begin().
+ * @param[out] segment The segment statistics.  NULL discards them.
+ * @return 0 or error code, such as for an invalid handle.
+ *
+ * The handle is invalid after this call.  Segments remain readable
+ * after js110_finalize(), and js110_initialize() ends all segments.
+ */
+int js110_segment_end(uint32_t handle, struct js110_segment_s * segment);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif  /* JS110_SEGMENT_H__ */
@@ -0,0 +1,136 @@
+/*
+ * Copyright 2020 Jetperch LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Control the simulated JS110 instruments.
+ *
+ * The simulated instruments replace real instruments for benchmarks and
+ * load testing.  Each simulated instrument produces a new statistics
+ * window every 500 ms, using the same status packet format as a real
+ * JS110.
+ *
+ * Load tests can also script device arrivals and departures and inject
+ * slow or failing transfers.  Like a real JS110, which is USB powered,
+ * a simulated instrument reboots on each arrival, so its samples_total,
+ * charge and energy restart from 0.  The simulator keeps the ground
+ * truth for each instrument, see js110_sim_truth().
+ */
+
+#ifndef JS110_SIM_H__
+#define JS110_SIM_H__
+
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/// The serial number of the first simulated instrument.
+#define JS110_SIM_SERIAL_NUMBER_BASE (100000)
+
+/// The number of samples in each simulated window.
+#define JS110_SIM_SAMPLES_PER_WINDOW (1000000)
+
+/**
+ * @brief The ground truth for a simulated instrument.
+ *
+ * Each produced window is either read by a status transfer, skipped
+ * because the next window replaced it or the instrument departed first,
+ * or pending, so windows = windows_read + windows_skipped + windows_pending.
+ */
+struct js110_sim_truth_s {
+    /// 1 when connected, 0 when departed.
+    uint32_t connected;
+    /// The number of boots, which is 1 + the number of arrivals.
+    uint32_t boots;
+    /// The number of windows produced over all boots.
+    uint64_t windows;
+    /// The number of windows returned by status transfers.
+    uint64_t windows_read;
+    /// The number of windows never returned by a status transfer.
+    uint64_t windows_skipped;
+    /// The number of produced windows not yet read.
+    uint64_t windows_pending;
+    /// The number of failed transfers, including injected failures.
+    uint64_t transfer_errors;
+    /// The charge produced over all boots, in coulombs.
+    double charge;
+    /// The charge reported by the last read window of each boot, summed
+    /// over all boots, in coulombs.
+    double charge_read;
+};
+
+/**
+ * @brief Use simulated instruments instead of real instruments.
+ *
+ * @param device_count The number of simulated instruments, which have
+ *      serial numbers starting at JS110_SIM_SERIAL_NUMBER_BASE.  0
+ *      uses real instruments.
+ * @return 0 or error code.
+ *
+ * Call before js110_initialize().
+ */
+int js110_sim_configure(uint32_t device_count);
+
+/**
+ * @brief Connect a departed simulated instrument.
+ *
+ * @param serial_number The instrument serial number.
+ * @return 0 or error code.
+ *
+ * The instrument boots and the library scans for devices.
+ */
+int js110_sim_connect(uint32_t serial_number);
+
+/**
+ * @brief Disconnect a simulated instrument.
+ *
+ * @param serial_number The instrument serial number.
+ * @return 0 or error code.
+ *
+ * Transfers with the instrument fail until it reconnects and the library
+ * opens it again.  The library scans for devices.
+ */
+int js110_sim_disconnect(uint32_t serial_number);
+
+/**
+ * @brief Inject transfer faults.
+ *
+ * @param serial_number The instrument serial number.
+ * @param delay_us The additional duration of each status transfer.
+ * @param fail_ppm The probability that each status transfer fails, in
+ *      parts per million.
+ * @return 0 or error code.
+ *
+ * Use 0, 0 to clear the faults.
+ */
+int js110_sim_fault_set(uint32_t serial_number, uint32_t delay_us, uint32_t fail_ppm);
+
+/**
+ * @brief Get the ground truth for a simulated instrument.
+ *
+ * @param serial_number The instrument serial number.
+ * @param truth The truth, populated on success.
+ * @return 0 or error code.
+ */
+int js110_sim_truth(uint32_t serial_number, struct js110_sim_truth_s * truth);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif  /* JS110_SIM_H__ */
@@ -0,0 +1,176 @@
+/*
+ * Copyright 2020 Jetperch LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Constant-memory, mergeable quantile sketch.
+ *
+ * The sketch is a DDSketch with fixed logarithmic bins.  Any quantile
+ * estimate is within JS110_SKETCH_RELATIVE_ACCURACY of the true value for
+ * magnitudes from JS110_SKETCH_VALUE_MIN up to about 6e5.  Smaller
+ * magnitudes count as zero, and larger magnitudes use the last bin.
+ * Sketches with the same bins merge exactly, so sketches from multiple
+ * devices or hosts combine into the same result as a single sketch over
+ * all values.
+ *
+ * The library maintains a sketch of current_mean and power_mean for each
+ * device and for each device group.  See js110_sketch_get() and
+ * js110_sketch_group_get().
+ */
+
+#ifndef JS110_SKETCH_H__
+#define JS110_SKETCH_H__
+
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/// The number of bins for each sign.
+#define JS110_SKETCH_BINS (1024)
+/// The relative accuracy of quantile estimates.
+#define JS110_SKETCH_RELATIVE_ACCURACY (0.02)
+/// The smallest magnitude that is not counted as zero.
+#define JS110_SKETCH_VALUE_MIN (1e-12)
+/// The maximum serialized size, in bytes.
+#define JS110_SKETCH_SERIALIZED_SIZE_MAX (48 + 2 * JS110_SKETCH_BINS * 10)
+/// The number of device groups.
+#define JS110_SKETCH_GROUP_COUNT (16)
+
+/// The statistics fields tracked by the library.
+enum js110_sketch_field_e {
+    JS110_SKETCH_CURRENT_MEAN = 0,
+    JS110_SKETCH_POWER_MEAN = 1,
+    JS110_SKETCH_FIELD_COUNT,
+};
+
+/**
+ * @brief The quantile sketch.
+ */
+struct js110_sketch_s {
+    /// The total number of values.
+    uint64_t count;
+    /// The number of values with magnitude below JS110_SKETCH_VALUE_MIN.
+    uint64_t zero_count;
+    /// The exact minimum value.
+    double min;
+    /// The exact maximum value.
+    double max;
+    /// The bin counts for positive values.
+    uint64_t positive[JS110_SKETCH_BINS];
+    /// The bin counts for negative values, by magnitude.
+    uint64_t negative[JS110_SKETCH_BINS];
+};
+
+/**
+ * @brief Clear a sketch.
+ *
+ * @param self The sketch.
+ */
+void js110_sketch_clear(struct js110_sketch_s * self);
+
+/**
+ * @brief Add a value to a sketch.
+ *
+ * @param self The sketch.
+ * @param value The value.  NaN is ignored.
+ */
+void js110_sketch_add(struct js110_sketch_s * self, double value);
+
+/**
+ * @brief Merge one sketch into another.
+ *
+ * @param self The sketch, which is modified.
+ * @param other The sketch to merge into self.
+ */
+void js110_sketch_merge(struct js110_sketch_s * self, const struct js110_sketch_s * other);
+
+/**
+ * @brief Estimate a quantile.
+ *
+ * @param self The sketch.
+ * @param q The quantile from 0.0 to 1.0, such as 0.99 for p99.
+ * @return The estimated value, or NaN if the sketch is empty.
+ */
+double js110_sketch_quantile(const struct js110_sketch_s * self, double q);
+
+/**
+ * @brief Serialize a sketch to a compact, portable byte representation.
+ *
+ * @param self The sketch.
+ * @param buffer The output buffer.
+ * @param size The size of buffer, in bytes.  JS110_SKETCH_SERIALIZED_SIZE_MAX
+ *      is always sufficient.
+ * @param[out] length The serialized length, in bytes.
+ * @return 0 or error code.
+ */
+int js110_sketch_serialize(const struct js110_sketch_s * self, uint8_t * buffer, uint32_t size, uint32_t * length);
+
+/**
+ * @brief Deserialize a sketch.
+ *
+ * @param self The sketch to populate.
+ * @param buffer The serialized sketch.
+ * @param length The length of buffer, in bytes.
+ * @return 0 or error code.
+ *
+ * Use js110_sketch_merge() to combine the result with other sketches.
+ */
+int js110_sketch_deserialize(struct js110_sketch_s * self, const uint8_t * buffer, uint32_t length);
+
+/**
+ * @brief Get a copy of a device's sketch.
+ *
+ * @param serial_number The device serial number.
+ * @param field The statistics field.
+ * @param sketch The sketch to populate.
+ * @return 0 or error code.
+ *
+ * Safe to call from any thread.  The sketches remain available after
+ * js110_finalize() until the next js110_initialize().
+ */
+int js110_sketch_get(uint32_t serial_number, enum js110_sketch_field_e field, struct js110_sketch_s * sketch);
+
+/**
+ * @brief Assign a device to a group.
+ *
+ * @param serial_number The device serial number.
+ * @param group The group from 0 to JS110_SKETCH_GROUP_COUNT - 1, or -1
+ *      to remove the device from its group.
+ * @return 0 or error code.
+ *
+ * Group sketches only include the values received while the device
+ * belongs to the group.  Assignments may be made before js110_initialize()
+ * and persist across js110_initialize() calls.
+ */
+int js110_sketch_group_set(uint32_t serial_number, int32_t group);
+
+/**
+ * @brief Get a copy of a group's sketch.
+ *
+ * @param group The group from 0 to JS110_SKETCH_GROUP_COUNT - 1.
+ * @param field The statistics field.
+ * @param sketch The sketch to populate.
+ * @return 0 or error code.
+ */
+int js110_sketch_group_get(int32_t group, enum js110_sketch_field_e field, struct js110_sketch_s * sketch);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif  /* JS110_SKETCH_H__ */
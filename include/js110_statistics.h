@@ -65,8 +65,85 @@ struct js110_statistics_s {
     double power_min;
     /// The maximum power over samples_this samples.
     double power_max;
+
+    /// The samples missed between the previous update and this window.
+    int64_t samples_missed;
+    /// The windows missed between the previous update and this window.
+    uint32_t windows_missed;
+    /// The js110_flag_e bits.
+    uint32_t flags;
+};
+
+/**
+ * @brief The flags of struct js110_statistics_s.
+ *
+ * The library expects samples_total to advance by samples_this from one
+ * update to the next.  When it advances further, the instrument
+ * produced windows that the library could not read in time, such as
+ * when a polling cycle overran, and the update reports them in
+ * samples_missed and windows_missed.  charge and energy include the
+ * missed windows.
+ */
+enum js110_flag_e {
+    /// Windows were missed before this update.
+    JS110_FLAG_GAP = (1U << 0),
+    /**
+     * The instrument rebooted, or the library could not determine the
+     * continuity.  After a reboot, the totals continue with the samples
+     * since the reboot, which count as missed, but any window lost
+     * while the instrument was disconnected is unknown.
+     */
+    JS110_FLAG_RESYNC = (1U << 1),
+    /// An interpolated record for a missed window, see js110_gap_fill_set().
+    JS110_FLAG_FILL = (1U << 2),
+};
+
+/**
+ * @brief The gap totals for a single device.
+ */
+struct js110_gap_s {
+    /// The number of updates with JS110_FLAG_GAP.
+    uint64_t gaps;
+    /// The total windows_missed.
+    uint64_t windows_missed;
+    /// The total samples_missed.
+    int64_t samples_missed;
+    /// The number of updates with JS110_FLAG_RESYNC.
+    uint64_t resyncs;
+    /// The number of fill records delivered.
+    uint64_t fills;
 };
 
+/**
+ * @brief The fields of struct js110_statistics_s, as bits for js110_fields_set().
+ *
+ * The bit positions follow the member order of struct js110_statistics_s.
+ */
+enum js110_field_e {
+    JS110_FIELD_SERIAL_NUMBER = (1U << 0),
+    JS110_FIELD_SAMPLES_THIS = (1U << 1),
+    JS110_FIELD_SAMPLES_PER_UPDATE = (1U << 2),
+    JS110_FIELD_SAMPLES_PER_SECOND = (1U << 3),
+    JS110_FIELD_SAMPLES_TOTAL = (1U << 4),
+    JS110_FIELD_CHARGE = (1U << 5),
+    JS110_FIELD_ENERGY = (1U << 6),
+    JS110_FIELD_CURRENT_MEAN = (1U << 7),
+    JS110_FIELD_CURRENT_MIN = (1U << 8),
+    JS110_FIELD_CURRENT_MAX = (1U << 9),
+    JS110_FIELD_VOLTAGE_MEAN = (1U << 10),
+    JS110_FIELD_VOLTAGE_MIN = (1U << 11),
+    JS110_FIELD_VOLTAGE_MAX = (1U << 12),
+    JS110_FIELD_POWER_MEAN = (1U << 13),
+    JS110_FIELD_POWER_MIN = (1U << 14),
+    JS110_FIELD_POWER_MAX = (1U << 15),
+    JS110_FIELD_SAMPLES_MISSED = (1U << 16),
+    JS110_FIELD_WINDOWS_MISSED = (1U << 17),
+    JS110_FIELD_FLAGS = (1U << 18),
+};
+
+/// The js110_field_e mask that selects all fields.
+#define JS110_FIELD_ALL (0x7ffffU)
+
 /**
  * @brief The function called for each statistics update.
  *
@@ -74,12 +151,122 @@ struct js110_statistics_s {
  * @param statistics The statistics update structure.  The pointer
  *      is on loan for the duration of the function call.
  *
- * This function is called from the js110_statistics thread.
+ * This function is called from the js110_statistics thread, or from
+ * the dispatcher thread for slow consumers (see js110_coalesce_set()).
  * The function is responsible for performing any necessary thread
  * synchronization.
  */
 typedef void (*js110_statistics_cbk)(void * user_data, struct js110_statistics_s * statistics);
 
+/**
+ * @brief The policy for combining updates held for a slow consumer.
+ *
+ * When js110_statistics_cbk takes too long, the library moves delivery
+ * to a dedicated dispatcher thread so that device polling continues.
+ * Each device then holds at most one pending update.  Windows that arrive
+ * before the pending update is delivered are combined using this policy.
+ * In all cases samples_total, charge and energy are the exact values from
+ * the newest window.
+ */
+enum js110_coalesce_e {
+    /**
+     * Merge the skipped windows into the pending update.  The minimums
+     * and maximums cover all windows, the means are weighted by
+     * samples_this, and samples_this is the sum over all windows.
+     */
+    JS110_COALESCE_MERGE = 0,
+    /**
+     * Keep only the newest window and drop the skipped windows, which
+     * js110_dispatch_status() counts in windows_dropped.  The update
+     * keeps the samples_missed, windows_missed and flags of the
+     * dropped windows, which only report the instrument gaps.
+     */
+    JS110_COALESCE_LATEST = 1,
+};
+
+/**
+ * @brief The health of a device.
+ *
+ * A device that fails consecutive status transfers, or takes over 100 ms
+ * to complete them, is closed and opened again.  If it keeps failing,
+ * the library quarantines it and stops polling it.  Each retry happens
+ * after an exponential backoff with random jitter, so failing devices
+ * have a bounded effect on the polling cycle of the other devices.  The
+ * first successful transfer returns the device to JS110_HEALTH_OK.
+ */
+enum js110_health_e {
+    /// The device is polled normally.
+    JS110_HEALTH_OK = 0,
+    /// Recent status transfers failed, but the device is still polled.
+    JS110_HEALTH_DEGRADED = 1,
+    /// The device is closed and not polled until the retry.
+    JS110_HEALTH_QUARANTINED = 2,
+};
+
+/**
+ * @brief The function called when the health of a device changes.
+ *
+ * @param user_data The arbitrary data.
+ * @param serial_number The device serial number.
+ * @param health The new js110_health_e.
+ * @param retry_ms For JS110_HEALTH_QUARANTINED, the duration until
+ *      the retry, in milliseconds.  Otherwise 0.
+ *
+ * Each failed quarantine retry calls this function again with the
+ * longer backoff.  This function is called from the js110_statistics
+ * thread and must return quickly.
+ */
+typedef void (*js110_health_cbk)(void * user_data, uint32_t serial_number,
+                                 enum js110_health_e health, uint32_t retry_ms);
+
+/**
+ * @brief The update delivery status.
+ */
+struct js110_dispatch_status_s {
+    /// 1 when delivery runs on the dispatcher thread, 0 when direct.
+    int32_t active;
+    /// The number of js110_statistics_cbk calls.
+    uint64_t updates_delivered;
+    /// The number of windows merged into a pending update.
+    uint64_t windows_merged;
+    /// The number of windows replaced by a newer window.
+    uint64_t windows_dropped;
+};
+
+/**
+ * @brief The device polling loop status.
+ *
+ * Each cycle of the polling loop requests the status from every open
+ * device.  The cycle durations only include this polling work, and
+ * exclude device scans and the sleep between cycles.
+ */
+struct js110_poll_status_s {
+    /// The number of open devices in the last cycle.
+    uint32_t devices_open;
+    /// The current device table capacity, which grows as needed.
+    uint32_t device_capacity;
+    /// The number of completed polling cycles.
+    uint64_t cycles;
+    /// The duration of the last cycle, in microseconds.
+    uint64_t cycle_duration_us_last;
+    /// The maximum cycle duration, in microseconds.
+    uint64_t cycle_duration_us_max;
+    /// The total duration of all cycles, in microseconds.
+    uint64_t cycle_duration_us_total;
+    /// The number of device scans.
+    uint64_t scans;
+    /// The total duration of all device scans, in microseconds.
+    uint64_t scan_duration_us_total;
+    /// The number of quarantined devices in the last cycle.
+    uint32_t devices_quarantined;
+    /// The number of failed status transfers, including slow transfers.
+    uint64_t transfer_errors;
+    /// The number of times that a failing device was opened again.
+    uint64_t reopens;
+    /// The number of times that a device entered quarantine.
+    uint64_t quarantines;
+};
+
 /**
  * @brief Initialize the JS110 statistics library.
  *
@@ -101,6 +288,164 @@ int js110_initialize(js110_statistics_cbk cbk_fn, void * cbk_user_data);
  */
 int js110_finalize(void);
 
+/**
+ * @brief Persist the accumulated totals across host process restarts.
+ *
+ * @param path The checkpoint file path, which is created if needed.
+ *      NULL disables the checkpoint.
+ * @param flush_interval_ms The interval between disk flushes, in
+ *      milliseconds.
+ * @return 0 or error code.
+ *
+ * Call before js110_initialize().  The library records the accumulated
+ * samples_total, charge and energy for each serial number in a small
+ * memory-mapped file on every window.  When a device opens after a
+ * restart, the library continues its totals from the checkpoint:
+ *
+ * - If the instrument kept running while the host was down, the totals
+ *   include the entire downtime and no windows are lost.
+ * - If the instrument rebooted while the host was down, the totals
+ *   continue from the last checkpointed window, and the windows between
+ *   the last checkpoint and the reboot are lost.
+ *
+ * A crash of the host process alone loses no checkpointed windows,
+ * since the operating system owns the mapped pages.  An operating system
+ * crash or power failure loses at most flush_interval_ms of windows, about
+ * 2 windows per second per device, plus the disk write latency.
+ */
+int js110_checkpoint_set(const char * path, uint32_t flush_interval_ms);
+
+/**
+ * @brief Configure slow consumer handling.
+ *
+ * @param mode The js110_coalesce_e policy for skipped windows.
+ * @param slow_threshold_ms The js110_statistics_cbk duration, in
+ *      milliseconds, that moves delivery to the dispatcher thread.
+ *      0 uses the dispatcher thread from the start.
+ * @return 0 or error code.
+ *
+ * The default is JS110_COALESCE_MERGE with a 10 millisecond threshold.
+ * Once delivery moves to the dispatcher thread, it remains there
+ * until js110_finalize().
+ */
+int js110_coalesce_set(enum js110_coalesce_e mode, uint32_t slow_threshold_ms);
+
+/**
+ * @brief Set the interval between device polling cycles.
+ *
+ * @param interval_ms The interval in milliseconds.  The default is 100.
+ * @return 0 or error code.
+ *
+ * The polling thread waits on an event between cycles, so device
+ * changes, js110_finalize() and this function wake it immediately.
+ */
+int js110_poll_interval_set(uint32_t interval_ms);
+
+/**
+ * @brief Set the function called when the health of a device changes.
+ *
+ * @param cbk_fn The function to call, or NULL to disable.
+ * @param cbk_user_data The arbitrary data for cbk_fn.
+ * @return 0 or error code.
+ *
+ * Call before js110_initialize().
+ */
+int js110_health_callback_set(js110_health_cbk cbk_fn, void * cbk_user_data);
+
+/**
+ * @brief Deliver interpolated records for missed windows.
+ *
+ * @param windows_max The maximum number of missed windows to fill
+ *      before an update.  0 (default) disables.
+ * @return 0 or error code.
+ *
+ * Before an update with JS110_FLAG_GAP that missed at most windows_max
+ * whole windows, the library delivers one record with JS110_FLAG_FILL
+ * for each missed window.  Since charge and energy include the missed
+ * windows, the fill records have the exact mean current and power over
+ * the gap, with equal minimum and maximum.  The voltage fields repeat
+ * the following window.  samples_total, charge and energy advance
+ * evenly over the fill records, so the update stream has no gap in
+ * samples_total.  The update after the fill records still reports the
+ * gap.  The library only delivers fill records while it calls
+ * js110_statistics_cbk directly, and not from the dispatcher thread,
+ * see js110_coalesce_set().  Call at any time.
+ */
+int js110_gap_fill_set(uint32_t windows_max);
+
+/**
+ * @brief Get the gap totals for a device.
+ *
+ * @param serial_number The device serial number.
+ * @param gap The gap totals, populated on success.
+ * @return 0 or error code.
+ */
+int js110_gap_get(uint32_t serial_number, struct js110_gap_s * gap);
+
+/// Wait forever in js110_wait_for_update().
+#define JS110_TIMEOUT_INFINITE (0xffffffffU)
+
+/**
+ * @brief Wait for the next update delivery.
+ *
+ * @param timeout_ms The maximum time to wait in milliseconds, or
+ *      JS110_TIMEOUT_INFINITE.
+ * @return 0 when js110_statistics_cbk returned from an update during
+ *      the wait, 1 on timeout, or 2 when the library is not running,
+ *      including when js110_finalize() ends the wait.
+ *
+ * Use this function to block a consumer thread instead of polling.
+ * Updates delivered before the call do not end the wait, so process
+ * everything that the callback queued after each return.  Do not call
+ * from js110_statistics_cbk.
+ */
+int js110_wait_for_update(uint32_t timeout_ms);
+
+/**
+ * @brief Get the update delivery status.
+ *
+ * @param status The status structure to populate.
+ * @return 0 or error code.
+ */
+int js110_dispatch_status(struct js110_dispatch_status_s * status);
+
+/**
+ * @brief Get the device polling loop status.
+ *
+ * @param status The status structure to populate.
+ * @return 0 or error code.
+ */
+int js110_poll_status(struct js110_poll_status_s * status);
+
+/**
+ * @brief Select the fields to decode for each update.
+ *
+ * @param fields The js110_field_e bit mask.  The default is
+ *      JS110_FIELD_ALL.
+ * @return 0 or error code.
+ *
+ * The library decodes only the selected fields of each status packet,
+ * along with the few fields that it uses internally.  The remaining
+ * fields of the update passed to js110_statistics_cbk are 0 until
+ * decoded with js110_statistics_decode().  Call at any time.
+ */
+int js110_fields_set(uint32_t fields);
+
+/**
+ * @brief Decode additional fields of an update on demand.
+ *
+ * @param statistics The update passed to js110_statistics_cbk.
+ * @param fields The js110_field_e bit mask of the fields to decode.
+ * @return 0 or error code.
+ *
+ * The library keeps the raw status packet with each update, so
+ * js110_statistics_decode() only converts the fields not yet decoded.
+ * Only call from within js110_statistics_cbk with the statistics
+ * pointer on loan to the callback.  Copies of the update are not
+ * supported and return an error.
+ */
+int js110_statistics_decode(struct js110_statistics_s * statistics, uint32_t fields);
+
 
 #if defined(__cplusplus)
 }
@@ -0,0 +1,194 @@
+/*
+ * Copyright 2020 Jetperch LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Header-only C++17 wrapper with compile-time field selection.
+ *
+ * The template arguments select the fields to decode for each update.
+ * Accessing a field that was not selected fails to compile, unless the
+ * code explicitly decodes the field on demand:
+ *
+ *     using Fields = js110::Session<js110::Field::current_mean, js110::Field::charge>;
+ *     Fields session([](Fields::update_type & u) {
+ *         double i = u.get<js110::Field::current_mean>();
+ *         double q = u.get<js110::Field::charge>();
+ *         double v = u.decode<js110::Field::voltage_mean>();  // on demand
+ *         ...
+ *     });
+ *     session.start();
+ *
+ * Like the C API, the functions return 0 or an error code.
+ */
+
+#ifndef JS110_STATISTICS_HPP__
+#define JS110_STATISTICS_HPP__
+
+#include "js110_statistics.h"
+#include <cstdint>
+#include <functional>
+#include <utility>
+
+namespace js110 {
+
+/// The fields of struct js110_statistics_s, see js110_field_e.
+enum class Field : uint32_t {
+    serial_number = JS110_FIELD_SERIAL_NUMBER,
+    samples_this = JS110_FIELD_SAMPLES_THIS,
+    samples_per_update = JS110_FIELD_SAMPLES_PER_UPDATE,
+    samples_per_second = JS110_FIELD_SAMPLES_PER_SECOND,
+    samples_total = JS110_FIELD_SAMPLES_TOTAL,
+    charge = JS110_FIELD_CHARGE,
+    energy = JS110_FIELD_ENERGY,
+    current_mean = JS110_FIELD_CURRENT_MEAN,
+    current_min = JS110_FIELD_CURRENT_MIN,
+    current_max = JS110_FIELD_CURRENT_MAX,
+    voltage_mean = JS110_FIELD_VOLTAGE_MEAN,
+    voltage_min = JS110_FIELD_VOLTAGE_MIN,
+    voltage_max = JS110_FIELD_VOLTAGE_MAX,
+    power_mean = JS110_FIELD_POWER_MEAN,
+    power_min = JS110_FIELD_POWER_MIN,
+    power_max = JS110_FIELD_POWER_MAX,
+    samples_missed = JS110_FIELD_SAMPLES_MISSED,
+    windows_missed = JS110_FIELD_WINDOWS_MISSED,
+    flags = JS110_FIELD_FLAGS,
+};
+
+namespace detail {
+
+/// Map each Field to its member of struct js110_statistics_s.
+template <Field F> struct field_traits;
+
+#define JS110_FIELD_TRAITS(name_)                                               \
+    template <> struct field_traits<Field::name_> {                             \
+        using type = decltype(js110_statistics_s::name_);                       \
+        static type get(const js110_statistics_s & s) { return s.name_; }       \
+    }
+JS110_FIELD_TRAITS(serial_number);
+JS110_FIELD_TRAITS(samples_this);
+JS110_FIELD_TRAITS(samples_per_update);
+JS110_FIELD_TRAITS(samples_per_second);
+JS110_FIELD_TRAITS(samples_total);
+JS110_FIELD_TRAITS(charge);
+JS110_FIELD_TRAITS(energy);
+JS110_FIELD_TRAITS(current_mean);
+JS110_FIELD_TRAITS(current_min);
+JS110_FIELD_TRAITS(current_max);
+JS110_FIELD_TRAITS(voltage_mean);
+JS110_FIELD_TRAITS(voltage_min);
+JS110_FIELD_TRAITS(voltage_max);
+JS110_FIELD_TRAITS(power_mean);
+JS110_FIELD_TRAITS(power_min);
+JS110_FIELD_TRAITS(power_max);
+JS110_FIELD_TRAITS(samples_missed);
+JS110_FIELD_TRAITS(windows_missed);
+JS110_FIELD_TRAITS(flags);
+#undef JS110_FIELD_TRAITS
+
+}  // namespace detail
+
+/**
+ * @brief A statistics update with the compile-time selected fields.
+ *
+ * The update is on loan for the duration of the Session callback.
+ */
+template <Field... Fs>
+class Update {
+public:
+    /// The js110_field_e mask of the selected fields.
+    static constexpr uint32_t fields = (JS110_FIELD_SERIAL_NUMBER | ... | static_cast<uint32_t>(Fs));
+
+    explicit Update(js110_statistics_s * statistics) : statistics_(statistics) {}
+
+    /// Get a selected field.
+    template <Field F>
+    typename detail::field_traits<F>::type get() const {
+        static_assert(0 != (fields & static_cast<uint32_t>(F)),
+                      "field not selected, use decode<F>() instead");
+        return detail::field_traits<F>::get(*statistics_);
+    }
+
+    /// Decode and get any field, see js110_statistics_decode().
+    template <Field F>
+    typename detail::field_traits<F>::type decode() {
+        js110_statistics_decode(statistics_, static_cast<uint32_t>(F));
+        return detail::field_traits<F>::get(*statistics_);
+    }
+
+    /// Get the underlying update, where unselected fields may be 0.
+    const js110_statistics_s & statistics() const {
+        return *statistics_;
+    }
+
+private:
+    js110_statistics_s * statistics_;
+};
+
+/**
+ * @brief Receive the statistics with the compile-time selected fields.
+ *
+ * Like js110_initialize(), only one Session may run at a time.
+ */
+template <Field... Fs>
+class Session {
+public:
+    using update_type = Update<Fs...>;
+    using callback_type = std::function<void(update_type &)>;
+
+    explicit Session(callback_type callback) : callback_(std::move(callback)) {}
+    Session(const Session &) = delete;
+    Session & operator=(const Session &) = delete;
+
+    ~Session() {
+        stop();
+    }
+
+    /// Select the fields and start the library.
+    int start() {
+        if (running_) {
+            return 1;
+        }
+        int rc = js110_fields_set(update_type::fields);
+        if (!rc) {
+            rc = js110_initialize(&Session::on_statistics, this);
+        }
+        running_ = (0 == rc);
+        return rc;
+    }
+
+    /// Stop the library.
+    int stop() {
+        if (!running_) {
+            return 0;
+        }
+        running_ = false;
+        return js110_finalize();
+    }
+
+private:
+    static void on_statistics(void * user_data, js110_statistics_s * statistics) {
+        Session * self = static_cast<Session *>(user_data);
+        update_type update(statistics);
+        self->callback_(update);
+    }
+
+    callback_type callback_;
+    bool running_ = false;
+};
+
+}  // namespace js110
+
+#endif  /* JS110_STATISTICS_HPP__ */
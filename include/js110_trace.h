@@ -0,0 +1,80 @@
+/*
+ * Copyright 2020 Jetperch LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Record where the library threads spend their time.
+ *
+ * When enabled, the library records spans for each polling cycle,
+ * device scan and enumeration, device open, status transfer, status
+ * decode and js110_statistics_cbk call, tagged with the device serial
+ * number.  Each thread writes to its own fixed-size ring buffer without
+ * locks, so the newest events per thread are kept.  js110_trace_write()
+ * produces the Chrome trace-event JSON format, which chrome://tracing
+ * and https://ui.perfetto.dev display as a timeline.
+ *
+ * When disabled, each span costs a test of a global flag.
+ */
+
+#ifndef JS110_TRACE_H__
+#define JS110_TRACE_H__
+
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/// The default number of events kept for each thread.
+#define JS110_TRACE_EVENTS_DEFAULT (65536)
+
+/**
+ * @brief Start recording.
+ *
+ * @param events_per_thread The ring buffer size for each thread, or 0
+ *      for JS110_TRACE_EVENTS_DEFAULT.  Buffers allocated by an earlier
+ *      js110_trace_start() keep their size.
+ * @return 0 or error code.
+ *
+ * Discards the previously recorded events.  Call at any time.
+ */
+int js110_trace_start(uint32_t events_per_thread);
+
+/**
+ * @brief Stop recording.
+ *
+ * @return 0 or error code.
+ *
+ * The recorded events remain available to js110_trace_write().
+ */
+int js110_trace_stop(void);
+
+/**
+ * @brief Write the recorded events as Chrome trace-event JSON.
+ *
+ * @param path The output file path.
+ * @return 0 or error code.
+ *
+ * Call at any time, including while recording.  Events that a thread
+ * overwrites during the write are skipped.
+ */
+int js110_trace_write(const char * path);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif  /* JS110_TRACE_H__ */
@@ -0,0 +1,162 @@
+/*
+ * Copyright 2020 Jetperch LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Compressed time-series storage for statistics updates.
+ *
+ * The encoder groups consecutive js110_statistics_s updates into blocks.
+ * Each block stores every field as a separate column, and each column
+ * uses the smallest of:
+ *
+ * - constant: the same value for every record.
+ * - run-length: (value, count) pairs for slowly changing values.
+ * - delta-of-delta: for integer fields, such as samples_total, which
+ *   usually increments by a fixed stride.
+ * - XOR: for double fields, which store the XOR with the previous value
+ *   using the leading and trailing zero counts.
+ *
+ * Feed the encoder with updates from a single instrument for the best
+ * compression.  Blocks are self-contained and can be decoded
+ * independently.  Blocks are written back-to-back in a stream, and
+ * js110_tsz_block_info() finds the block boundaries.
+ */
+
+#ifndef JS110_TSZ_H__
+#define JS110_TSZ_H__
+
+#include "js110_statistics.h"
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/// The maximum number of records in a single block.
+#define JS110_TSZ_BLOCK_RECORDS_MAX (1024)
+
+/// The block header size, in bytes.
+#define JS110_TSZ_HEADER_SIZE (16)
+
+/// The number of columns, one for each field of struct js110_statistics_s.
+#define JS110_TSZ_COLUMN_COUNT (19)
+
+/// The maximum encoded block size for a given record count, in bytes.
+#define JS110_TSZ_BLOCK_SIZE_MAX(records) \
+    (JS110_TSZ_HEADER_SIZE + JS110_TSZ_COLUMN_COUNT * (13 + (((records) * 77 + 7) / 8)))
+
+/**
+ * @brief The function called with each completed block.
+ *
+ * @param user_data The arbitrary data.
+ * @param block The encoded block, which is on loan for the duration
+ *      of the function call.
+ * @param size The size of block, in bytes.
+ */
+typedef void (*js110_tsz_write_fn)(void * user_data, const uint8_t * block, uint32_t size);
+
+/// The opaque streaming encoder instance.
+struct js110_tsz_encoder_s;
+
+/**
+ * @brief Allocate a new streaming encoder.
+ *
+ * @param block_records The number of records per block, up to
+ *      JS110_TSZ_BLOCK_RECORDS_MAX.  0 uses JS110_TSZ_BLOCK_RECORDS_MAX.
+ * @param write_fn The function called with each completed block.
+ * @param user_data The arbitrary data for write_fn.
+ * @return The new encoder or NULL on error.
+ */
+struct js110_tsz_encoder_s * js110_tsz_encoder_alloc(
+        uint32_t block_records, js110_tsz_write_fn write_fn, void * user_data);
+
+/**
+ * @brief Free an encoder.
+ *
+ * @param self The encoder.  Any partial block is discarded, so call
+ *      js110_tsz_encoder_flush() first to keep it.
+ */
+void js110_tsz_encoder_free(struct js110_tsz_encoder_s * self);
+
+/**
+ * @brief Add a record to the encoder.
+ *
+ * @param self The encoder.
+ * @param statistics The record, which is copied.
+ * @return 0 or error code.
+ *
+ * When the block is full, this function encodes the block and calls
+ * the write_fn before returning.
+ */
+int js110_tsz_encoder_add(struct js110_tsz_encoder_s * self, const struct js110_statistics_s * statistics);
+
+/**
+ * @brief Encode and write any partial block.
+ *
+ * @param self The encoder.
+ * @return 0 or error code.
+ */
+int js110_tsz_encoder_flush(struct js110_tsz_encoder_s * self);
+
+/**
+ * @brief Encode records into a single block.
+ *
+ * @param records The records to encode.
+ * @param count The number of records, up to JS110_TSZ_BLOCK_RECORDS_MAX.
+ * @param block The output buffer, which should be at least
+ *      JS110_TSZ_BLOCK_SIZE_MAX(count) bytes.
+ * @param size The size of block, in bytes.
+ * @param[out] block_size The encoded block size, in bytes.
+ * @return 0 or error code.
+ */
+int js110_tsz_encode(const struct js110_statistics_s * records, uint32_t count,
+                     uint8_t * block, uint32_t size, uint32_t * block_size);
+
+/**
+ * @brief Get the block information from the block header.
+ *
+ * @param block The start of the block.
+ * @param size The bytes available at block, at least JS110_TSZ_HEADER_SIZE.
+ * @param[out] block_size The total block size, in bytes.  Use to find the
+ *      start of the next block in a stream.
+ * @param[out] record_count The number of records in the block.
+ * @return 0 or error code.
+ */
+int js110_tsz_block_info(const uint8_t * block, uint32_t size,
+                         uint32_t * block_size, uint32_t * record_count);
+
+/**
+ * @brief Decode a block.
+ *
+ * @param block The encoded block.
+ * @param size The size of block, in bytes.
+ * @param records The output records.
+ * @param records_max The number of records available at records.
+ * @param[out] record_count The number of decoded records.
+ * @return 0 or error code.
+ *
+ * Blocks from format version 1 do not have samples_missed,
+ * windows_missed and flags, which decode as 0.
+ */
+int js110_tsz_decode(const uint8_t * block, uint32_t size,
+                     struct js110_statistics_s * records, uint32_t records_max,
+                     uint32_t * record_count);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif  /* JS110_TSZ_H__ */
@@ -0,0 +1,92 @@
+# Copyright 2020 Jetperch LLC
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Measure the js110 module throughput against simulated instruments.
+
+    python bench_sim.py --devices 1000 --duration 30
+
+Each simulated instrument produces 2 updates per second.  The benchmark
+reads batches with numpy views over the module-owned memory, checks the
+serial numbers and sample counters, and reports the update rate along
+with the progress of a pure-Python thread that runs concurrently, which
+shows that the polling and buffering do not hold the GIL.
+"""
+
+import argparse
+import threading
+import time
+
+import numpy as np
+import js110
+
+
+def spin(stop, counter):
+    while not stop.is_set():
+        counter[0] += 1
+
+
+def run():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n\n')[0])
+    parser.add_argument('--devices', type=int, default=1000)
+    parser.add_argument('--duration', type=float, default=30.0)
+    parser.add_argument('--min-records', type=int, default=1000)
+    parser.add_argument('--block-records', type=int, default=4096)
+    args = parser.parse_args()
+
+    js110.sim_configure(args.devices)
+    stop = threading.Event()
+    counter = [0]
+    spinner = threading.Thread(target=spin, args=(stop, counter))
+    records = 0
+    batches = 0
+    errors = 0
+    samples_total = {}
+    with js110.Reader(block_records=args.block_records) as reader:
+        spinner.start()
+        t_start = time.perf_counter()
+        t_end = t_start + args.duration
+        while time.perf_counter() < t_end:
+            batch = reader.read(min_records=args.min_records, timeout=1.0)
+            if batch is None:
+                continue
+            x = np.asarray(batch)
+            serial_number = np.asarray(batch.column('serial_number'))
+            if not np.array_equal(x['serial_number'], serial_number):
+                errors += 1
+            errors += int(np.count_nonzero(serial_number < js110.SIM_SERIAL_NUMBER_BASE))
+            errors += int(np.count_nonzero(serial_number >= js110.SIM_SERIAL_NUMBER_BASE + args.devices))
+            for sn, total in zip(serial_number.tolist(), x['samples_total'].tolist()):
+                if total <= samples_total.get(sn, -1):
+                    errors += 1
+                samples_total[sn] = total
+            records += len(batch)
+            batches += 1
+        duration = time.perf_counter() - t_start
+        stop.set()
+        spinner.join()
+        status = reader.status()
+
+    rate = records / duration
+    print(f'devices           {args.devices}')
+    print(f'records           {records} in {batches} batches')
+    print(f'rate              {rate:.0f} records/s, expect {2 * args.devices} records/s')
+    print(f'devices reported  {len(samples_total)}')
+    print(f'errors            {errors}')
+    print(f'dropped           {status["records_dropped"]}')
+    print(f'python spins/s    {counter[0] / duration:.0f}')
+    return 1 if errors else 0
+
+
+if __name__ == '__main__':
+    raise SystemExit(run())
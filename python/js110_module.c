@@ -0,0 +1,776 @@
+/*
+ * Copyright 2020 Jetperch LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * The js110 Python extension module.
+ *
+ * The library callback runs on the library's own threads without the
+ * GIL.  It appends each update to a block of records owned by this
+ * module.  Reader.read() releases the GIL while it waits, then returns a
+ * whole block as a Batch object.  Batch exports the records through the
+ * buffer protocol as a structured array, and Batch.column() exports a
+ * single field as a strided array, so numpy.asarray() wraps the
+ * module-owned memory without copying.  The block returns to the free
+ * pool when the last reference to the Batch and its columns goes away.
+ *
+ *     import numpy as np
+ *     import js110
+ *     with js110.Reader() as reader:
+ *         batch = reader.read(min_records=1000, timeout=1.0)
+ *         records = np.asarray(batch)
+ *         current = np.asarray(batch.column('current_mean'))
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <pythread.h>
+#include <structmember.h>
+#include "js110_statistics.h"
+#include "js110_sim.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#if PY_VERSION_HEX < 0x030D0000
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+#endif
+
+#define BLOCK_RECORDS_DEFAULT (4096)
+#define BLOCKS_MAX_DEFAULT (64)
+#define WAIT_SLICE_US (100000)  // check for Python signals at this interval
+
+// The PEP 3118 format of struct js110_statistics_s, which numpy
+// converts to a structured dtype.
+static const char RECORD_FORMAT[] =
+    "T{"
+    "I:serial_number:"
+    "i:samples_this:"
+    "i:samples_per_update:"
+    "i:samples_per_second:"
+    "q:samples_total:"
+    "d:charge:"
+    "d:energy:"
+    "d:current_mean:"
+    "d:current_min:"
+    "d:current_max:"
+    "d:voltage_mean:"
+    "d:voltage_min:"
+    "d:voltage_max:"
+    "d:power_mean:"
+    "d:power_min:"
+    "d:power_max:"
+    "q:samples_missed:"
+    "I:windows_missed:"
+    "I:flags:"
+    "}";
+
+struct field_s {
+    const char * name;
+    const char * format;
+    Py_ssize_t itemsize;
+    Py_ssize_t offset;
+};
+
+#define FIELD(name_, format_, type_) \
+    {#name_, format_, sizeof(type_), offsetof(struct js110_statistics_s, name_)}
+static const struct field_s fields_[] = {
+    FIELD(serial_number, "I", uint32_t),
+    FIELD(samples_this, "i", int32_t),
+    FIELD(samples_per_update, "i", int32_t),
+    FIELD(samples_per_second, "i", int32_t),
+    FIELD(samples_total, "q", int64_t),
+    FIELD(charge, "d", double),
+    FIELD(energy, "d", double),
+    FIELD(current_mean, "d", double),
+    FIELD(current_min, "d", double),
+    FIELD(current_max, "d", double),
+    FIELD(voltage_mean, "d", double),
+    FIELD(voltage_min, "d", double),
+    FIELD(voltage_max, "d", double),
+    FIELD(power_mean, "d", double),
+    FIELD(power_min, "d", double),
+    FIELD(power_max, "d", double),
+    FIELD(samples_missed, "q", int64_t),
+    FIELD(windows_missed, "I", uint32_t),
+    FIELD(flags, "I", uint32_t),
+    {NULL, NULL, 0, 0},
+};
+
+static int64_t monotonic_us(void) {
+#if PY_VERSION_HEX >= 0x030D0000
+    PyTime_t t = 0;
+    PyTime_MonotonicRaw(&t);
+    return (int64_t) (t / 1000);
+#elif defined(_WIN32)
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (int64_t) ((counter.QuadPart / frequency.QuadPart) * 1000000
+            + ((counter.QuadPart % frequency.QuadPart) * 1000000) / frequency.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+/// A block of records, owned by the module.
+struct block_s {
+    struct block_s * next;
+    Py_ssize_t count;
+    struct js110_statistics_s records[];
+};
+
+/**
+ * The buffering state shared with the library callback.
+ *
+ * The library callback never touches Python objects.  lock protects
+ * all fields.  signal is a binary semaphore that the callback releases
+ * to wake a waiting reader.
+ */
+struct buffer_s {
+    PyThread_type_lock lock;
+    PyThread_type_lock signal;
+    Py_ssize_t block_records;
+    uint32_t blocks_max;
+    uint32_t blocks_allocated;
+    struct block_s * fill;          // the block receiving records, or NULL
+    struct block_s * ready_head;    // the full blocks, oldest first
+    struct block_s * ready_tail;
+    struct block_s * free;          // the free pool
+    Py_ssize_t wait_records;        // the waiting reader's min_records, 0 for none
+    int signalled;                  // signal released and not yet consumed
+    uint64_t records_received;
+    uint64_t records_dropped;
+    int closed;                     // the Reader closed, free blocks on release
+    int references;                 // the Reader and the outstanding Batch objects
+};
+
+static int active_ = 0;  // only one Reader may own the library at a time
+
+static struct block_s * block_get(struct buffer_s * b) {
+    struct block_s * block = b->free;
+    if (block) {
+        b->free = block->next;
+    } else if (b->blocks_allocated < b->blocks_max) {
+        block = PyMem_RawMalloc(sizeof(struct block_s) + b->block_records * sizeof(struct js110_statistics_s));
+        if (!block) {
+            return NULL;
+        }
+        ++b->blocks_allocated;
+    } else {
+        return NULL;
+    }
+    block->next = NULL;
+    block->count = 0;
+    return block;
+}
+
+static void buffer_free(struct buffer_s * b) {
+    struct block_s * lists[] = {b->fill, b->ready_head, b->free};
+    for (size_t i = 0; i < sizeof(lists) / sizeof(lists[0]); ++i) {
+        struct block_s * block = lists[i];
+        while (block) {
+            struct block_s * next = block->next;
+            PyMem_RawFree(block);
+            block = next;
+        }
+    }
+    PyThread_free_lock(b->signal);
+    PyThread_free_lock(b->lock);
+    PyMem_RawFree(b);
+}
+
+/// Drop one reference, lock must be held, and returns 1 when b is freed.
+static int buffer_release(struct buffer_s * b) {
+    if (--b->references) {
+        return 0;
+    }
+    PyThread_release_lock(b->lock);
+    buffer_free(b);
+    return 1;
+}
+
+/// Wake the reader, lock must be held.
+static void buffer_signal(struct buffer_s * b) {
+    if (b->wait_records && !b->signalled) {
+        b->signalled = 1;
+        PyThread_release_lock(b->signal);
+    }
+}
+
+/// Return a block, which may be NULL, and release a reference to b.
+static void block_return(struct buffer_s * b, struct block_s * block) {
+    PyThread_acquire_lock(b->lock, WAIT_LOCK);
+    if (!block) {
+        // nothing to return
+    } else if (b->closed) {
+        PyMem_RawFree(block);
+    } else {
+        block->next = b->free;
+        b->free = block;
+    }
+    if (!buffer_release(b)) {
+        PyThread_release_lock(b->lock);
+    }
+}
+
+static void on_statistics(void * user_data, struct js110_statistics_s * statistics) {
+    // CAUTION: called from the library threads without the GIL.
+    struct buffer_s * b = (struct buffer_s *) user_data;
+    PyThread_acquire_lock(b->lock, WAIT_LOCK);
+    ++b->records_received;
+    if (!b->fill) {
+        b->fill = block_get(b);
+    }
+    if (!b->fill) {
+        ++b->records_dropped;  // reader too slow, all blocks in use
+    } else {
+        b->fill->records[b->fill->count++] = *statistics;
+        if (b->fill->count >= b->block_records) {
+            if (b->ready_tail) {
+                b->ready_tail->next = b->fill;
+            } else {
+                b->ready_head = b->fill;
+            }
+            b->ready_tail = b->fill;
+            b->fill = NULL;
+            buffer_signal(b);
+        } else if (b->wait_records && (b->fill->count >= b->wait_records)) {
+            buffer_signal(b);
+        }
+    }
+    PyThread_release_lock(b->lock);
+}
+
+/// Take the next block to read, lock must be held.
+static struct block_s * buffer_take(struct buffer_s * b, Py_ssize_t min_records) {
+    struct block_s * block = b->ready_head;
+    if (block) {
+        b->ready_head = block->next;
+        if (!b->ready_head) {
+            b->ready_tail = NULL;
+        }
+        block->next = NULL;
+    } else if (b->fill && b->fill->count && (b->fill->count >= min_records)) {
+        block = b->fill;
+        b->fill = NULL;
+    }
+    return block;
+}
+
+/**
+ * Wait for a block to read, without the GIL.
+ *
+ * @param b The buffer.
+ * @param min_records The minimum number of records before the deadline.
+ * @param deadline_us The monotonic_us() deadline, or -1 for none.
+ * @param[out] expired 1 when the deadline passed or the Reader closed.
+ * @return The block, or NULL after WAIT_SLICE_US or the deadline.
+ */
+static struct block_s * buffer_wait(struct buffer_s * b, Py_ssize_t min_records,
+                                    int64_t deadline_us, int * expired) {
+    struct block_s * block = NULL;
+    int64_t slice_end_us = monotonic_us() + WAIT_SLICE_US;
+    PyThread_acquire_lock(b->lock, WAIT_LOCK);
+    while (1) {
+        block = buffer_take(b, min_records);
+        if (block) {
+            break;
+        }
+        int64_t now_us = monotonic_us();
+        if (b->closed || ((deadline_us >= 0) && (now_us >= deadline_us))) {
+            *expired = 1;
+            block = buffer_take(b, 1);  // whatever is available
+            break;
+        } else if (now_us >= slice_end_us) {
+            break;
+        }
+        int64_t end_us = slice_end_us;
+        if ((deadline_us >= 0) && (deadline_us < end_us)) {
+            end_us = deadline_us;
+        }
+        b->wait_records = min_records;
+        PyThread_release_lock(b->lock);
+        PyLockStatus status = PyThread_acquire_lock_timed(b->signal, (PY_TIMEOUT_T) (end_us - now_us), 0);
+        PyThread_acquire_lock(b->lock, WAIT_LOCK);
+        if ((status != PY_LOCK_ACQUIRED) && b->signalled) {
+            // Signalled after the timeout, consume the released signal.
+            PyThread_acquire_lock(b->signal, WAIT_LOCK);
+        }
+        b->signalled = 0;
+        b->wait_records = 0;
+    }
+    PyThread_release_lock(b->lock);
+    return block;
+}
+
+
+/* --------------------------------------------------------------------- */
+/* Batch                                                                  */
+/* --------------------------------------------------------------------- */
+
+typedef struct {
+    PyObject_HEAD
+    struct buffer_s * buffer;
+    struct block_s * block;
+    Py_ssize_t shape;
+    Py_ssize_t strides;
+} BatchObject;
+
+typedef struct {
+    PyObject_HEAD
+    BatchObject * batch;
+    const struct field_s * field;
+} ColumnObject;
+
+static PyTypeObject BatchType;
+static PyTypeObject ColumnType;
+
+static void Batch_dealloc(BatchObject * self) {
+    if (self->buffer) {
+        block_return(self->buffer, self->block);
+    }
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static Py_ssize_t Batch_length(BatchObject * self) {
+    return self->block->count;
+}
+
+static int Batch_getbuffer(BatchObject * self, Py_buffer * view, int flags) {
+    if (flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "Batch is read-only");
+        return -1;
+    }
+    self->shape = self->block->count;
+    self->strides = sizeof(struct js110_statistics_s);
+    view->obj = (PyObject *) self;
+    Py_INCREF(self);
+    view->buf = self->block->records;
+    view->len = self->block->count * (Py_ssize_t) sizeof(struct js110_statistics_s);
+    view->readonly = 1;
+    view->itemsize = sizeof(struct js110_statistics_s);
+    view->format = (flags & PyBUF_FORMAT) ? (char *) RECORD_FORMAT : NULL;
+    view->ndim = 1;
+    view->shape = (flags & PyBUF_ND) ? &self->shape : NULL;
+    view->strides = ((flags & PyBUF_STRIDES) == PyBUF_STRIDES) ? &self->strides : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    return 0;
+}
+
+static PyObject * Batch_column(BatchObject * self, PyObject * args) {
+    const char * name = NULL;
+    if (!PyArg_ParseTuple(args, "s", &name)) {
+        return NULL;
+    }
+    for (const struct field_s * f = fields_; f->name; ++f) {
+        if (0 == strcmp(name, f->name)) {
+            ColumnObject * column = PyObject_New(ColumnObject, &ColumnType);
+            if (!column) {
+                return NULL;
+            }
+            Py_INCREF(self);
+            column->batch = self;
+            column->field = f;
+            return (PyObject *) column;
+        }
+    }
+    PyErr_Format(PyExc_KeyError, "unknown field: %s", name);
+    return NULL;
+}
+
+static PyObject * Batch_fields(PyObject * cls, PyObject * unused) {
+    (void) cls;
+    (void) unused;
+    Py_ssize_t n = 0;
+    while (fields_[n].name) {
+        ++n;
+    }
+    PyObject * result = PyTuple_New(n);
+    for (Py_ssize_t i = 0; result && (i < n); ++i) {
+        PyTuple_SET_ITEM(result, i, PyUnicode_FromString(fields_[i].name));
+    }
+    return result;
+}
+
+static PySequenceMethods Batch_as_sequence = {
+    .sq_length = (lenfunc) Batch_length,
+};
+
+static PyBufferProcs Batch_as_buffer = {
+    .bf_getbuffer = (getbufferproc) Batch_getbuffer,
+};
+
+static PyMethodDef Batch_methods[] = {
+    {"column", (PyCFunction) Batch_column, METH_VARARGS,
+     "column(name)\n\nGet a single field as a zero-copy strided buffer."},
+    {"fields", (PyCFunction) Batch_fields, METH_NOARGS | METH_CLASS,
+     "fields()\n\nGet the field names in record order."},
+    {NULL, NULL, 0, NULL},
+};
+
+static PyTypeObject BatchType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "js110.Batch",
+    .tp_basicsize = sizeof(BatchObject),
+    .tp_dealloc = (destructor) Batch_dealloc,
+    .tp_as_sequence = &Batch_as_sequence,
+    .tp_as_buffer = &Batch_as_buffer,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "A batch of statistics records in module-owned memory.\n\n"
+              "Use numpy.asarray(batch) for a structured array without copying.",
+    .tp_methods = Batch_methods,
+};
+
+static void Column_dealloc(ColumnObject * self) {
+    Py_XDECREF(self->batch);
+    PyObject_Free(self);
+}
+
+static int Column_getbuffer(ColumnObject * self, Py_buffer * view, int flags) {
+    BatchObject * batch = self->batch;
+    if (flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "Column is read-only");
+        return -1;
+    }
+    if ((flags & PyBUF_STRIDES) != PyBUF_STRIDES) {
+        PyErr_SetString(PyExc_BufferError, "Column requires a strided buffer");
+        return -1;
+    }
+    batch->shape = batch->block->count;
+    batch->strides = sizeof(struct js110_statistics_s);
+    view->obj = (PyObject *) self;
+    Py_INCREF(self);
+    view->buf = ((char *) batch->block->records) + self->field->offset;
+    view->len = batch->block->count * self->field->itemsize;
+    view->readonly = 1;
+    view->itemsize = self->field->itemsize;
+    view->format = (flags & PyBUF_FORMAT) ? (char *) self->field->format : NULL;
+    view->ndim = 1;
+    view->shape = &batch->shape;
+    view->strides = &batch->strides;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    return 0;
+}
+
+static Py_ssize_t Column_length(ColumnObject * self) {
+    return self->batch->block->count;
+}
+
+static PySequenceMethods Column_as_sequence = {
+    .sq_length = (lenfunc) Column_length,
+};
+
+static PyBufferProcs Column_as_buffer = {
+    .bf_getbuffer = (getbufferproc) Column_getbuffer,
+};
+
+static PyTypeObject ColumnType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "js110.Column",
+    .tp_basicsize = sizeof(ColumnObject),
+    .tp_dealloc = (destructor) Column_dealloc,
+    .tp_as_sequence = &Column_as_sequence,
+    .tp_as_buffer = &Column_as_buffer,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "A single field of a Batch as a strided buffer.",
+};
+
+
+/* --------------------------------------------------------------------- */
+/* Reader                                                                 */
+/* --------------------------------------------------------------------- */
+
+typedef struct {
+    PyObject_HEAD
+    struct buffer_s * buffer;
+    int open;
+} ReaderObject;
+
+static PyTypeObject ReaderType;
+
+static int Reader_init(ReaderObject * self, PyObject * args, PyObject * kwds) {
+    static char * kwlist[] = {"block_records", "blocks_max", NULL};
+    Py_ssize_t block_records = BLOCK_RECORDS_DEFAULT;
+    unsigned int blocks_max = BLOCKS_MAX_DEFAULT;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|nI", kwlist, &block_records, &blocks_max)) {
+        return -1;
+    }
+    if ((block_records <= 0) || (blocks_max < 2)) {
+        PyErr_SetString(PyExc_ValueError, "block_records must be positive and blocks_max at least 2");
+        return -1;
+    }
+    if (self->buffer || active_) {
+        PyErr_SetString(PyExc_RuntimeError, "only one Reader may be open at a time");
+        return -1;
+    }
+    struct buffer_s * b = PyMem_RawCalloc(1, sizeof(struct buffer_s));
+    if (!b) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    b->lock = PyThread_allocate_lock();
+    b->signal = PyThread_allocate_lock();
+    if (!b->lock || !b->signal) {
+        if (b->lock) {
+            PyThread_free_lock(b->lock);
+        }
+        if (b->signal) {
+            PyThread_free_lock(b->signal);
+        }
+        PyMem_RawFree(b);
+        PyErr_NoMemory();
+        return -1;
+    }
+    PyThread_acquire_lock(b->signal, WAIT_LOCK);  // start unsignalled
+    b->block_records = block_records;
+    b->blocks_max = blocks_max;
+    b->references = 1;
+
+    int rc;
+    Py_BEGIN_ALLOW_THREADS
+    rc = js110_initialize(on_statistics, b);
+    Py_END_ALLOW_THREADS
+    if (rc) {
+        buffer_free(b);
+        PyErr_Format(PyExc_RuntimeError, "js110_initialize failed with %d", rc);
+        return -1;
+    }
+    self->buffer = b;
+    self->open = 1;
+    active_ = 1;
+    return 0;
+}
+
+static PyObject * Reader_close(ReaderObject * self, PyObject * unused) {
+    (void) unused;
+    struct buffer_s * b = self->buffer;
+    if (!self->open) {
+        Py_RETURN_NONE;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    js110_finalize();
+    Py_END_ALLOW_THREADS
+    self->open = 0;
+    self->buffer = NULL;
+    active_ = 0;
+    PyThread_acquire_lock(b->lock, WAIT_LOCK);
+    b->closed = 1;
+    buffer_signal(b);  // end a read() waiting on another thread
+    if (!buffer_release(b)) {
+        PyThread_release_lock(b->lock);
+    }
+    Py_RETURN_NONE;
+}
+
+static void Reader_dealloc(ReaderObject * self) {
+    Py_XDECREF(Reader_close(self, NULL));
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static PyObject * Reader_read(ReaderObject * self, PyObject * args, PyObject * kwds) {
+    static char * kwlist[] = {"min_records", "timeout", NULL};
+    Py_ssize_t min_records = 1;
+    PyObject * timeout_obj = Py_None;
+    double timeout = -1.0;
+    struct buffer_s * b = self->buffer;
+    struct block_s * block = NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|nO", kwlist, &min_records, &timeout_obj)) {
+        return NULL;
+    }
+    if (timeout_obj != Py_None) {
+        timeout = PyFloat_AsDouble(timeout_obj);
+        if ((timeout == -1.0) && PyErr_Occurred()) {
+            return NULL;
+        }
+    }
+    if (!self->open) {
+        PyErr_SetString(PyExc_RuntimeError, "Reader is closed");
+        return NULL;
+    }
+    if (min_records < 1) {
+        min_records = 1;
+    } else if (min_records > b->block_records) {
+        min_records = b->block_records;
+    }
+
+    // Wait without the GIL, in slices so that Ctrl-C interrupts the wait.
+    // The reference keeps b valid if another thread closes the Reader.
+    int64_t deadline_us = -1;
+    if (timeout >= 0.0) {
+        deadline_us = monotonic_us() + (int64_t) (timeout * 1e6);
+    }
+    PyThread_acquire_lock(b->lock, WAIT_LOCK);
+    ++b->references;
+    PyThread_release_lock(b->lock);
+    while (1) {
+        int expired = 0;
+        Py_BEGIN_ALLOW_THREADS
+        block = buffer_wait(b, min_records, deadline_us, &expired);
+        Py_END_ALLOW_THREADS
+        if (block || expired || PyErr_CheckSignals()) {
+            break;
+        }
+    }
+    BatchObject * batch = NULL;
+    if (block) {
+        batch = PyObject_New(BatchObject, &BatchType);
+    }
+    if (!batch) {
+        block_return(b, block);  // also releases the reference
+        if (PyErr_Occurred()) {
+            return NULL;
+        }
+        Py_RETURN_NONE;
+    }
+    batch->buffer = b;  // transfer the reference
+    batch->block = block;
+    batch->shape = block->count;
+    batch->strides = sizeof(struct js110_statistics_s);
+    return (PyObject *) batch;
+}
+
+static PyObject * Reader_status(ReaderObject * self, PyObject * unused) {
+    (void) unused;
+    struct js110_dispatch_status_s dispatch;
+    struct js110_poll_status_s poll;
+    uint64_t received = 0;
+    uint64_t dropped = 0;
+    if (self->buffer) {
+        PyThread_acquire_lock(self->buffer->lock, WAIT_LOCK);
+        received = self->buffer->records_received;
+        dropped = self->buffer->records_dropped;
+        PyThread_release_lock(self->buffer->lock);
+    }
+    js110_dispatch_status(&dispatch);
+    js110_poll_status(&poll);
+    return Py_BuildValue("{s:K,s:K,s:K,s:K,s:I,s:K,s:K}",
+                         "records_received", (unsigned long long) received,
+                         "records_dropped", (unsigned long long) dropped,
+                         "updates_delivered", (unsigned long long) dispatch.updates_delivered,
+                         "windows_merged", (unsigned long long) dispatch.windows_merged,
+                         "devices_open", (unsigned int) poll.devices_open,
+                         "poll_cycles", (unsigned long long) poll.cycles,
+                         "poll_duration_us_total", (unsigned long long) poll.cycle_duration_us_total);
+}
+
+static PyObject * Reader_enter(ReaderObject * self, PyObject * unused) {
+    (void) unused;
+    Py_INCREF(self);
+    return (PyObject *) self;
+}
+
+static PyObject * Reader_exit(ReaderObject * self, PyObject * args) {
+    (void) args;
+    return Reader_close(self, NULL);
+}
+
+static PyMethodDef Reader_methods[] = {
+    {"read", (PyCFunction) (void (*)(void)) Reader_read, METH_VARARGS | METH_KEYWORDS,
+     "read(min_records=1, timeout=None)\n\n"
+     "Wait for updates without holding the GIL.\n\n"
+     "Returns a Batch with at least min_records updates, up to block_records,\n"
+     "or the available updates when timeout seconds elapse.  Returns None\n"
+     "when no updates arrived before the timeout.  None or a negative\n"
+     "timeout waits indefinitely.  When another thread closes the Reader,\n"
+     "returns the remaining updates, or None."},
+    {"status", (PyCFunction) Reader_status, METH_NOARGS,
+     "status()\n\nGet the buffering, delivery and polling counters as a dict."},
+    {"close", (PyCFunction) Reader_close, METH_NOARGS,
+     "close()\n\nStop the library.  Existing Batch objects remain valid."},
+    {"__enter__", (PyCFunction) Reader_enter, METH_NOARGS, NULL},
+    {"__exit__", (PyCFunction) Reader_exit, METH_VARARGS, NULL},
+    {NULL, NULL, 0, NULL},
+};
+
+static PyTypeObject ReaderType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "js110.Reader",
+    .tp_basicsize = sizeof(ReaderObject),
+    .tp_dealloc = (destructor) Reader_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Reader(block_records=4096, blocks_max=64)\n\n"
+              "Start the library and buffer the updates from all instruments.\n"
+              "Holds up to blocks_max blocks of block_records updates, and\n"
+              "counts the updates dropped when all blocks are in use.",
+    .tp_methods = Reader_methods,
+    .tp_init = (initproc) Reader_init,
+    .tp_new = PyType_GenericNew,
+};
+
+
+/* --------------------------------------------------------------------- */
+/* Module                                                                 */
+/* --------------------------------------------------------------------- */
+
+static PyObject * js110_sim_configure_py(PyObject * module, PyObject * args) {
+    (void) module;
+    unsigned int device_count = 0;
+    if (!PyArg_ParseTuple(args, "I", &device_count)) {
+        return NULL;
+    }
+    if (active_) {
+        PyErr_SetString(PyExc_RuntimeError, "close the Reader first");
+        return NULL;
+    }
+    if (js110_sim_configure(device_count)) {
+        return PyErr_NoMemory();
+    }
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef module_methods[] = {
+    {"sim_configure", js110_sim_configure_py, METH_VARARGS,
+     "sim_configure(device_count)\n\n"
+     "Use simulated instruments for the next Reader, or 0 for real instruments."},
+    {NULL, NULL, 0, NULL},
+};
+
+static struct PyModuleDef module_def = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "js110",
+    .m_doc = "Statistics from Joulescope JS110 instruments.",
+    .m_size = -1,
+    .m_methods = module_methods,
+};
+
+PyMODINIT_FUNC PyInit_js110(void) {
+    if ((PyType_Ready(&BatchType) < 0) || (PyType_Ready(&ColumnType) < 0) || (PyType_Ready(&ReaderType) < 0)) {
+        return NULL;
+    }
+    PyObject * m = PyModule_Create(&module_def);
+    if (!m) {
+        return NULL;
+    }
+    Py_INCREF(&ReaderType);
+    Py_INCREF(&BatchType);
+    Py_INCREF(&ColumnType);
+    if ((PyModule_AddObject(m, "Reader", (PyObject *) &ReaderType) < 0)
+            || (PyModule_AddObject(m, "Batch", (PyObject *) &BatchType) < 0)
+            || (PyModule_AddObject(m, "Column", (PyObject *) &ColumnType) < 0)
+            || (PyModule_AddIntConstant(m, "SIM_SERIAL_NUMBER_BASE", JS110_SIM_SERIAL_NUMBER_BASE) < 0)) {
+        Py_DECREF(m);
+        return NULL;
+    }
+    return m;
+}
@@ -0,0 +1,56 @@
+# Copyright 2020 Jetperch LLC
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Build the js110 Python extension module.
+
+The module links the library sources directly, so the extension is
+self-contained:
+
+    cd python
+    pip install .
+"""
+
+import os
+import sys
+from setuptools import setup, Extension
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+LIB_SOURCES = [
+    'js110_statistics.c',
+    'status_decode.c',
+    'trace.c',
+    'backend_sim.c',
+    'backend_winusb.c',
+    'checkpoint.c',
+    'device_change_notifier.c',
+    'forward.c',
+    'tsz.c',
+    'sketch.c',
+    'segment.c',
+]
+
+ext = Extension(
+    'js110',
+    sources=['js110_module.c'] + [os.path.join(ROOT, 'source', f) for f in LIB_SOURCES],
+    include_dirs=[os.path.join(ROOT, 'include'), os.path.join(ROOT, 'source')],
+    libraries=['setupapi', 'winusb', 'ws2_32', 'user32'] if sys.platform == 'win32' else [],
+)
+
+setup(
+    name='js110',
+    version='0.2.0',
+    description='Statistics from Joulescope JS110 instruments',
+    ext_modules=[ext],
+    python_requires='>=3.8',
+)
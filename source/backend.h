@@ -0,0 +1,91 @@
+/*
+ * Copyright 2020 Jetperch LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief The device access backend.
+ *
+ * The library accesses JS110 instruments through this small function
+ * table.  js110_backend_winusb uses SetupAPI and WinUSB to access real
+ * instruments, and js110_backend_sim provides simulated instruments for
+ * benchmarks and load testing.  See js110_sim.h.
+ */
+
+#ifndef JS110_BACKEND_H__
+#define JS110_BACKEND_H__
+
+#include <stdint.h>
+#include <wchar.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/**
+ * @brief The function called for each device found by a scan.
+ *
+ * @param user_data The arbitrary data.
+ * @param path The device path, which is on loan for the duration of the
+ *      function call.  The path contains the serial number in the same
+ *      format as the Windows device interface path.
+ */
+typedef void (*js110_backend_found_fn)(void * user_data, const wchar_t * path);
+
+/**
+ * @brief The backend function table.
+ *
+ * All functions return 0 on success or an error code.  The library only
+ * calls the functions from its polling thread.
+ */
+struct js110_backend_s {
+    /// Call found_fn for each present device.
+    int (*scan)(js110_backend_found_fn found_fn, void * user_data);
+    /// Open a device by path.
+    int (*open)(const wchar_t * path, void ** handle);
+    /// Close a device.
+    void (*close)(void * handle);
+    /// Perform a vendor control OUT transfer.
+    int (*control_out)(void * handle, uint8_t request, const uint8_t * buffer, uint32_t length);
+    /// Perform a vendor control IN transfer.
+    int (*control_in)(void * handle, uint8_t request, uint8_t * buffer, uint32_t size, uint32_t * length);
+};
+
+/// The backend for real instruments using SetupAPI and WinUSB.
+extern const struct js110_backend_s js110_backend_winusb;
+
+/// The backend for simulated instruments.
+extern const struct js110_backend_s js110_backend_sim;
+
+/**
+ * @brief Check if simulated instruments are configured.
+ *
+ * @return 1 to use js110_backend_sim, 0 to use js110_backend_winusb.
+ */
+int js110_backend_sim_active(void);
+
+/**
+ * @brief Notify the library that devices arrived or departed.
+ *
+ * Backends without WM_DEVICECHANGE notifications call this function,
+ * from any thread, to request a scan.
+ */
+void js110_backend_device_change(void);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif  /* JS110_BACKEND_H__ */
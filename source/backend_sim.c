@@ -0,0 +1,392 @@
+/*
+ * Copyright 2020 Jetperch LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "backend.h"
+#include "usb_def.h"
+#include "js110_sim.h"
+#include <Windows.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define STATUS_LENGTH (104)
+#define SAMPLES_PER_SECOND (2000000)
+#define SAMPLES_PER_UPDATE (JS110_SIM_SAMPLES_PER_WINDOW)
+#define UPDATES_PER_SECOND (SAMPLES_PER_SECOND / SAMPLES_PER_UPDATE)
+#define PATH_FORMAT L"\\\\?\\usb#vid_16d0&pid_0e88#%06u#{576d606f-f3de-4e4e-8a87-065b9fd21eb0}"
+#define PATH_SERIAL_PREFIX L"&pid_0e88#"
+
+/**
+ * @brief A simulated instrument.
+ *
+ * The instrument accumulates samples_total, charge and energy from its
+ * boot time, like a real instrument.  The window values are a
+ * deterministic function of the serial number and window index.
+ * The truth fields accumulate over all boots.
+ */
+struct sim_device_s {
+    uint32_t serial_number;
+    bool connected;
+    bool open;              // the library handle is valid
+    int64_t boot_time_us;
+    int64_t window;         // the last completed window, -1 for none
+    int64_t window_read;    // the last window returned by a status request
+    double charge;
+    double energy;
+    double charge_read;     // the charge of the last window read in this boot
+    uint32_t delay_us;
+    uint32_t fail_ppm;
+    uint32_t rng;
+    struct js110_sim_truth_s truth;
+    uint8_t status[STATUS_LENGTH];
+};
+
+// The devices, protected by lock_.  The library calls the backend from its
+// polling thread while the load test scripts the devices from its own.
+// lock_ is recursive, so sim_scan() holds it while the library opens the
+// devices that it finds.
+static CRITICAL_SECTION lock_;
+static bool lock_initialized_ = false;
+static uint32_t device_count_ = 0;
+static struct sim_device_s * devices_ = NULL;
+
+
+static int64_t time_us(void) {
+    static LARGE_INTEGER frequency = {.QuadPart = 0};
+    LARGE_INTEGER counter;
+    if (!frequency.QuadPart) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&counter);
+    return (int64_t) ((counter.QuadPart * 1000000.0) / frequency.QuadPart);
+}
+
+static inline void u32_encode(uint8_t * p, uint32_t v) {
+    p[0] = (uint8_t) v;
+    p[1] = (uint8_t) (v >> 8);
+    p[2] = (uint8_t) (v >> 16);
+    p[3] = (uint8_t) (v >> 24);
+}
+
+static inline void u64_encode(uint8_t * p, uint64_t v) {
+    u32_encode(p, (uint32_t) v);
+    u32_encode(p + 4, (uint32_t) (v >> 32));
+}
+
+static inline void fixed32_encode(uint8_t * p, double v, double scale) {
+    u32_encode(p, (uint32_t) (int32_t) (v * scale));
+}
+
+static inline void fixed64_encode(uint8_t * p, double v, double scale) {
+    u64_encode(p, (uint64_t) (int64_t) (v * scale));
+}
+
+/// Advance the simulated instrument to the current time.
+static void device_advance(struct sim_device_s * d, int64_t now_us) {
+    int64_t window = ((now_us - d->boot_time_us) * UPDATES_PER_SECOND) / 1000000 - 1;
+    while (d->window < window) {
+        int64_t k = ++d->window;
+        double i_base = 0.001 * (1 + (d->serial_number % 97));
+        double i_mean = i_base * (1.0 + 0.1 * sin(k * 0.1));
+        double v_mean = 3.3 + 0.01 * cos(k * 0.05);
+        double p_mean = i_mean * v_mean;
+        double dt = ((double) SAMPLES_PER_UPDATE) / SAMPLES_PER_SECOND;
+        d->charge += i_mean * dt;
+        d->energy += p_mean * dt;
+        ++d->truth.windows;
+        d->truth.charge += i_mean * dt;
+
+        uint8_t * pkt = d->status;
+        memset(pkt, 0, sizeof(d->status));
+        u64_encode(pkt + 24, (uint64_t) ((k + 1) * SAMPLES_PER_UPDATE));
+        fixed64_encode(pkt + 32, p_mean, (double) (1LLU << 34));
+        fixed64_encode(pkt + 40, d->charge, (double) (1LLU << 27));
+        fixed64_encode(pkt + 48, d->energy, (double) (1LLU << 27));
+        u32_encode(pkt + 56, SAMPLES_PER_UPDATE);
+        u32_encode(pkt + 60, SAMPLES_PER_UPDATE);
+        u32_encode(pkt + 64, SAMPLES_PER_SECOND);
+        fixed32_encode(pkt + 68, i_mean, (double) (1LU << 27));
+        fixed32_encode(pkt + 72, i_mean * 0.9, (double) (1LU << 27));
+        fixed32_encode(pkt + 76, i_mean * 1.1, (double) (1LU << 27));
+        fixed32_encode(pkt + 80, v_mean, (double) (1LU << 17));
+        fixed32_encode(pkt + 84, v_mean - 0.001, (double) (1LU << 17));
+        fixed32_encode(pkt + 88, v_mean + 0.001, (double) (1LU << 17));
+        fixed32_encode(pkt + 92, p_mean * 0.9, (double) (1LU << 21));
+        fixed32_encode(pkt + 96, p_mean * 1.1, (double) (1LU << 21));
+    }
+}
+
+/// Boot the simulated instrument at boot_time_us.
+static void device_boot(struct sim_device_s * d, int64_t boot_time_us) {
+    d->connected = true;
+    d->open = false;
+    d->boot_time_us = boot_time_us;
+    d->window = -1;
+    d->window_read = -1;
+    d->charge = 0.0;
+    d->energy = 0.0;
+    d->charge_read = 0.0;
+    memset(d->status, 0, sizeof(d->status));
+    ++d->truth.boots;
+}
+
+/// Disconnect the simulated instrument, which loses its unread window.
+static void device_depart(struct sim_device_s * d, int64_t now_us) {
+    device_advance(d, now_us);
+    d->truth.windows_skipped += d->window - d->window_read;
+    d->truth.charge_read += d->charge_read;
+    d->connected = false;
+    d->open = false;
+}
+
+/// Get a device by handle, lock_ must be held.
+static struct sim_device_s * device_get(void * handle) {
+    uintptr_t idx = (uintptr_t) handle;
+    if (!idx || (idx > device_count_)) {
+        return NULL;
+    }
+    struct sim_device_s * d = &devices_[idx - 1];
+    return d->open ? d : NULL;
+}
+
+/// Get a device by serial number, lock_ must be held.
+static struct sim_device_s * device_find(uint32_t serial_number) {
+    uint32_t idx = serial_number - JS110_SIM_SERIAL_NUMBER_BASE;
+    if ((serial_number < JS110_SIM_SERIAL_NUMBER_BASE) || (idx >= device_count_)) {
+        return NULL;
+    }
+    return &devices_[idx];
+}
+
+/// A fast xorshift random number generator for the fault injection.
+static uint32_t rng_next(uint32_t * state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static void delay(uint32_t delay_us) {
+    if (delay_us >= 1000) {
+        Sleep(delay_us / 1000);
+    } else if (delay_us) {
+        int64_t t_end = time_us() + delay_us;
+        while (time_us() < t_end) {
+            // spin for short delays, which Sleep() cannot provide
+        }
+    }
+}
+
+static int sim_scan(js110_backend_found_fn found_fn, void * user_data) {
+    wchar_t path[128];
+    EnterCriticalSection(&lock_);
+    for (uint32_t i = 0; i < device_count_; ++i) {
+        if (devices_[i].connected) {
+            swprintf(path, sizeof(path) / sizeof(path[0]), PATH_FORMAT, devices_[i].serial_number);
+            found_fn(user_data, path);
+        }
+    }
+    LeaveCriticalSection(&lock_);
+    return 0;
+}
+
+static int sim_open(const wchar_t * path, void ** handle) {
+    int rc = 1;
+    const wchar_t * p = wcsstr(path, PATH_SERIAL_PREFIX);
+    if (!p) {
+        return 1;
+    }
+    uint32_t serial_number = (uint32_t) wcstoul(p + wcslen(PATH_SERIAL_PREFIX), NULL, 10);
+    EnterCriticalSection(&lock_);
+    struct sim_device_s * d = device_find(serial_number);
+    if (d && d->connected) {
+        d->open = true;
+        *handle = (void *) (uintptr_t) (d - devices_ + 1);
+        rc = 0;
+    }
+    LeaveCriticalSection(&lock_);
+    return rc;
+}
+
+static void sim_close(void * handle) {
+    (void) handle;
+}
+
+static int sim_control_out(void * handle, uint8_t request, const uint8_t * buffer, uint32_t length) {
+    (void) buffer;
+    (void) length;
+    int rc = 0;
+    EnterCriticalSection(&lock_);
+    if (!device_get(handle) || (JS110_USBREQ_SETTINGS != request)) {
+        rc = 1;
+    }
+    LeaveCriticalSection(&lock_);
+    return rc;
+}
+
+static int sim_control_in(void * handle, uint8_t request, uint8_t * buffer, uint32_t size, uint32_t * length) {
+    EnterCriticalSection(&lock_);
+    struct sim_device_s * d = device_get(handle);
+    uint32_t delay_us = d ? d->delay_us : 0;
+    LeaveCriticalSection(&lock_);
+    delay(delay_us);  // the transfer duration, without holding the lock
+
+    int rc = 0;
+    EnterCriticalSection(&lock_);
+    d = device_get(handle);  // may have departed during the transfer
+    if (!d || (JS110_USBREQ_STATUS != request) || (size < STATUS_LENGTH)) {
+        rc = 1;
+    } else if (d->fail_ppm && ((rng_next(&d->rng) % 1000000U) < d->fail_ppm)) {
+        rc = 1;
+    } else {
+        device_advance(d, time_us());
+        memcpy(buffer, d->status, STATUS_LENGTH);
+        if ((d->window < 0) || (d->window == d->window_read)) {
+            memset(buffer + 56, 0, 4);  // samples_this = 0, no new window
+        } else {
+            ++d->truth.windows_read;
+            d->truth.windows_skipped += d->window - d->window_read - 1;
+            d->charge_read = d->charge;
+        }
+        d->window_read = d->window;
+        *length = STATUS_LENGTH;
+    }
+    if (rc && d) {
+        ++d->truth.transfer_errors;
+    }
+    LeaveCriticalSection(&lock_);
+    return rc;
+}
+
+const struct js110_backend_s js110_backend_sim = {
+    .scan = sim_scan,
+    .open = sim_open,
+    .close = sim_close,
+    .control_out = sim_control_out,
+    .control_in = sim_control_in,
+};
+
+int js110_backend_sim_active(void) {
+    return device_count_ ? 1 : 0;
+}
+
+int js110_sim_configure(uint32_t device_count) {
+    struct sim_device_s * devices = NULL;
+    if (!lock_initialized_) {
+        InitializeCriticalSection(&lock_);
+        lock_initialized_ = true;
+    }
+    if (device_count) {
+        devices = calloc(device_count, sizeof(struct sim_device_s));
+        if (!devices) {
+            return 1;
+        }
+    }
+    int64_t now = time_us();
+    for (uint32_t i = 0; i < device_count; ++i) {
+        struct sim_device_s * d = &devices[i];
+        d->serial_number = JS110_SIM_SERIAL_NUMBER_BASE + i;
+        d->rng = d->serial_number;
+        // stagger the windows across the devices
+        device_boot(d, now - (int64_t) ((i * 7919U) % (1000000U / UPDATES_PER_SECOND)));
+    }
+    EnterCriticalSection(&lock_);
+    free(devices_);
+    devices_ = devices;
+    device_count_ = device_count;
+    LeaveCriticalSection(&lock_);
+    return 0;
+}
+
+int js110_sim_connect(uint32_t serial_number) {
+    int rc = 1;
+    if (!lock_initialized_) {
+        return 1;
+    }
+    EnterCriticalSection(&lock_);
+    struct sim_device_s * d = device_find(serial_number);
+    if (d && !d->connected) {
+        device_boot(d, time_us());
+        rc = 0;
+    }
+    LeaveCriticalSection(&lock_);
+    if (!rc) {
+        js110_backend_device_change();
+    }
+    return rc;
+}
+
+int js110_sim_disconnect(uint32_t serial_number) {
+    int rc = 1;
+    if (!lock_initialized_) {
+        return 1;
+    }
+    EnterCriticalSection(&lock_);
+    struct sim_device_s * d = device_find(serial_number);
+    if (d && d->connected) {
+        device_depart(d, time_us());
+        rc = 0;
+    }
+    LeaveCriticalSection(&lock_);
+    if (!rc) {
+        js110_backend_device_change();
+    }
+    return rc;
+}
+
+int js110_sim_fault_set(uint32_t serial_number, uint32_t delay_us, uint32_t fail_ppm) {
+    int rc = 1;
+    if (!lock_initialized_) {
+        return 1;
+    }
+    EnterCriticalSection(&lock_);
+    struct sim_device_s * d = device_find(serial_number);
+    if (d) {
+        d->delay_us = delay_us;
+        d->fail_ppm = fail_ppm;
+        rc = 0;
+    }
+    LeaveCriticalSection(&lock_);
+    return rc;
+}
+
+int js110_sim_truth(uint32_t serial_number, struct js110_sim_truth_s * truth) {
+    int rc = 1;
+    if (!lock_initialized_ || !truth) {
+        return 1;
+    }
+    EnterCriticalSection(&lock_);
+    struct sim_device_s * d = device_find(serial_number);
+    if (d) {
+        if (d->connected) {
+            device_advance(d, time_us());
+        }
+        *truth = d->truth;
+        if (d->connected) {
+            truth->connected = 1;
+            truth->windows_pending = d->window - d->window_read;
+            truth->charge_read += d->charge_read;
+        }
+        rc = 0;
+    }
+    LeaveCriticalSection(&lock_);
+    return rc;
+}
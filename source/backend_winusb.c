@@ -0,0 +1,170 @@
+/*
+ * Copyright 2020 Jetperch LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "backend.h"
+#include "usb_def.h"
+#include <Windows.h>
+#include <setupapi.h>
+#include <winusb.h>
+#include <stdlib.h>
+#include <string.h>
+
+// #include <stdio.h>
+// #define DEBUG_PRINTF(...) printf(__VA_ARGS__)
+#define DEBUG_PRINTF(...)
+#define DEVICE_INTERFACE_DETAIL_SIZE ((1024 / sizeof(uint64_t)) * sizeof(uint64_t))
+static const DWORD CONTROL_PIPE_TIMEOUT_MS = 500;
+
+// The Joulescope WinUSB interface's GUID.
+// {576d606f-f3de-4e4e-8a87-065b9fd21eb0}
+static const GUID guid = {0x576d606f, 0xf3de, 0x4e4e, {0x8a, 0x87, 0x06, 0x5b, 0x9f, 0xd2, 0x1e, 0xb0}};
+
+struct winusb_device_s {
+    HANDLE file;
+    WINUSB_INTERFACE_HANDLE winusb;
+};
+
+static int winusb_scan(js110_backend_found_fn found_fn, void * user_data) {
+    DWORD member_index = 0;
+    uint64_t data[DEVICE_INTERFACE_DETAIL_SIZE / sizeof(uint64_t)];
+    SP_DEVICE_INTERFACE_DETAIL_DATA_W * dev_interface_detail = (SP_DEVICE_INTERFACE_DETAIL_DATA_W *) data;
+    SP_DEVICE_INTERFACE_DATA dev_interface;
+    HANDLE handle = SetupDiGetClassDevsW(&guid, NULL, NULL, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
+    if (!handle) {
+        return 1;
+    }
+
+    memset(&dev_interface, 0, sizeof(dev_interface));
+    dev_interface.cbSize = sizeof(dev_interface);
+    for (; SetupDiEnumDeviceInterfaces(handle, NULL, &guid, member_index, &dev_interface); ++member_index) {
+        DWORD required_size = 0;
+        SetupDiGetDeviceInterfaceDetailW(
+                handle,
+                &dev_interface,
+                0, 0, &required_size, 0);
+        if (required_size > DEVICE_INTERFACE_DETAIL_SIZE) {
+            DEBUG_PRINTF("device interface detail too long: %lu\n", required_size);
+            continue;
+        }
+        memset(dev_interface_detail, 0, DEVICE_INTERFACE_DETAIL_SIZE);
+        dev_interface_detail->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA_W);
+        if (!SetupDiGetDeviceInterfaceDetailW(
+                handle,
+                &dev_interface,
+                dev_interface_detail, required_size, &required_size, 0)) {
+            DEBUG_PRINTF("SetupDiGetDeviceInterfaceDetailW failed\n");
+            continue;
+        }
+        // DEBUG_PRINTF("scan %d: found %ls, %d\n", member_index, dev_interface_detail->DevicePath, required_size);
+        found_fn(user_data, dev_interface_detail->DevicePath);
+    }
+    SetupDiDestroyDeviceInfoList(handle);
+    return 0;
+}
+
+static void winusb_close(void * handle) {
+    struct winusb_device_s * d = (struct winusb_device_s *) handle;
+    if (!d) {
+        return;
+    }
+    if (d->winusb) {
+        WinUsb_Free(d->winusb);
+        d->winusb = 0;
+    }
+    if (d->file) {
+        CloseHandle(d->file);
+        d->file = 0;
+    }
+    free(d);
+}
+
+static int winusb_open(const wchar_t * path, void ** handle) {
+    struct winusb_device_s * d = calloc(1, sizeof(struct winusb_device_s));
+    if (!d) {
+        return 1;
+    }
+    d->file = CreateFileW(
+            path,
+            GENERIC_WRITE | GENERIC_READ,
+            FILE_SHARE_WRITE | FILE_SHARE_READ,
+            NULL,
+            OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED,
+            NULL);
+    if (d->file == INVALID_HANDLE_VALUE) {
+        DEBUG_PRINTF("winusb_open Device CreateFileW failed\n");
+        d->file = 0;
+        free(d);
+        return 1;
+    }
+
+    if (!WinUsb_Initialize(d->file, &d->winusb)) {
+        DEBUG_PRINTF("winusb_open Device WinUsb_Initialize failed\n");
+        d->winusb = 0;
+        winusb_close(d);
+        return 1;
+    }
+
+    // Reduce control endpoint timeout
+    // https://docs.microsoft.com/en-us/windows-hardware/drivers/usbcon/winusb-functions-for-pipe-policy-modification
+    if (!WinUsb_SetPipePolicy(d->winusb, 0, PIPE_TRANSFER_TIMEOUT,
+                              sizeof(CONTROL_PIPE_TIMEOUT_MS), (void *) &CONTROL_PIPE_TIMEOUT_MS)) {
+        DEBUG_PRINTF("WinUsb_SetPipePolicy failed\n");
+    }
+    *handle = d;
+    return 0;
+}
+
+static int winusb_control_out(void * handle, uint8_t request, const uint8_t * buffer, uint32_t length) {
+    struct winusb_device_s * d = (struct winusb_device_s *) handle;
+    ULONG length_transferred = 0;
+    WINUSB_SETUP_PACKET setup_pkt;
+    setup_pkt.RequestType = USB_REQUEST_TYPE(DEVICE, VENDOR, OUT);
+    setup_pkt.Request = request;
+    setup_pkt.Value = 0;
+    setup_pkt.Index = 0;
+    setup_pkt.Length = 0;
+    if (!WinUsb_ControlTransfer(d->winusb, setup_pkt, (UCHAR *) buffer, length, &length_transferred, 0)) {
+        DEBUG_PRINTF("WinUsb_ControlTransfer out %d failed\n", (int) request);
+        return 1;
+    }
+    return 0;
+}
+
+static int winusb_control_in(void * handle, uint8_t request, uint8_t * buffer, uint32_t size, uint32_t * length) {
+    struct winusb_device_s * d = (struct winusb_device_s *) handle;
+    ULONG length_transferred = 0;
+    WINUSB_SETUP_PACKET setup_pkt;
+    setup_pkt.RequestType = USB_REQUEST_TYPE(DEVICE, VENDOR, IN);
+    setup_pkt.Request = request;
+    setup_pkt.Value = 0;
+    setup_pkt.Index = 0;
+    setup_pkt.Length = 0;
+    if (!WinUsb_ControlTransfer(d->winusb, setup_pkt, buffer, size, &length_transferred, 0)) {
+        DEBUG_PRINTF("WinUsb_ControlTransfer in %d failed\n", (int) request);
+        return 1;
+    }
+    *length = length_transferred;
+    return 0;
+}
+
+const struct js110_backend_s js110_backend_winusb = {
+    .scan = winusb_scan,
+    .open = winusb_open,
+    .close = winusb_close,
+    .control_out = winusb_control_out,
+    .control_in = winusb_control_in,
+};
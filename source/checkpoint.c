@@ -0,0 +1,262 @@
+/*
+ * Copyright 2020 Jetperch LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "checkpoint.h"
+#include <Windows.h>
+#include <stdbool.h>
+#include <string.h>
+
+// #include <stdio.h>
+// #define DEBUG_PRINTF(...) printf(__VA_ARGS__)
+#define DEBUG_PRINTF(...)
+#define MAGIC "JS110CKP"
+#define VERSION (1)
+#define BLOCK_SIZE (256)  // divides the disk sector size, see checkpoint.h
+#define FILE_SIZE (BLOCK_SIZE * (1 + JS110_CHECKPOINT_CAPACITY))
+
+struct header_s {
+    char magic[8];
+    uint32_t version;
+    uint32_t block_size;
+    uint32_t capacity;
+    volatile uint32_t count;
+    uint8_t reserved[BLOCK_SIZE - 24];
+};
+
+struct slot_s {
+    volatile uint64_t seq;
+    struct js110_checkpoint_state_s state;
+    volatile uint64_t seq_end;
+};
+
+struct record_s {
+    uint32_t serial_number;
+    uint32_t reserved1;
+    uint8_t reserved2[56];
+    struct slot_s slot[2];
+    uint8_t reserved3[BLOCK_SIZE - 64 - 2 * sizeof(struct slot_s)];  // 256 byte total
+};
+
+struct file_s {
+    struct header_s header;
+    struct record_s records[JS110_CHECKPOINT_CAPACITY];
+};
+
+static HANDLE file_ = NULL;
+static HANDLE mapping_ = NULL;
+static struct file_s * view_ = NULL;
+static uint64_t seq_[JS110_CHECKPOINT_CAPACITY];  // the last written sequence number
+static uint32_t flush_interval_ms_ = 0;
+static ULONGLONG flush_time_ms_ = 0;
+static HANDLE flush_event_ = NULL;  // wakes the flush thread
+static HANDLE flush_thread_ = NULL;
+static volatile bool flush_exit_ = false;
+
+
+static bool header_valid(const struct header_s * h) {
+    return (0 == memcmp(h->magic, MAGIC, sizeof(h->magic)))
+        && (VERSION == h->version)
+        && (BLOCK_SIZE == h->block_size)
+        && (JS110_CHECKPOINT_CAPACITY == h->capacity)
+        && (h->count <= JS110_CHECKPOINT_CAPACITY);
+}
+
+/// Wait for the disk writes that js110_checkpoint_flush() started.
+static DWORD WINAPI flush_thread(LPVOID lpParam) {
+    (void) lpParam;
+    while (1) {
+        WaitForSingleObject(flush_event_, INFINITE);
+        if (flush_exit_) {
+            break;
+        }
+        if (!FlushFileBuffers(file_)) {
+            DEBUG_PRINTF("checkpoint: FlushFileBuffers failed\n");
+        }
+    }
+    return 0;
+}
+
+static void flush_thread_stop(void) {
+    if (flush_thread_) {
+        flush_exit_ = true;
+        SetEvent(flush_event_);
+        WaitForSingleObject(flush_thread_, INFINITE);  // at most one disk flush
+        CloseHandle(flush_thread_);
+        flush_thread_ = NULL;
+    }
+    if (flush_event_) {
+        CloseHandle(flush_event_);
+        flush_event_ = NULL;
+    }
+}
+
+/// Get the newest valid slot in a record, or NULL.
+static const struct slot_s * slot_newest(const struct record_s * r) {
+    const struct slot_s * result = NULL;
+    for (int i = 0; i < 2; ++i) {
+        const struct slot_s * s = &r->slot[i];
+        if (s->seq && (s->seq == s->seq_end)) {
+            if (!result || (s->seq > result->seq)) {
+                result = s;
+            }
+        }
+    }
+    return result;
+}
+
+int js110_checkpoint_open(const char * path, uint32_t flush_interval_ms) {
+    LARGE_INTEGER size;
+    if (view_) {
+        return 1;
+    }
+    file_ = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+                        NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file_ == INVALID_HANDLE_VALUE) {
+        DEBUG_PRINTF("checkpoint: could not open %s\n", path);
+        file_ = NULL;
+        return 1;
+    }
+    if (!GetFileSizeEx(file_, &size)) {
+        size.QuadPart = 0;
+    }
+    mapping_ = CreateFileMappingA(file_, NULL, PAGE_READWRITE, 0, FILE_SIZE, NULL);
+    if (!mapping_) {
+        DEBUG_PRINTF("checkpoint: CreateFileMapping failed\n");
+        CloseHandle(file_);
+        file_ = NULL;
+        return 1;
+    }
+    view_ = (struct file_s *) MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, FILE_SIZE);
+    if (!view_) {
+        DEBUG_PRINTF("checkpoint: MapViewOfFile failed\n");
+        CloseHandle(mapping_);
+        CloseHandle(file_);
+        mapping_ = NULL;
+        file_ = NULL;
+        return 1;
+    }
+
+    memset(seq_, 0, sizeof(seq_));
+    if ((size.QuadPart < FILE_SIZE) || !header_valid(&view_->header)) {
+        DEBUG_PRINTF("checkpoint: initialize %s\n", path);
+        memset(view_, 0, FILE_SIZE);
+        memcpy(view_->header.magic, MAGIC, sizeof(view_->header.magic));
+        view_->header.version = VERSION;
+        view_->header.block_size = BLOCK_SIZE;
+        view_->header.capacity = JS110_CHECKPOINT_CAPACITY;
+        view_->header.count = 0;
+        FlushViewOfFile(view_, FILE_SIZE);
+    } else {
+        for (uint32_t i = 0; i < view_->header.count; ++i) {
+            const struct slot_s * s = slot_newest(&view_->records[i]);
+            seq_[i] = s ? s->seq : 0;
+        }
+    }
+    flush_interval_ms_ = flush_interval_ms;
+    flush_time_ms_ = GetTickCount64();
+    flush_exit_ = false;
+    flush_event_ = CreateEvent(NULL, FALSE, FALSE, NULL);  // auto reset
+    if (flush_event_) {
+        flush_thread_ = CreateThread(NULL, 0, flush_thread, NULL, 0, NULL);
+    }
+    if (!flush_thread_) {
+        DEBUG_PRINTF("checkpoint: could not start the flush thread\n");
+        js110_checkpoint_close();
+        return 1;
+    }
+    return 0;
+}
+
+void js110_checkpoint_close(void) {
+    flush_thread_stop();
+    if (view_) {
+        FlushViewOfFile(view_, FILE_SIZE);
+        UnmapViewOfFile(view_);
+        view_ = NULL;
+    }
+    if (mapping_) {
+        CloseHandle(mapping_);
+        mapping_ = NULL;
+    }
+    if (file_) {
+        FlushFileBuffers(file_);
+        CloseHandle(file_);
+        file_ = NULL;
+    }
+}
+
+int32_t js110_checkpoint_lookup(uint32_t serial_number, struct js110_checkpoint_state_s * state, int * found) {
+    *found = 0;
+    if (!view_) {
+        return -1;
+    }
+    uint32_t count = view_->header.count;
+    for (uint32_t i = 0; i < count; ++i) {
+        struct record_s * r = &view_->records[i];
+        if (r->serial_number == serial_number) {
+            const struct slot_s * s = slot_newest(r);
+            if (s) {
+                *state = s->state;
+                *found = 1;
+            }
+            return (int32_t) i;
+        }
+    }
+    if (count >= JS110_CHECKPOINT_CAPACITY) {
+        DEBUG_PRINTF("checkpoint: full\n");
+        return -1;
+    }
+    // Write the record before publishing it with the count.
+    struct record_s * r = &view_->records[count];
+    memset(r, 0, sizeof(*r));
+    r->serial_number = serial_number;
+    seq_[count] = 0;
+    MemoryBarrier();
+    view_->header.count = count + 1;
+    return (int32_t) count;
+}
+
+void js110_checkpoint_update(int32_t index, const struct js110_checkpoint_state_s * state) {
+    if (!view_ || (index < 0) || (index >= JS110_CHECKPOINT_CAPACITY)) {
+        return;
+    }
+    uint64_t seq = ++seq_[index];
+    struct slot_s * s = &view_->records[index].slot[seq & 1];
+    s->seq = seq;
+    MemoryBarrier();
+    s->state = *state;
+    MemoryBarrier();
+    s->seq_end = seq;
+}
+
+void js110_checkpoint_flush(void) {
+    if (!view_) {
+        return;
+    }
+    ULONGLONG now = GetTickCount64();
+    if ((now - flush_time_ms_) >= flush_interval_ms_) {
+        flush_time_ms_ = now;
+        FlushViewOfFile(view_, FILE_SIZE);  // starts the writes, does not wait
+        SetEvent(flush_event_);  // the flush thread waits for them
+    }
+}
+
+int64_t js110_checkpoint_time_ms(void) {
+    FILETIME t;
+    GetSystemTimeAsFileTime(&t);
+    uint64_t v = (((uint64_t) t.dwHighDateTime) << 32) | t.dwLowDateTime;
+    return (int64_t) (v / 10000);  // 100 ns to ms
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright 2020 Jetperch LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Crash-safe checkpoint of the per-device accumulation state.
+ *
+ * The checkpoint is a small memory-mapped file with one record for each
+ * device serial number.  Each record holds two slots that are written
+ * alternately.  A slot is valid when its leading and trailing sequence
+ * numbers match, so a torn write leaves the previous slot intact.
+ * Records are aligned so that they never span a disk sector.
+ *
+ * Updates are plain memory writes into the mapped view.  The operating
+ * system owns the dirty pages, so a crash of the host process loses
+ * nothing.  js110_checkpoint_flush() periodically starts writing the dirty
+ * pages, and a private flush thread then waits for the disk to complete
+ * them with FlushFileBuffers().  This bounds the loss on an operating
+ * system crash or power failure to the flush interval plus the disk
+ * write latency.
+ */
+
+#ifndef JS110_CHECKPOINT_H__
+#define JS110_CHECKPOINT_H__
+
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/// The maximum number of device serial numbers in a checkpoint file.
+#define JS110_CHECKPOINT_CAPACITY (1024)
+
+/**
+ * @brief The accumulation state for a single device.
+ *
+ * See struct device_s in js110_statistics.c.
+ */
+struct js110_checkpoint_state_s {
+    int64_t samples_total_offset;
+    int64_t samples_total_accum;
+    double charge_offset;
+    double charge_accum;
+    double energy_offset;
+    double energy_accum;
+    /// The host UTC time in milliseconds, see js110_checkpoint_time_ms().
+    int64_t time_ms;
+};
+
+/**
+ * @brief Open or create the checkpoint file.
+ *
+ * @param path The checkpoint file path.
+ * @param flush_interval_ms The interval between disk flushes.
+ * @return 0 or error code.
+ */
+int js110_checkpoint_open(const char * path, uint32_t flush_interval_ms);
+
+/**
+ * @brief Flush and close the checkpoint file.
+ */
+void js110_checkpoint_close(void);
+
+/**
+ * @brief Find or add the record for a device.
+ *
+ * @param serial_number The device serial number.
+ * @param[out] state The restored state, when found.
+ * @param[out] found 1 if state was restored, 0 otherwise.
+ * @return The record index or -1 when the checkpoint is closed or full.
+ */
+int32_t js110_checkpoint_lookup(uint32_t serial_number, struct js110_checkpoint_state_s * state, int * found);
+
+/**
+ * @brief Update a device record.
+ *
+ * @param index The record index from js110_checkpoint_lookup().
+ * @param state The new state.
+ */
+void js110_checkpoint_update(int32_t index, const struct js110_checkpoint_state_s * state);
+
+/**
+ * @brief Get the current host UTC time.
+ *
+ * @return The time in milliseconds since 1601-01-01.
+ */
+int64_t js110_checkpoint_time_ms(void);
+
+/**
+ * @brief Start writing the dirty pages to disk when the flush interval elapsed.
+ *
+ * This function does not wait for the disk writes to complete.  The
+ * flush thread waits for them instead, so that a slow disk never stalls
+ * the polling thread.
+ */
+void js110_checkpoint_flush(void);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif  /* JS110_CHECKPOINT_H__ */
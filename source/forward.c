@@ -0,0 +1,887 @@
+/*
+ * Copyright 2020 Jetperch LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "js110_forward.h"
+#include "js110_tsz.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <Windows.h>
+typedef SOCKET socket_t;
+#define SOCKET_NONE INVALID_SOCKET
+#define SEND_FLAGS (0)
+#else
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+typedef int socket_t;
+#define SOCKET_NONE (-1)
+#define SEND_FLAGS (MSG_NOSIGNAL)
+#endif
+
+
+/*
+ * The forwarder is portable so that the forwarder and the reference
+ * collector run together on a single Linux host for testing.  The small
+ * platform layer below covers the threads, locks, clocks and sockets.
+ */
+
+// #define DEBUG_PRINTF(...) fprintf(stderr, __VA_ARGS__)
+#define DEBUG_PRINTF(...)
+#define MAGIC "JSFW"
+#define VERSION (1)
+#define QUEUE_SIZE (1U << 16)           // power of 2
+#define BATCH_RECORDS_DEFAULT (256)
+#define BATCH_MS_DEFAULT (1000)
+#define SPOOL_BYTES_DEFAULT (64LLU << 20)
+#define SPOOL_REPLAY_FRAMES (64)        // per loop iteration
+#define HOST_SIZE (256)
+#define SPOOL_PATH_SIZE (1024)
+#define SEQUENCE_SUFFIX ".seq"
+#define SEQUENCE_FILE_SIZE (16)         // u64 source id, u64 sequence
+#define UDP_PAYLOAD_MAX (65507U)
+#define RECONNECT_MS_MIN (100)
+#define RECONNECT_MS_MAX (5000)
+#define SEND_TIMEOUT_MS (5000)
+#define WAIT_MS (100)
+#define STOP_TIMEOUT_MS (1000)
+#define INFLIGHT_MAX (4096)             // power of 2
+#define ACK_MAGIC "JSAK"
+
+static struct js110_forward_config_s config_;
+static char host_[HOST_SIZE];
+static char port_[8];
+static bool udp_ = false;
+static socket_t socket_ = SOCKET_NONE;
+static int64_t reconnect_time_ms_ = 0;
+static uint32_t reconnect_ms_ = RECONNECT_MS_MIN;
+static uint64_t sequence_ = 0;
+static struct js110_statistics_s * batch_ = NULL;
+static uint8_t * frame_ = NULL;
+
+// Every frame passes through the spool, which is a file when configured
+// or memory otherwise.  A frame leaves the spool once acknowledged by the
+// collector over TCP, or once sent over UDP.  The offsets only increase
+// until the spool resets when empty.
+static FILE * spool_ = NULL;
+static uint8_t * spool_mem_ = NULL;
+static uint64_t spool_mem_size_ = 0;
+static uint64_t spool_ack_ = 0;         // the offset of the first unacknowledged frame
+static uint64_t spool_send_ = 0;        // the offset of the next frame to send
+static uint64_t spool_sent_ = 0;        // the highest offset ever sent, to count resends
+static uint64_t spool_size_ = 0;        // the size containing valid frames
+
+// The TCP frames sent but not yet acknowledged, in spool order.
+struct inflight_s {
+    uint64_t source_id;
+    uint64_t sequence;
+    uint64_t end;  // the spool offset following the frame
+};
+static struct inflight_s inflight_[INFLIGHT_MAX];
+static uint32_t inflight_tail_ = 0;
+static uint32_t inflight_count_ = 0;
+static uint8_t ack_[JS110_FORWARD_ACK_SIZE];
+static uint32_t ack_length_ = 0;
+
+// Protected by lock_
+static struct js110_statistics_s * queue_ = NULL;
+static uint32_t queue_head_ = 0;
+static uint32_t queue_tail_ = 0;
+static struct js110_forward_status_s status_;
+static volatile bool active_ = false;
+static volatile bool quit_ = false;
+
+static uint32_t crc_table_[256];
+
+#if defined(_WIN32)
+static CRITICAL_SECTION lock_;
+static CONDITION_VARIABLE cond_;
+static HANDLE thread_;
+
+static void lock(void) { EnterCriticalSection(&lock_); }
+static void unlock(void) { LeaveCriticalSection(&lock_); }
+static void cond_signal(void) { WakeConditionVariable(&cond_); }
+static void cond_wait(uint32_t timeout_ms) { SleepConditionVariableCS(&cond_, &lock_, timeout_ms); }
+static void socket_close(socket_t s) { closesocket(s); }
+static void sleep_ms(uint32_t duration_ms) { Sleep(duration_ms); }
+
+static DWORD WINAPI forward_thread(LPVOID lpParam);
+
+static int thread_start(void) {
+    InitializeCriticalSection(&lock_);
+    InitializeConditionVariable(&cond_);
+    thread_ = CreateThread(NULL, 0, forward_thread, NULL, 0, NULL);
+    if (!thread_) {
+        DeleteCriticalSection(&lock_);
+        return 1;
+    }
+    return 0;
+}
+
+static void thread_join(void) {
+    WaitForSingleObject(thread_, INFINITE);
+    CloseHandle(thread_);
+    thread_ = 0;
+    DeleteCriticalSection(&lock_);
+}
+
+static int64_t time_ms(void) {
+    FILETIME t;
+    GetSystemTimeAsFileTime(&t);
+    uint64_t v = (((uint64_t) t.dwHighDateTime) << 32) | t.dwLowDateTime;
+    return (int64_t) (v / 10000) - 11644473600000LL;  // 1601 to 1970 epoch
+}
+
+static int64_t monotonic_ms(void) {
+    return (int64_t) GetTickCount64();
+}
+
+static uint64_t process_id(void) {
+    return (uint64_t) GetCurrentProcessId();
+}
+#else
+static pthread_mutex_t lock_ = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond_;
+static pthread_t thread_;
+
+static void lock(void) { pthread_mutex_lock(&lock_); }
+static void unlock(void) { pthread_mutex_unlock(&lock_); }
+static void cond_signal(void) { pthread_cond_signal(&cond_); }
+static void socket_close(socket_t s) { close(s); }
+
+static void sleep_ms(uint32_t duration_ms) {
+    struct timespec ts = {.tv_sec = duration_ms / 1000, .tv_nsec = (long) (duration_ms % 1000) * 1000000L};
+    nanosleep(&ts, NULL);
+}
+
+static void * forward_thread(void * lpParam);
+
+static int thread_start(void) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&cond_, &attr);
+    pthread_condattr_destroy(&attr);
+    if (pthread_create(&thread_, NULL, forward_thread, NULL)) {
+        pthread_cond_destroy(&cond_);
+        return 1;
+    }
+    return 0;
+}
+
+static void thread_join(void) {
+    pthread_join(thread_, NULL);
+    pthread_cond_destroy(&cond_);
+}
+
+static void cond_wait(uint32_t timeout_ms) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += timeout_ms / 1000;
+    ts.tv_nsec += (long) (timeout_ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ++ts.tv_sec;
+        ts.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&cond_, &lock_, &ts);
+}
+
+static int64_t time_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t process_id(void) {
+    return (uint64_t) getpid();
+}
+#endif
+
+static inline void u16_encode(uint8_t * p, uint16_t v) {
+    p[0] = (uint8_t) v;
+    p[1] = (uint8_t) (v >> 8);
+}
+
+static inline void u32_encode(uint8_t * p, uint32_t v) {
+    u16_encode(p, (uint16_t) v);
+    u16_encode(p + 2, (uint16_t) (v >> 16));
+}
+
+static inline void u64_encode(uint8_t * p, uint64_t v) {
+    u32_encode(p, (uint32_t) v);
+    u32_encode(p + 4, (uint32_t) (v >> 32));
+}
+
+static inline uint16_t u16_decode(const uint8_t * p) {
+    return (uint16_t) (p[0] | (((uint16_t) p[1]) << 8));
+}
+
+static inline uint32_t u32_decode(const uint8_t * p) {
+    return ((uint32_t) u16_decode(p)) | (((uint32_t) u16_decode(p + 2)) << 16);
+}
+
+static inline uint64_t u64_decode(const uint8_t * p) {
+    return ((uint64_t) u32_decode(p)) | (((uint64_t) u32_decode(p + 4)) << 32);
+}
+
+static void crc_initialize(void) {
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) {
+            c = (c & 1) ? (0xEDB88320U ^ (c >> 1)) : (c >> 1);
+        }
+        crc_table_[i] = c;
+    }
+}
+
+static uint32_t crc32(const uint8_t * buffer, uint32_t length) {
+    uint32_t c = 0xFFFFFFFFU;
+    if (!crc_table_[1]) {
+        crc_initialize();
+    }
+    for (uint32_t i = 0; i < length; ++i) {
+        c = crc_table_[(c ^ buffer[i]) & 0xff] ^ (c >> 8);
+    }
+    return c ^ 0xFFFFFFFFU;
+}
+
+int js110_forward_frame_parse(const uint8_t * buffer, uint32_t length, struct js110_forward_frame_s * frame) {
+    if (length < JS110_FORWARD_HEADER_SIZE) {
+        return ((length >= 4) && memcmp(buffer, MAGIC, 4)) ? 1 : 2;
+    }
+    if (memcmp(buffer, MAGIC, 4) || (VERSION != u16_decode(buffer + 4))
+            || (JS110_FORWARD_HEADER_SIZE != u16_decode(buffer + 6))) {
+        return 1;
+    }
+    uint32_t frame_size = u32_decode(buffer + 8);
+    if ((frame_size < JS110_FORWARD_HEADER_SIZE) || (frame_size > JS110_FORWARD_FRAME_SIZE_MAX)) {
+        return 1;
+    }
+    frame->frame_size = frame_size;
+    if (length < frame_size) {
+        return 2;
+    }
+    frame->record_count = u32_decode(buffer + 12);
+    frame->source_id = u64_decode(buffer + 16);
+    frame->sequence = u64_decode(buffer + 24);
+    frame->time_ms = (int64_t) u64_decode(buffer + 32);
+    frame->payload = buffer + JS110_FORWARD_HEADER_SIZE;
+    frame->payload_size = frame_size - JS110_FORWARD_HEADER_SIZE;
+    if (crc32(frame->payload, frame->payload_size) != u32_decode(buffer + 40)) {
+        return 1;
+    }
+    return 0;
+}
+
+void js110_forward_ack_encode(uint8_t * buffer, uint64_t source_id, uint64_t sequence) {
+    memcpy(buffer, ACK_MAGIC, 4);
+    u32_encode(buffer + 4, 0);
+    u64_encode(buffer + 8, source_id);
+    u64_encode(buffer + 16, sequence);
+}
+
+static int url_parse(const char * url) {
+    const char * p;
+    if (!url) {
+        return 1;
+    }
+    if (0 == strncmp(url, "tcp://", 6)) {
+        udp_ = false;
+    } else if (0 == strncmp(url, "udp://", 6)) {
+        udp_ = true;
+    } else {
+        return 1;
+    }
+    url += 6;
+    p = strrchr(url, ':');
+    size_t sz = p ? (size_t) (p - url) : strlen(url);
+    if (!sz || (sz >= sizeof(host_))) {
+        return 1;
+    }
+    memcpy(host_, url, sz);
+    host_[sz] = 0;
+    if (p) {
+        unsigned long port = strtoul(p + 1, NULL, 10);
+        if (!port || (port > 65535)) {
+            return 1;
+        }
+        snprintf(port_, sizeof(port_), "%lu", port);
+    } else {
+        snprintf(port_, sizeof(port_), "%u", JS110_FORWARD_PORT_DEFAULT);
+    }
+    return 0;
+}
+
+static uint64_t source_id_generate(void) {
+    char name[HOST_SIZE];
+    uint64_t h = 14695981039346656037LLU;  // FNV-1a
+    if (0 == gethostname(name, sizeof(name))) {
+        name[sizeof(name) - 1] = 0;
+        for (char * c = name; *c; ++c) {
+            h = (h ^ (uint8_t) *c) * 1099511628211LLU;
+        }
+    }
+    h = (h ^ process_id()) * 1099511628211LLU;
+    h ^= (uint64_t) time_ms();
+    return h ? h : 1;
+}
+
+static void disconnect(void) {
+    if (socket_ != SOCKET_NONE) {
+        DEBUG_PRINTF("forward: disconnect\n");
+        socket_close(socket_);
+        socket_ = SOCKET_NONE;
+        reconnect_time_ms_ = monotonic_ms() + reconnect_ms_;
+        // Resend the unacknowledged frames after reconnecting.
+        spool_send_ = spool_ack_;
+        inflight_count_ = 0;
+        ack_length_ = 0;
+        lock();
+        status_.connected = 0;
+        unlock();
+    }
+}
+
+static void connect_(void) {
+    struct addrinfo hints;
+    struct addrinfo * result = NULL;
+    int64_t now = monotonic_ms();
+    if ((socket_ != SOCKET_NONE) || (now < reconnect_time_ms_)) {
+        return;
+    }
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = udp_ ? SOCK_DGRAM : SOCK_STREAM;
+    if (0 == getaddrinfo(host_, port_, &hints, &result)) {
+        for (struct addrinfo * a = result; a; a = a->ai_next) {
+            socket_t s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+            if (s == SOCKET_NONE) {
+                continue;
+            }
+            if (0 == connect(s, a->ai_addr, (int) a->ai_addrlen)) {
+                socket_ = s;
+                break;
+            }
+            socket_close(s);
+        }
+        freeaddrinfo(result);
+    }
+    if (socket_ == SOCKET_NONE) {
+        // exponential backoff
+        reconnect_time_ms_ = now + reconnect_ms_;
+        reconnect_ms_ = (reconnect_ms_ * 2 > RECONNECT_MS_MAX) ? RECONNECT_MS_MAX : (reconnect_ms_ * 2);
+        return;
+    }
+#if defined(_WIN32)
+    DWORD timeout = SEND_TIMEOUT_MS;
+#else
+    struct timeval timeout = {.tv_sec = SEND_TIMEOUT_MS / 1000, .tv_usec = 0};
+#endif
+    setsockopt(socket_, SOL_SOCKET, SO_SNDTIMEO, (const char *) &timeout, sizeof(timeout));
+    DEBUG_PRINTF("forward: connected to %s:%s\n", host_, port_);
+    reconnect_ms_ = RECONNECT_MS_MIN;
+    lock();
+    status_.connected = 1;
+    ++status_.connects;
+    unlock();
+}
+
+static int send_all(const uint8_t * buffer, uint32_t length) {
+    if (socket_ == SOCKET_NONE) {
+        return 1;
+    }
+    while (length) {
+        int rc = (int) send(socket_, (const char *) buffer, (int) length, SEND_FLAGS);
+        if (rc <= 0) {
+            disconnect();
+            return 1;
+        }
+        buffer += rc;
+        length -= (uint32_t) rc;
+    }
+    return 0;
+}
+
+static int spool_write(uint64_t offset, const uint8_t * buffer, uint32_t length) {
+    if (spool_) {
+        return (fseek(spool_, (long) offset, SEEK_SET)
+                || (length != fwrite(buffer, 1, length, spool_))
+                || fflush(spool_)) ? 1 : 0;
+    }
+    if ((offset + length) > spool_mem_size_) {
+        uint64_t sz = spool_mem_size_ ? spool_mem_size_ : (1U << 20);
+        while (sz < (offset + length)) {
+            sz *= 2;
+        }
+        uint8_t * mem = realloc(spool_mem_, (size_t) sz);
+        if (!mem) {
+            return 1;
+        }
+        spool_mem_ = mem;
+        spool_mem_size_ = sz;
+    }
+    memcpy(spool_mem_ + offset, buffer, length);
+    return 0;
+}
+
+static int spool_read(uint64_t offset, uint8_t * buffer, uint32_t length) {
+    if (spool_) {
+        return (fseek(spool_, (long) offset, SEEK_SET)
+                || (length != fread(buffer, 1, length, spool_))) ? 1 : 0;
+    }
+    memcpy(buffer, spool_mem_ + offset, length);
+    return 0;
+}
+
+static int sequence_path(char * path) {
+    int rc = snprintf(path, SPOOL_PATH_SIZE, "%s" SEQUENCE_SUFFIX, config_.spool_path);
+    return ((rc < 0) || (rc >= SPOOL_PATH_SIZE)) ? 1 : 0;
+}
+
+/**
+ * @brief Save the last sequence number next to the spool file.
+ *
+ * The spool holds the highest sequence number until it is discarded.
+ * The sequence file keeps it after that, so a restarted forwarder with
+ * a fixed source id continues above the sequence numbers that the
+ * collector already accepted.
+ */
+static void sequence_save(void) {
+    char path[SPOOL_PATH_SIZE];
+    uint8_t buffer[SEQUENCE_FILE_SIZE];
+    if (!sequence_ || sequence_path(path)) {
+        return;
+    }
+    FILE * f = fopen(path, "wb");
+    if (!f) {
+        DEBUG_PRINTF("forward: could not open %s\n", path);
+        return;
+    }
+    u64_encode(buffer, config_.source_id);
+    u64_encode(buffer + 8, sequence_);
+    if ((sizeof(buffer) != fwrite(buffer, 1, sizeof(buffer), f)) || fflush(f)) {
+        DEBUG_PRINTF("forward: could not write %s\n", path);
+    }
+    fclose(f);
+}
+
+/// Get the last sequence number from the sequence file, or 0.
+static uint64_t sequence_load(void) {
+    char path[SPOOL_PATH_SIZE];
+    uint8_t buffer[SEQUENCE_FILE_SIZE];
+    uint64_t sequence = 0;
+    if (sequence_path(path)) {
+        return 0;
+    }
+    FILE * f = fopen(path, "rb");
+    if (!f) {
+        return 0;
+    }
+    if ((sizeof(buffer) == fread(buffer, 1, sizeof(buffer), f))
+            && (u64_decode(buffer) == config_.source_id)) {
+        sequence = u64_decode(buffer + 8);
+    }
+    fclose(f);
+    return sequence;
+}
+
+/// Discard the spool contents once all frames are acknowledged.
+static void spool_reset(void) {
+    if (spool_) {
+        sequence_save();  // before the spool loses the sequence number
+        spool_ = freopen(config_.spool_path, "w+b", spool_);
+    }
+    spool_ack_ = 0;
+    spool_send_ = 0;
+    spool_sent_ = 0;
+    spool_size_ = 0;
+}
+
+static void spool_open(void) {
+    uint8_t header[JS110_FORWARD_HEADER_SIZE];
+    struct js110_forward_frame_s frame;
+    spool_reset();
+    if (!config_.spool_path) {
+        return;
+    }
+    sequence_ = sequence_load();
+    spool_ = fopen(config_.spool_path, "r+b");
+    if (!spool_) {
+        spool_ = fopen(config_.spool_path, "w+b");
+        if (!spool_) {
+            DEBUG_PRINTF("forward: could not open spool %s\n", config_.spool_path);
+        }
+        return;
+    }
+    // Keep the valid frames from a previous run.  A torn frame at the
+    // end is overwritten by the next frame.  Continue the sequence
+    // numbers of frames from this source id, which the collector may
+    // already have accepted.
+    fseek(spool_, 0, SEEK_END);
+    uint64_t file_size = (uint64_t) ftell(spool_);
+    while ((spool_size_ + sizeof(header)) <= file_size) {
+        if (spool_read(spool_size_, header, sizeof(header))
+                || (2 != js110_forward_frame_parse(header, sizeof(header), &frame))
+                || ((spool_size_ + frame.frame_size) > file_size)) {
+            break;
+        }
+        uint64_t sequence = u64_decode(header + 24);  // parse only checks the header
+        if ((u64_decode(header + 16) == config_.source_id) && (sequence > sequence_)) {
+            sequence_ = sequence;
+        }
+        spool_size_ += frame.frame_size;
+    }
+    status_.spool_bytes = spool_size_;
+}
+
+static void spool_close(void) {
+    if (spool_) {
+        fclose(spool_);
+        spool_ = NULL;
+    }
+    free(spool_mem_);
+    spool_mem_ = NULL;
+    spool_mem_size_ = 0;
+}
+
+static void spool_append(const uint8_t * buffer, uint32_t length) {
+    if (((spool_size_ + length) > config_.spool_bytes_max) || spool_write(spool_size_, buffer, length)) {
+        lock();
+        ++status_.frames_dropped;
+        unlock();
+        return;
+    }
+    spool_size_ += length;
+    lock();
+    status_.spool_bytes = spool_size_ - spool_ack_;
+    unlock();
+}
+
+static void ack_process(void) {
+    uint64_t acked = 0;
+    if (memcmp(ack_, ACK_MAGIC, 4)) {
+        disconnect();
+        return;
+    }
+    uint64_t source_id = u64_decode(ack_ + 8);
+    uint64_t sequence = u64_decode(ack_ + 16);
+    while (inflight_count_) {
+        struct inflight_s * f = &inflight_[inflight_tail_ & (INFLIGHT_MAX - 1)];
+        if ((f->source_id != source_id) || (f->sequence > sequence)) {
+            break;
+        }
+        spool_ack_ = f->end;
+        ++inflight_tail_;
+        --inflight_count_;
+        ++acked;
+    }
+    if (spool_ack_ && (spool_ack_ >= spool_size_)) {
+        spool_reset();
+    }
+    lock();
+    status_.frames_acked += acked;
+    status_.spool_bytes = spool_size_ - spool_ack_;
+    unlock();
+}
+
+/// Receive the TCP acknowledgements without blocking.
+static void ack_receive(void) {
+    fd_set fds;
+    struct timeval tv;
+    while ((socket_ != SOCKET_NONE) && !udp_) {
+        FD_ZERO(&fds);
+        FD_SET(socket_, &fds);
+        tv.tv_sec = 0;
+        tv.tv_usec = 0;
+        if (select((int) socket_ + 1, &fds, NULL, NULL, &tv) <= 0) {
+            return;
+        }
+        int rc = (int) recv(socket_, (char *) ack_ + ack_length_, JS110_FORWARD_ACK_SIZE - ack_length_, 0);
+        if (rc <= 0) {
+            disconnect();
+            return;
+        }
+        ack_length_ += (uint32_t) rc;
+        if (ack_length_ == JS110_FORWARD_ACK_SIZE) {
+            ack_length_ = 0;
+            ack_process();
+        }
+    }
+}
+
+/// Send the spooled frames, in order, once connected.
+static void spool_send(void) {
+    struct js110_forward_frame_s frame;
+    while ((socket_ != SOCKET_NONE) && (spool_send_ < spool_size_) && (inflight_count_ < INFLIGHT_MAX)) {
+        if (spool_read(spool_send_, frame_, JS110_FORWARD_HEADER_SIZE)
+                || (2 != js110_forward_frame_parse(frame_, JS110_FORWARD_HEADER_SIZE, &frame))
+                || spool_read(spool_send_ + JS110_FORWARD_HEADER_SIZE, frame_ + JS110_FORWARD_HEADER_SIZE,
+                              frame.frame_size - JS110_FORWARD_HEADER_SIZE)) {
+            DEBUG_PRINTF("forward: spool corrupted, discard\n");
+            spool_reset();
+            break;
+        }
+        if (send_all(frame_, frame.frame_size)) {
+            return;  // resend after reconnect
+        }
+        spool_send_ += frame.frame_size;
+        lock();
+        if (spool_send_ <= spool_sent_) {
+            ++status_.frames_resent;
+        } else {
+            ++status_.frames_sent;
+            spool_sent_ = spool_send_;
+        }
+        unlock();
+        if (udp_) {
+            // No acknowledgements over UDP.
+            spool_ack_ = spool_send_;
+        } else {
+            struct inflight_s * f = &inflight_[(inflight_tail_ + inflight_count_) & (INFLIGHT_MAX - 1)];
+            f->source_id = u64_decode(frame_ + 16);
+            f->sequence = frame.sequence;
+            f->end = spool_send_;
+            ++inflight_count_;
+        }
+    }
+    if (spool_ack_ && (spool_ack_ >= spool_size_)) {
+        spool_reset();
+        lock();
+        status_.spool_bytes = 0;
+        unlock();
+    }
+}
+
+static void frame_build(const struct js110_statistics_s * records, uint32_t count) {
+    uint32_t block_size = 0;
+    uint8_t * p = frame_;
+    if (js110_tsz_encode(records, count, p + JS110_FORWARD_HEADER_SIZE,
+                         JS110_FORWARD_FRAME_SIZE_MAX - JS110_FORWARD_HEADER_SIZE, &block_size)) {
+        lock();
+        ++status_.frames_dropped;
+        unlock();
+        return;
+    }
+    uint32_t frame_size = JS110_FORWARD_HEADER_SIZE + block_size;
+    memcpy(p, MAGIC, 4);
+    u16_encode(p + 4, VERSION);
+    u16_encode(p + 6, JS110_FORWARD_HEADER_SIZE);
+    u32_encode(p + 8, frame_size);
+    u32_encode(p + 12, count);
+    u64_encode(p + 16, config_.source_id);
+    u64_encode(p + 24, ++sequence_);
+    u64_encode(p + 32, (uint64_t) time_ms());
+    u32_encode(p + 40, crc32(p + JS110_FORWARD_HEADER_SIZE, block_size));
+    u32_encode(p + 44, 0);
+    lock();
+    status_.records_framed += count;
+    unlock();
+    spool_append(p, frame_size);
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI forward_thread(LPVOID lpParam) {
+#else
+static void * forward_thread(void * lpParam) {
+#endif
+    (void) lpParam;
+    int64_t deadline_ms = 0;
+    int64_t quit_ms = 0;
+    DEBUG_PRINTF("forward_thread start\n");
+    while (1) {
+        uint32_t count = 0;
+        lock();
+        uint32_t available = queue_head_ - queue_tail_;
+        bool quit = quit_;
+        int64_t now = monotonic_ms();
+        if (!available) {
+            deadline_ms = 0;
+        } else if (!deadline_ms) {
+            deadline_ms = now + config_.batch_ms;
+        }
+        if (available && (quit || (available >= config_.batch_records) || (now >= deadline_ms))) {
+            count = (available > config_.batch_records) ? config_.batch_records : available;
+            for (uint32_t i = 0; i < count; ++i) {
+                batch_[i] = queue_[(queue_tail_ + i) & (QUEUE_SIZE - 1)];
+            }
+            queue_tail_ += count;
+            deadline_ms = 0;
+        } else if (!quit) {
+            int64_t timeout = deadline_ms ? (deadline_ms - now) : WAIT_MS;
+            cond_wait((uint32_t) ((timeout > WAIT_MS) ? WAIT_MS : timeout));
+        } else if (!quit_ms) {
+            quit_ms = now + STOP_TIMEOUT_MS;
+        }
+        unlock();
+
+        if (count) {
+            frame_build(batch_, count);
+        }
+        connect_();
+        ack_receive();
+        spool_send();
+        if (quit_ms) {
+            // Wait a little for the acknowledgements.  Unacknowledged
+            // frames remain in the spool file for the next run.
+            if ((spool_size_ == 0) || (socket_ == SOCKET_NONE) || (now >= quit_ms)) {
+                break;
+            }
+            sleep_ms(1);
+        }
+    }
+    disconnect();
+    DEBUG_PRINTF("forward_thread exit\n");
+    return 0;
+}
+
+static void free_all(void) {
+    free(queue_);
+    free(batch_);
+    free(frame_);
+    queue_ = NULL;
+    batch_ = NULL;
+    frame_ = NULL;
+}
+
+int js110_forward_start(const struct js110_forward_config_s * config) {
+    if (active_ || !config || url_parse(config->url)) {
+        return 1;
+    }
+    config_ = *config;
+    if (!config_.batch_records) {
+        config_.batch_records = BATCH_RECORDS_DEFAULT;
+    }
+    if (config_.batch_records > JS110_TSZ_BLOCK_RECORDS_MAX) {
+        config_.batch_records = JS110_TSZ_BLOCK_RECORDS_MAX;
+    }
+    if (udp_) {
+        while ((JS110_FORWARD_HEADER_SIZE + JS110_TSZ_BLOCK_SIZE_MAX(config_.batch_records)) > UDP_PAYLOAD_MAX) {
+            --config_.batch_records;
+        }
+    }
+    if (!config_.batch_ms) {
+        config_.batch_ms = BATCH_MS_DEFAULT;
+    }
+    if (!config_.spool_bytes_max) {
+        config_.spool_bytes_max = SPOOL_BYTES_DEFAULT;
+    }
+
+#if defined(_WIN32)
+    WSADATA wsa_data;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa_data)) {
+        return 1;
+    }
+#endif
+    if (!config_.source_id) {
+        config_.source_id = source_id_generate();
+    }
+    queue_ = malloc(sizeof(struct js110_statistics_s) * QUEUE_SIZE);
+    batch_ = malloc(sizeof(struct js110_statistics_s) * JS110_TSZ_BLOCK_RECORDS_MAX);
+    frame_ = malloc(JS110_FORWARD_FRAME_SIZE_MAX);
+    if (!queue_ || !batch_ || !frame_) {
+        free_all();
+        return 1;
+    }
+    memset(&status_, 0, sizeof(status_));
+    queue_head_ = 0;
+    queue_tail_ = 0;
+    sequence_ = 0;
+    inflight_tail_ = 0;
+    inflight_count_ = 0;
+    ack_length_ = 0;
+    socket_ = SOCKET_NONE;
+    reconnect_time_ms_ = 0;
+    reconnect_ms_ = RECONNECT_MS_MIN;
+    quit_ = false;
+    spool_open();
+
+    if (thread_start()) {
+        DEBUG_PRINTF("js110_forward_start could not create thread\n");
+        spool_close();
+        free_all();
+#if defined(_WIN32)
+        WSACleanup();
+#endif
+        return 1;
+    }
+    active_ = true;
+    return 0;
+}
+
+void js110_forward_push(const struct js110_statistics_s * statistics) {
+    if (!active_) {
+        return;
+    }
+    lock();
+    uint32_t available = queue_head_ - queue_tail_;
+    if (available >= QUEUE_SIZE) {
+        ++status_.records_dropped;
+    } else {
+        queue_[queue_head_ & (QUEUE_SIZE - 1)] = *statistics;
+        ++queue_head_;
+        if (!available || ((available + 1) == config_.batch_records)) {
+            cond_signal();
+        }
+    }
+    unlock();
+}
+
+int js110_forward_status(struct js110_forward_status_s * status) {
+    if (!status) {
+        return 1;
+    }
+    if (!active_) {
+        *status = status_;  // the final status after js110_forward_stop()
+        return 0;
+    }
+    lock();
+    *status = status_;
+    unlock();
+    return 0;
+}
+
+int js110_forward_stop(void) {
+    if (!active_) {
+        return 0;
+    }
+    lock();
+    quit_ = true;
+    cond_signal();
+    unlock();
+    thread_join();
+#if defined(_WIN32)
+    WSACleanup();
+#endif
+    active_ = false;
+    spool_close();
+    free_all();
+    return 0;
+}
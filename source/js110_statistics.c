@@ -15,12 +15,17 @@
  */
 
 #include "js110_statistics.h"
+#include "js110_sketch.h"
+#include "backend.h"
+#include "checkpoint.h"
 #include "device_change_notifier.h"
+#include "segment.h"
+#include "status_decode.h"
+#include "trace.h"
 #include "usb_def.h"
 #include <stdbool.h>
 #include <Windows.h>
-#include <setupapi.h>
-#include <winusb.h>
+#include <stdlib.h>
 #include <string.h> // memset
 
 
@@ -34,26 +39,46 @@
 // #include <stdio.h>
 // #define DEBUG_PRINTF(...) printf(__VA_ARGS__)
 #define DEBUG_PRINTF(...)
-#define DEVICE_INTERFACE_DETAIL_SIZE ((1024 / sizeof(uint64_t)) * sizeof(uint64_t))
-#define DEVICE_COUNT_MAX (128)
-static const DWORD CONTROL_PIPE_TIMEOUT_MS = 500;
+#define DEVICE_CAPACITY_INIT (16)
+#define DEVICE_STR_SIZE (1024)
+#define SKETCH_GROUP_MAP_SIZE (1024)
+#define CHECKPOINT_PATH_SIZE (1024)
+#define CHECKPOINT_TOLERANCE_MS (10000)
+#define POLL_INTERVAL_MS_DEFAULT (100)
+#define HEALTH_FAILURES_REOPEN (2)      // consecutive failures before reopening
+#define HEALTH_TRANSFER_SLOW_MS (100)   // slower transfers count as failures
+#define HEALTH_BACKOFF_MS_MIN (250)
+#define HEALTH_BACKOFF_MS_MAX (60000)
+#define HEALTH_RETRIES_PER_CYCLE (1)    // quarantine retries per polling cycle
+#define HEALTH_DEGRADED_BUDGET_MS (100) // polling time per cycle for degraded devices
 
 
-static inline uint16_t buf_decode_u16(uint8_t * buffer) {
-    return ((uint16_t) (buffer[0])) |
-           (((uint16_t) (buffer[1])) << 8);
-}
-static inline uint32_t buf_decode_u32(uint8_t * buffer) {
-    return (((uint32_t) buf_decode_u16(buffer))          ) |
-           (((uint32_t) buf_decode_u16(buffer + 2)) << 16);
-}
-static inline uint64_t buf_decode_u64(uint8_t * buffer) {
-    return (((uint64_t) buf_decode_u32(buffer))          ) |
-           (((uint64_t) buf_decode_u32(buffer + 4)) << 32);
-}
-#define buf_decode_i16(buffer)  ((int16_t) buf_decode_u16(buffer))
-#define buf_decode_i32(buffer)  ((int32_t) buf_decode_u32(buffer))
-#define buf_decode_i64(buffer)  ((int64_t) buf_decode_u64(buffer))
+// The fields that the library uses for accumulation and the sketches.
+#define FIELDS_INTERNAL (JS110_FIELD_SERIAL_NUMBER | JS110_FIELD_SAMPLES_THIS \
+    | JS110_FIELD_SAMPLES_PER_SECOND | JS110_FIELD_SAMPLES_TOTAL \
+    | JS110_FIELD_CHARGE | JS110_FIELD_ENERGY \
+    | JS110_FIELD_CURRENT_MEAN | JS110_FIELD_POWER_MEAN \
+    | JS110_FIELD_SAMPLES_MISSED | JS110_FIELD_WINDOWS_MISSED | JS110_FIELD_FLAGS)
+
+// The fields that fill records repeat from the following window.
+#define FIELDS_FILL_VOLTAGE (JS110_FIELD_VOLTAGE_MEAN | JS110_FIELD_VOLTAGE_MIN | JS110_FIELD_VOLTAGE_MAX)
+
+// The fields that open segments track, see js110_segment.h.
+#define FIELDS_SEGMENT (JS110_FIELD_CURRENT_MIN | JS110_FIELD_CURRENT_MAX \
+    | JS110_FIELD_VOLTAGE_MIN | JS110_FIELD_VOLTAGE_MAX \
+    | JS110_FIELD_POWER_MIN | JS110_FIELD_POWER_MAX)
+
+/**
+ * @brief A statistics update along with its raw status packet.
+ *
+ * js110_statistics_cbk receives a pointer to statistics, and
+ * js110_statistics_decode() finds the update from that pointer.
+ */
+struct update_s {
+    struct js110_statistics_s statistics;
+    uint32_t fields;  // the decoded js110_field_e fields
+    uint8_t pkt[JS110_STATUS_LENGTH];
+};
 
 
 static js110_statistics_cbk cbk_fn_ = 0;
@@ -62,6 +87,48 @@ static HANDLE thread_;
 static DWORD thread_id_;
 static volatile bool thread_exit_ = false;
 static volatile int device_change_ = 0;
+static HANDLE wake_event_ = NULL;  // wakes the polling thread, never closed
+static volatile uint32_t poll_interval_ms_ = POLL_INTERVAL_MS_DEFAULT;
+static const struct js110_backend_s * backend_ = &js110_backend_winusb;
+static char checkpoint_path_[CHECKPOINT_PATH_SIZE];
+static uint32_t checkpoint_flush_interval_ms_ = 0;
+
+// Slow consumer handling: see js110_coalesce_set().
+static CRITICAL_SECTION lock_;
+static bool lock_initialized_ = false;
+static HANDLE dispatch_thread_;
+static HANDLE dispatch_event_;
+static volatile bool dispatch_active_ = false;
+static volatile bool dispatch_exit_ = false;
+static volatile enum js110_coalesce_e coalesce_mode_ = JS110_COALESCE_MERGE;
+static volatile uint32_t slow_threshold_ms_ = 10;
+static struct js110_dispatch_status_s dispatch_status_;  // protected by lock_
+static CONDITION_VARIABLE update_cv_;  // with lock_, signals updates_delivered
+static uint32_t update_waiters_ = 0;  // protected by lock_
+static bool running_ = false;  // protected by lock_
+static volatile uint32_t fields_ = JS110_FIELD_ALL;
+static js110_health_cbk health_cbk_fn_ = 0;
+static void * health_cbk_user_data_;
+static uint32_t health_rng_ = 1;  // the backoff jitter, polling thread only
+static uint64_t transfer_ms_ = 0;  // the last status transfer duration, polling thread only
+static struct update_s update_;  // the update on loan from the polling thread
+static struct update_s dispatch_update_;  // the update on loan from the dispatcher thread
+static struct update_s fill_update_;  // the fill record on loan from the polling thread
+static volatile uint32_t fill_windows_max_ = 0;
+
+/// The accumulation resynchronization state for struct device_s.
+enum resync_e {
+    /// Continue with the current offsets.
+    RESYNC_NONE = 0,
+    /// Compute new offsets that continue from the current accumulators.
+    RESYNC_REQUIRED = 1,
+    /// The offsets and accumulators were restored from the checkpoint.
+    /// Keep the offsets unless the instrument rebooted.
+    RESYNC_RESTORED = 2,
+    /// The device was opened again after a departure or transfer failures.
+    /// Keep the offsets unless the instrument rebooted.
+    RESYNC_REOPENED = 3,
+};
 
 /// The state of a single Joulescope device "slot" in the devices_ array.
 enum device_state_e {
@@ -69,28 +136,28 @@ enum device_state_e {
     ST_PRESENT,
     ST_OPEN,
     ST_MISSING,
+    ST_QUARANTINED,  // closed after repeated failures, see js110_health_e
 };
 
 /**
- * @brief Store data associated with a single Joulescope instrument.
+ * @brief Store the data that the polling loop uses for a single instrument.
+ *
+ * The polling loop visits every device on every cycle, so this structure
+ * only holds the fields needed to poll and to process a new window.
+ * See struct device_info_s for the remaining fields.
  */
 struct device_s {
-    int id;
-    int32_t serial_number;
-    HANDLE file;
-    HANDLE winusb;
     enum device_state_e state;
-    int mark;  // for scan & detect remove
-    union {
-        SP_DEVICE_INTERFACE_DETAIL_DATA_W s;
-        // uint64_t rather than uint8_t to force alignment
-        uint64_t data[DEVICE_INTERFACE_DETAIL_SIZE / sizeof(uint64_t)];
-    } device_interface_detail;
+    int32_t serial_number;
+    void * handle;  // the backend device handle
+    uint32_t failures;  // consecutive failed status transfers
+    uint64_t retry_ms;  // the GetTickCount64() time to leave ST_QUARANTINED
 
     // The sensor-side statistics accumulate indefinitely.
     // We only want statistics over the duration of this program.
     // The following variables to allow collection from start and
     // resume if the instrument reboots (disconnects / reconnects).
+    // resync is a resync_e value.
     int resync;
     int64_t samples_total_offset;
     int64_t samples_total_accum;
@@ -98,72 +165,253 @@ struct device_s {
     double charge_accum;
     double energy_offset;
     double energy_accum;
+    int32_t checkpoint_index;  // -1 for none
+
+    // The quantile sketches for each js110_sketch_field_e, allocated on
+    // the first update and protected by lock_.  sketch_group is the
+    // group index or -1 for none.
+    struct js110_sketch_s * sketch;
+    int32_t sketch_group;
 };
 
-/// Array to hold all possible connected Joulescopes.
-static struct device_s devices_[DEVICE_COUNT_MAX];  // 0 is reserved for invalid
+/**
+ * @brief Store the infrequently used data for a single instrument.
+ */
+struct device_info_s {
+    wchar_t * path;  // the backend device path, allocated
+    uint32_t path_hash;  // for device_index_
+    int mark;  // for scan & detect remove
+    int64_t checkpoint_time_ms;  // the restored checkpoint time
+    enum js110_health_e health;
+    uint32_t quarantines;  // consecutive quarantines, for the backoff
+    struct js110_gap_s gap;  // protected by lock_
+    struct js110_segment_track_s * segments;  // allocated on the first update, protected by lock_
 
-// The Joulescope WinUSB interface's GUID.
-// {576d606f-f3de-4e4e-8a87-065b9fd21eb0}
-static const GUID guid = {0x576d606f, 0xf3de, 0x4e4e, {0x8a, 0x87, 0x06, 0x5b, 0x9f, 0xd2, 0x1e, 0xb0}};
+    // The update waiting for the dispatcher thread, protected by lock_.
+    // pending_windows is the number of device windows combined into
+    // pending, or 0 when nothing is pending.
+    struct update_s pending;
+    int32_t pending_windows;
+};
+
+// The device table, indexed by device id where 0 is reserved for invalid.
+// Only the polling thread adds devices.  It grows the arrays while
+// holding lock_, so other threads must hold lock_ to access them.
+// device_count_ is the number of used ids, including 0.
+static struct device_s * devices_ = NULL;
+static struct device_info_s * device_info_ = NULL;
+static uint32_t device_count_ = 0;
+static uint32_t device_capacity_ = 0;
+static struct js110_poll_status_s poll_status_;  // protected by lock_
+
+// The device ids by path hash, with linear probing and 0 for empty.
+// Devices are never removed, and the size is twice device_capacity_.
+// Only the polling thread uses the index.
+static uint32_t * device_index_ = NULL;
+static uint32_t device_index_size_ = 0;  // power of 2
+
+/// The device serial number to sketch group assignments, protected by lock_.
+struct sketch_group_map_s {
+    uint32_t serial_number;
+    int32_t group;
+};
+static struct sketch_group_map_s sketch_group_map_[SKETCH_GROUP_MAP_SIZE];
+static uint32_t sketch_group_map_count_ = 0;
+
+/// The group sketches, each an array of JS110_SKETCH_FIELD_COUNT, protected by lock_.
+static struct js110_sketch_s * sketch_groups_[JS110_SKETCH_GROUP_COUNT];
+
+static void lock_initialize(void) {
+    if (!lock_initialized_) {
+        InitializeCriticalSection(&lock_);
+        InitializeConditionVariable(&update_cv_);
+        wake_event_ = CreateEvent(
+                NULL,  // default security attributes
+                FALSE, // auto reset event
+                FALSE, // start unsignalled
+                NULL); // no name
+        lock_initialized_ = true;
+    }
+}
+
+/// Wake the polling thread to run a cycle now.
+static void poll_wake(void) {
+    if (wake_event_) {
+        SetEvent(wake_event_);
+    }
+}
+
+/// Count a delivered update and wake js110_wait_for_update(), lock_ must be held.
+static void update_delivered(void) {
+    ++dispatch_status_.updates_delivered;
+    if (update_waiters_) {
+        WakeAllConditionVariable(&update_cv_);
+    }
+}
 
 void on_device_change(void *cookie) {
     (void) cookie;
     device_change_ = 1;  // signal main loop to perform scan
+    poll_wake();
 }
 
-static int device_lookup(SP_DEVICE_INTERFACE_DETAIL_DATA_W * dev_interface_detail) {
-    for (int i = 1; i < DEVICE_COUNT_MAX; ++i) {
-        if (ST_EMPTY != devices_[i].state) {
-            if (0 == wcscmp(dev_interface_detail->DevicePath, devices_[i].device_interface_detail.s.DevicePath)) {
-                return i;
-            }
+void js110_backend_device_change(void) {
+    on_device_change(NULL);
+}
+
+static inline bool dev_id_valid(int dev_id) {
+    return (dev_id > 0) && ((uint32_t) dev_id < device_count_);
+}
+
+static uint32_t path_hash(const wchar_t * path) {
+    uint32_t h = 2166136261U;  // FNV-1a
+    for (; *path; ++path) {
+        h = (h ^ (uint32_t) *path) * 16777619U;
+    }
+    return h;
+}
+
+static void device_index_insert(uint32_t dev_id) {
+    uint32_t mask = device_index_size_ - 1;
+    uint32_t k = device_info_[dev_id].path_hash & mask;
+    while (device_index_[k]) {
+        k = (k + 1) & mask;
+    }
+    device_index_[k] = dev_id;
+}
+
+/// Rebuild the index for the current device_capacity_.
+static int device_index_grow(void) {
+    uint32_t size = device_capacity_ * 2;
+    uint32_t * index = calloc(size, sizeof(uint32_t));
+    if (!index) {
+        return 1;
+    }
+    free(device_index_);
+    device_index_ = index;
+    device_index_size_ = size;
+    for (uint32_t i = 1; i < device_count_; ++i) {
+        device_index_insert(i);
+    }
+    return 0;
+}
+
+static int device_lookup(const wchar_t * path) {
+    if (!device_index_size_) {
+        return 0;
+    }
+    uint32_t hash = path_hash(path);
+    uint32_t mask = device_index_size_ - 1;
+    for (uint32_t k = hash & mask; device_index_[k]; k = (k + 1) & mask) {
+        const struct device_info_s * info = &device_info_[device_index_[k]];
+        if ((info->path_hash == hash) && (0 == wcscmp(path, info->path))) {
+            return (int) device_index_[k];
         }
     }
     return 0;  // not found
 }
 
-static int device_add(SP_DEVICE_INTERFACE_DETAIL_DATA_W * dev_interface_detail) {
-    struct device_s * d;
-    for (int i = 1; i < DEVICE_COUNT_MAX; ++i) {
-        if (devices_[i].state) {
-            DEBUG_PRINTF("device_add(%d) taken %d\n", i, devices_[i].state);
-            continue;
-        }
-        d = &devices_[i];
-        memset(d, 0, sizeof(*d));
-        d->id = i;
-        d->state = ST_PRESENT;
-        memcpy(d->device_interface_detail.data, dev_interface_detail, DEVICE_INTERFACE_DETAIL_SIZE);
-        DEBUG_PRINTF("device_add(%ls)\n", dev_interface_detail->DevicePath);
-        return i;
-    }
-    DEBUG_PRINTF("Could not add device: %ls\n", dev_interface_detail->DevicePath);
-    return 0;
+/// Grow the device table, only called from the polling thread.
+static int device_table_grow(void) {
+    uint32_t capacity = device_capacity_ ? (device_capacity_ * 2) : DEVICE_CAPACITY_INIT;
+    int rc = 0;
+    EnterCriticalSection(&lock_);
+    struct device_s * devices = realloc(devices_, capacity * sizeof(struct device_s));
+    if (devices) {
+        devices_ = devices;
+    }
+    struct device_info_s * device_info = realloc(device_info_, capacity * sizeof(struct device_info_s));
+    if (device_info) {
+        device_info_ = device_info;
+    }
+    if (devices && device_info) {
+        memset(devices_ + device_capacity_, 0, (capacity - device_capacity_) * sizeof(struct device_s));
+        memset(device_info_ + device_capacity_, 0, (capacity - device_capacity_) * sizeof(struct device_info_s));
+        device_capacity_ = capacity;
+        poll_status_.device_capacity = capacity;
+    } else {
+        DEBUG_PRINTF("device_table_grow(%u) out of memory\n", capacity);
+        rc = 1;
+    }
+    LeaveCriticalSection(&lock_);
+    if (!rc && device_index_grow()) {
+        DEBUG_PRINTF("device_table_grow(%u) index out of memory\n", capacity);
+        rc = 1;
+    }
+    return rc;
 }
 
-static int device_close(int dev_id) {
-    if ((dev_id <= 0) || (dev_id > DEVICE_COUNT_MAX)) {
-        DEBUG_PRINTF("dev_id out of range: %d\n", dev_id);
-        return 1;
+/// Free the device table, lock_ must be held.
+static void device_table_free(void) {
+    js110_segment_pool_free();
+    for (uint32_t i = 0; i < device_count_; ++i) {
+        free(device_info_[i].path);
+        js110_segment_track_free(device_info_[i].segments);
+        free(devices_[i].sketch);
     }
+    free(devices_);
+    free(device_info_);
+    free(device_index_);
+    devices_ = NULL;
+    device_info_ = NULL;
+    device_index_ = NULL;
+    device_count_ = 0;
+    device_capacity_ = 0;
+    device_index_size_ = 0;
+}
 
-    if (ST_OPEN != devices_[dev_id].state) {
+static int device_add(const wchar_t * path) {
+    if (!device_count_) {
+        device_count_ = 1;  // reserve 0 for invalid
+    }
+    if ((device_count_ >= device_capacity_) && device_table_grow()) {
+        DEBUG_PRINTF("Could not add device: %ls\n", path);
         return 0;
     }
+    size_t sz = (wcslen(path) + 1) * sizeof(wchar_t);
+    wchar_t * path_copy = malloc(sz);
+    if (!path_copy) {
+        return 0;
+    }
+    memcpy(path_copy, path, sz);
 
-    struct device_s * d = &devices_[dev_id];
-    d->state = ST_MISSING;
+    uint32_t i = device_count_;
+    struct device_s * d = &devices_[i];
+    struct device_info_s * info = &device_info_[i];
+    memset(d, 0, sizeof(*d));
+    memset(info, 0, sizeof(*info));
+    d->state = ST_PRESENT;
+    d->resync = RESYNC_REQUIRED;
+    d->sketch_group = -1;
+    d->checkpoint_index = -1;
+    info->path = path_copy;
+    info->path_hash = path_hash(path);
+    device_index_insert(i);
+    EnterCriticalSection(&lock_);
+    device_count_ = i + 1;  // publish to the other threads
+    LeaveCriticalSection(&lock_);
+    DEBUG_PRINTF("device_add(%ls)\n", path);
+    return (int) i;
+}
 
-    if (d->winusb) {
-        WinUsb_Free(d->winusb);
-        d->winusb = 0;
+static int device_close(int dev_id) {
+    if (!dev_id_valid(dev_id)) {
+        DEBUG_PRINTF("dev_id out of range: %d\n", dev_id);
+        return 1;
     }
-    if (d->file) {
-        CloseHandle(d->file);
-        d->file = 0;
+
+    struct device_s * d = &devices_[dev_id];
+    if (ST_QUARANTINED == d->state) {
+        d->state = ST_MISSING;  // already closed
+        return 0;
+    }
+    if (ST_OPEN != d->state) {
+        return 0;
     }
 
+    d->state = ST_MISSING;
+    backend_->close(d->handle);
+    d->handle = NULL;
     return 0;
 }
 
@@ -198,49 +446,114 @@ static int32_t extract_serial_number(char * str) {
     return atoi(start);
 }
 
-static int device_open_(int dev_id) {
-    char device_str[DEVICE_INTERFACE_DETAIL_SIZE];
+/// Find the sketch group for a serial number, lock_ must be held.
+static int32_t sketch_group_lookup(uint32_t serial_number) {
+    for (uint32_t i = 0; i < sketch_group_map_count_; ++i) {
+        if (sketch_group_map_[i].serial_number == serial_number) {
+            return sketch_group_map_[i].group;
+        }
+    }
+    return -1;
+}
 
-    ULONG length_transferred = 0;
-    struct device_s * d = &devices_[dev_id];
-    d->file = CreateFileW(
-            d->device_interface_detail.s.DevicePath,
-            GENERIC_WRITE | GENERIC_READ,
-            FILE_SHARE_WRITE | FILE_SHARE_READ,
-            NULL,
-            OPEN_EXISTING,
-            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED,
-            NULL);
-    if (d->file == INVALID_HANDLE_VALUE) {
-        DEBUG_PRINTF("device_open_ Device CreateFileW failed\n");
-        return 1;
+static struct js110_sketch_s * sketch_alloc(void) {
+    struct js110_sketch_s * sketch = malloc(sizeof(struct js110_sketch_s) * JS110_SKETCH_FIELD_COUNT);
+    if (sketch) {
+        for (int i = 0; i < JS110_SKETCH_FIELD_COUNT; ++i) {
+            js110_sketch_clear(&sketch[i]);
+        }
     }
+    return sketch;
+}
 
-    if (!WinUsb_Initialize(d->file, &d->winusb)) {
-        DEBUG_PRINTF("device_open_ Device WinUsb_Initialize failed\n");
-        device_close(dev_id);
-        return 1;
+static void sketch_add(struct js110_sketch_s * sketch, const struct js110_statistics_s * statistics) {
+    js110_sketch_add(&sketch[JS110_SKETCH_CURRENT_MEAN], statistics->current_mean);
+    js110_sketch_add(&sketch[JS110_SKETCH_POWER_MEAN], statistics->power_mean);
+}
+
+static void sketch_update(struct device_s * d, const struct js110_statistics_s * statistics) {
+    EnterCriticalSection(&lock_);
+    if (!d->sketch) {
+        d->sketch = sketch_alloc();
+    }
+    if (d->sketch) {
+        sketch_add(d->sketch, statistics);
+    }
+    int32_t group = d->sketch_group;
+    if (group >= 0) {
+        if (!sketch_groups_[group]) {
+            sketch_groups_[group] = sketch_alloc();
+        }
+        if (sketch_groups_[group]) {
+            sketch_add(sketch_groups_[group], statistics);
+        }
     }
+    LeaveCriticalSection(&lock_);
+}
+
+static void sketch_free_all(void) {
+    for (int i = 0; i < JS110_SKETCH_GROUP_COUNT; ++i) {
+        free(sketch_groups_[i]);
+        sketch_groups_[i] = NULL;
+    }
+}
 
-    // Reduce control endpoint timeout
-    // https://docs.microsoft.com/en-us/windows-hardware/drivers/usbcon/winusb-functions-for-pipe-policy-modification
-    if (!WinUsb_SetPipePolicy(d->winusb, 0, PIPE_TRANSFER_TIMEOUT,
-                              sizeof(CONTROL_PIPE_TIMEOUT_MS), (void *) &CONTROL_PIPE_TIMEOUT_MS)) {
-        DEBUG_PRINTF("WinUsb_SetPipePolicy failed\n");
+static void checkpoint_restore(struct device_s * d) {
+    struct js110_checkpoint_state_s state;
+    int found = 0;
+    d->checkpoint_index = js110_checkpoint_lookup(d->serial_number, &state, &found);
+    if (found) {
+        DEBUG_PRINTF("checkpoint restore %d\n", d->serial_number);
+        d->samples_total_offset = state.samples_total_offset;
+        d->samples_total_accum = state.samples_total_accum;
+        d->charge_offset = state.charge_offset;
+        d->charge_accum = state.charge_accum;
+        d->energy_offset = state.energy_offset;
+        d->energy_accum = state.energy_accum;
+        device_info_[d - devices_].checkpoint_time_ms = state.time_ms;
+        d->resync = RESYNC_RESTORED;
     }
-    wcstombs_s(0, device_str, sizeof(device_str), d->device_interface_detail.s.DevicePath, _TRUNCATE);
+}
+
+static void checkpoint_save(struct device_s * d) {
+    struct js110_checkpoint_state_s state;
+    if (d->checkpoint_index < 0) {
+        return;
+    }
+    state.samples_total_offset = d->samples_total_offset;
+    state.samples_total_accum = d->samples_total_accum;
+    state.charge_offset = d->charge_offset;
+    state.charge_accum = d->charge_accum;
+    state.energy_offset = d->energy_offset;
+    state.energy_accum = d->energy_accum;
+    state.time_ms = js110_checkpoint_time_ms();
+    js110_checkpoint_update(d->checkpoint_index, &state);
+}
+
+static int device_open_(int dev_id) {
+    char device_str[DEVICE_STR_SIZE];
+    struct device_s * d = &devices_[dev_id];
+    const wchar_t * path = device_info_[dev_id].path;
+
+    if (backend_->open(path, &d->handle)) {
+        DEBUG_PRINTF("device_open_ failed\n");
+        d->handle = NULL;
+        return 1;
+    }
+    wcstombs_s(0, device_str, sizeof(device_str), path, _TRUNCATE);
     DEBUG_PRINTF("device_open(%s)\n", device_str);
     d->serial_number = extract_serial_number(device_str);
-    d->resync = 1;
+    if ((RESYNC_NONE == d->resync) || (RESYNC_REOPENED == d->resync)) {
+        d->resync = RESYNC_REOPENED;  // the offsets remain valid
+    }
+    if (d->checkpoint_index < 0) {
+        checkpoint_restore(d);
+    }
+    EnterCriticalSection(&lock_);
+    d->sketch_group = sketch_group_lookup(d->serial_number);
+    LeaveCriticalSection(&lock_);
 
     // Configure the Joulescope for normal operation.
-    WINUSB_SETUP_PACKET setup_pkt;
-    setup_pkt.RequestType = USB_REQUEST_TYPE(DEVICE, VENDOR, OUT);
-    setup_pkt.Request = JS110_USBREQ_SETTINGS;
-    setup_pkt.Value = 0;
-    setup_pkt.Index = 0;
-    setup_pkt.Length = 0;
-
     uint8_t pkt[16];
     memset(pkt, 0, sizeof(pkt));
     pkt[0] = 1;     // packet format version
@@ -251,17 +564,19 @@ static int device_open_(int dev_id) {
     pkt[10] = 0xC0; // normal operation
     pkt[11] = 0x00; // 15V range
     pkt[12] = 0x00; // no streaming
-    if (WinUsb_ControlTransfer(d->winusb, setup_pkt, pkt, sizeof(pkt), &length_transferred, 0)) {
+    if (0 == backend_->control_out(d->handle, JS110_USBREQ_SETTINGS, pkt, sizeof(pkt))) {
         d->state = ST_OPEN;
         return 0;
     } else {
-        DEBUG_PRINTF("WinUsb_ControlTransfer settings failed\n");
+        DEBUG_PRINTF("settings failed\n");
+        backend_->close(d->handle);
+        d->handle = NULL;
         return 1;
     }
 }
 
 static int device_open(int dev_id) {
-    if ((dev_id <= 0) || (dev_id > DEVICE_COUNT_MAX)) {
+    if (!dev_id_valid(dev_id)) {
         DEBUG_PRINTF("dev_id out of range: %d\n", dev_id);
         return 1;
     }
@@ -274,170 +589,650 @@ static int device_open(int dev_id) {
             DEBUG_PRINTF("device_open(%d) duplicate\n", dev_id);
             return 0;
         case ST_MISSING:  /* intentional fall-through */
-        case ST_PRESENT:
-            return device_open_(dev_id);
+        case ST_PRESENT: {
+            JS110_TRACE_BEGIN(t_open);
+            int rc = device_open_(dev_id);
+            JS110_TRACE_END(t_open, TRACE_OPEN, devices_[dev_id].serial_number);
+            return rc;
+        }
         default:
             DEBUG_PRINTF("device_open(%d) but invalid state %d\n", dev_id, devices_[dev_id].state);
             return 1;
     }
 }
 
+static void health_set(int dev_id, enum js110_health_e health, uint32_t retry_ms) {
+    struct device_info_s * info = &device_info_[dev_id];
+    if ((info->health == health) && (JS110_HEALTH_QUARANTINED != health)) {
+        return;
+    }
+    info->health = health;
+    if (health_cbk_fn_) {
+        health_cbk_fn_(health_cbk_user_data_, (uint32_t) devices_[dev_id].serial_number, health, retry_ms);
+    }
+}
+
+static uint32_t health_rng_next(void) {
+    uint32_t x = health_rng_;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    health_rng_ = x;
+    return x;
+}
+
+/**
+ * @brief Close a failing device and stop polling it until retry_ms.
+ *
+ * The backoff doubles with each consecutive quarantine.  The jitter
+ * spreads the retries of devices that failed together, such as all
+ * devices behind a failed hub.
+ */
+static void device_quarantine(int dev_id, uint64_t now_ms) {
+    struct device_s * d = &devices_[dev_id];
+    struct device_info_s * info = &device_info_[dev_id];
+    if (d->handle) {
+        backend_->close(d->handle);
+        d->handle = NULL;
+    }
+    d->state = ST_QUARANTINED;
+    uint32_t backoff_ms = HEALTH_BACKOFF_MS_MAX;
+    if (info->quarantines < 16) {
+        backoff_ms = HEALTH_BACKOFF_MS_MIN << info->quarantines;
+        backoff_ms = (backoff_ms < HEALTH_BACKOFF_MS_MAX) ? backoff_ms : HEALTH_BACKOFF_MS_MAX;
+    }
+    ++info->quarantines;
+    backoff_ms = backoff_ms - backoff_ms / 4 + health_rng_next() % (backoff_ms / 2 + 1);  // +/- 25%
+    d->retry_ms = now_ms + backoff_ms;
+    DEBUG_PRINTF("device_quarantine(%d) for %u ms\n", dev_id, backoff_ms);
+    EnterCriticalSection(&lock_);
+    ++poll_status_.quarantines;
+    LeaveCriticalSection(&lock_);
+    health_set(dev_id, JS110_HEALTH_QUARANTINED, backoff_ms);
+}
+
+/**
+ * @brief Close and open a failing device.
+ *
+ * Opening again recovers a handle that went stale, such as when a device
+ * departs and arrives again between two scans.
+ */
+static int device_reopen(int dev_id) {
+    struct device_s * d = &devices_[dev_id];
+    if (d->handle) {
+        backend_->close(d->handle);
+        d->handle = NULL;
+    }
+    d->state = ST_MISSING;
+    EnterCriticalSection(&lock_);
+    ++poll_status_.reopens;
+    LeaveCriticalSection(&lock_);
+    return device_open(dev_id);
+}
+
+/**
+ * @brief Update the device health after a status transfer.
+ *
+ * @param dev_id The device id.
+ * @param rc The js110_statistics() result, nonzero for a slow transfer.
+ * @param now_ms The GetTickCount64() time.
+ *
+ * The first failure degrades the device.  HEALTH_FAILURES_REOPEN
+ * consecutive failures reopen the device, and any failure after that
+ * quarantines it.  So a failing device costs at most
+ * HEALTH_FAILURES_REOPEN + 1 transfer timeouts and one reopen before
+ * the polling loop skips it.
+ */
+static void device_health_update(int dev_id, int rc, uint64_t now_ms) {
+    struct device_s * d = &devices_[dev_id];
+    if (!rc) {
+        d->failures = 0;
+        device_info_[dev_id].quarantines = 0;
+        health_set(dev_id, JS110_HEALTH_OK, 0);
+        return;
+    }
+    ++d->failures;
+    EnterCriticalSection(&lock_);
+    ++poll_status_.transfer_errors;
+    LeaveCriticalSection(&lock_);
+    if (d->failures < HEALTH_FAILURES_REOPEN) {
+        health_set(dev_id, JS110_HEALTH_DEGRADED, 0);
+    } else if ((d->failures > HEALTH_FAILURES_REOPEN) || device_reopen(dev_id)) {
+        device_quarantine(dev_id, now_ms);
+    } else {
+        health_set(dev_id, JS110_HEALTH_DEGRADED, 0);
+    }
+}
+
+/// Retry a quarantined device.
+static void device_retry(int dev_id, uint64_t now_ms) {
+    if (device_reopen(dev_id)) {
+        device_quarantine(dev_id, now_ms);
+        return;
+    }
+    // Poll normally, but quarantine again on the next failure.
+    devices_[dev_id].failures = HEALTH_FAILURES_REOPEN;
+    health_set(dev_id, JS110_HEALTH_DEGRADED, 0);
+}
+
+static void scan_found(void * user_data, const wchar_t * path) {
+    (void) user_data;
+    int device_id = device_lookup(path);
+    if (!device_id) {
+        // New device, never seen before.
+        device_id = device_add(path);
+        if (!device_id) {
+            return;
+        }
+        device_open(device_id);
+    } else if (ST_MISSING == devices_[device_id].state) {
+        // Known device, must have disconnected, but now reconnecting.
+        // The arrival resets the device health.
+        devices_[device_id].failures = 0;
+        device_info_[device_id].quarantines = 0;
+        if (0 == device_open(device_id)) {
+            health_set(device_id, JS110_HEALTH_OK, 0);
+        }
+    }
+    device_info_[device_id].mark = 1;
+}
+
 int js110_scan(void) {
-    DWORD member_index = 0;
-    int device_id = 0;
-    uint64_t data[DEVICE_INTERFACE_DETAIL_SIZE / sizeof(uint64_t)];
-    SP_DEVICE_INTERFACE_DETAIL_DATA_W * dev_interface_detail = (SP_DEVICE_INTERFACE_DETAIL_DATA_W *) data;
-    SP_DEVICE_INTERFACE_DATA dev_interface;
-    HANDLE handle = SetupDiGetClassDevsW(&guid, NULL, NULL, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
-    if (!handle) {
+    int rc;
+    JS110_TRACE_BEGIN(t_scan);
+    for (uint32_t i = 1; i < device_count_; ++i) {
+        device_info_[i].mark = 0;  // clear
+    }
+
+    JS110_TRACE_BEGIN(t_enumerate);
+    rc = backend_->scan(scan_found, NULL);
+    JS110_TRACE_END(t_enumerate, TRACE_ENUMERATE, 0);
+    if (rc) {
+        JS110_TRACE_END(t_scan, TRACE_SCAN, 0);
         return 1;
     }
 
-    for (int i = 1; i < DEVICE_COUNT_MAX; ++i) {
-        devices_[i].mark = 0;  // clear
-    }
-
-    memset(&dev_interface, 0, sizeof(dev_interface));
-    dev_interface.cbSize = sizeof(dev_interface);
-    while (SetupDiEnumDeviceInterfaces(handle, NULL, &guid, member_index, &dev_interface)) {
-        DWORD required_size = 0;
-        SetupDiGetDeviceInterfaceDetailW(
-                handle,
-                &dev_interface,
-                0, 0, &required_size, 0);
-        memset(dev_interface_detail, 0, DEVICE_INTERFACE_DETAIL_SIZE);
-        dev_interface_detail->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA_W);
-        if (!SetupDiGetDeviceInterfaceDetailW(
-                handle,
-                &dev_interface,
-                dev_interface_detail, required_size, &required_size, 0)) {
-            DEBUG_PRINTF("SetupDiGetDeviceInterfaceDetailW failed\n");
-            continue;
+    for (uint32_t i = 1; i < device_count_; ++i) {
+        if (!device_info_[i].mark) {  // unmarked, device removed
+            device_close((int) i);
         }
-        // DEBUG_PRINTF("scan %d: found %ls, %d\n", member_index, dev_interface_detail->DevicePath, required_size);
+    }
 
-        device_id = device_lookup(dev_interface_detail);
-        if (!device_id) {
-            // New device, never seen before.
-            device_id = device_add(dev_interface_detail);
-            device_open(device_id);
-        } else if (ST_MISSING == devices_[device_id].state) {
-            // Known device, must have disconnected, but now reconnecting.
-            device_open(device_id);
-        }
-        devices_[device_id].mark = 1;
-        ++member_index;
+    JS110_TRACE_END(t_scan, TRACE_SCAN, 0);
+    return 0;
+}
+
+static inline double mean_merge(double a, int32_t a_count, double b, int32_t b_count) {
+    int64_t count = (int64_t) a_count + b_count;
+    if (count <= 0) {
+        return b;
     }
-    SetupDiDestroyDeviceInfoList(handle);
+    return (a * a_count + b * b_count) / count;
+}
+
+static inline double min_merge(double a, double b) {
+    return (a < b) ? a : b;
+}
+
+static inline double max_merge(double a, double b) {
+    return (a > b) ? a : b;
+}
+
+/**
+ * @brief Combine a newer window into the pending update.
+ *
+ * @param p The pending update, modified in place.
+ * @param s The newer window.
+ *
+ * The accumulated fields (samples_total, charge, energy) always come
+ * from the newer window, so they remain exact.
+ */
+static void statistics_merge(struct js110_statistics_s * p, const struct js110_statistics_s * s) {
+    int32_t n0 = p->samples_this;
+    int32_t n1 = s->samples_this;
+    p->current_mean = mean_merge(p->current_mean, n0, s->current_mean, n1);
+    p->voltage_mean = mean_merge(p->voltage_mean, n0, s->voltage_mean, n1);
+    p->power_mean = mean_merge(p->power_mean, n0, s->power_mean, n1);
+    p->current_min = min_merge(p->current_min, s->current_min);
+    p->voltage_min = min_merge(p->voltage_min, s->voltage_min);
+    p->power_min = min_merge(p->power_min, s->power_min);
+    p->current_max = max_merge(p->current_max, s->current_max);
+    p->voltage_max = max_merge(p->voltage_max, s->voltage_max);
+    p->power_max = max_merge(p->power_max, s->power_max);
+    p->samples_this = n0 + n1;
+    p->samples_per_update = s->samples_per_update;
+    p->samples_per_second = s->samples_per_second;
+    p->samples_total = s->samples_total;
+    p->charge = s->charge;
+    p->energy = s->energy;
+    p->samples_missed += s->samples_missed;
+    p->windows_missed += s->windows_missed;
+    p->flags |= s->flags;
+}
 
-    for (int i = 1; i < DEVICE_COUNT_MAX; ++i) {
-        if (!devices_[i].mark) {  // unmarked, device removed
-            device_close(i);
+static DWORD WINAPI dispatch_thread(LPVOID lpParam) {
+    (void) lpParam;
+    DEBUG_PRINTF("dispatch_thread start\n");
+    js110_trace_thread_name("js110 dispatch");
+    while (1) {
+        bool quit = dispatch_exit_;  // sample before draining
+        for (uint32_t i = 1; ; ++i) {
+            int32_t windows = 0;
+            EnterCriticalSection(&lock_);
+            if (i >= device_count_) {
+                LeaveCriticalSection(&lock_);
+                break;
+            }
+            struct device_info_s * info = &device_info_[i];
+            windows = info->pending_windows;
+            if (windows) {
+                dispatch_update_ = info->pending;
+                info->pending_windows = 0;
+            }
+            LeaveCriticalSection(&lock_);
+            if (windows) {
+                if (cbk_fn_) {
+                    JS110_TRACE_BEGIN(t_callback);
+                    cbk_fn_(cbk_user_data_, &dispatch_update_.statistics);
+                    JS110_TRACE_END(t_callback, TRACE_CALLBACK, dispatch_update_.statistics.serial_number);
+                }
+                EnterCriticalSection(&lock_);
+                update_delivered();
+                LeaveCriticalSection(&lock_);
+            }
+        }
+        if (quit) {
+            break;
         }
+        // statistics_deliver() and dispatch_stop() set the event.
+        WaitForSingleObject(dispatch_event_, INFINITE);
     }
+    js110_trace_thread_exit();
+    DEBUG_PRINTF("dispatch_thread exit\n");
+    return 0;
+}
 
+static int dispatch_start(void) {
+    if (dispatch_active_) {
+        return 0;
+    }
+    dispatch_event_ = CreateEvent(
+            NULL,  // default security attributes
+            FALSE, // auto reset event
+            FALSE, // start unsignalled
+            NULL); // no name
+    if (!dispatch_event_) {
+        DEBUG_PRINTF("dispatch_start could not create event\n");
+        return 1;
+    }
+    dispatch_exit_ = false;
+    dispatch_thread_ = CreateThread(NULL, 0, dispatch_thread, NULL, 0, NULL);
+    if (!dispatch_thread_) {
+        DEBUG_PRINTF("dispatch_start could not create thread\n");
+        CloseHandle(dispatch_event_);
+        dispatch_event_ = 0;
+        return 1;
+    }
+    EnterCriticalSection(&lock_);
+    dispatch_status_.active = 1;
+    LeaveCriticalSection(&lock_);
+    dispatch_active_ = true;
     return 0;
 }
 
+static void dispatch_stop(void) {
+    if (!dispatch_active_) {
+        return;
+    }
+    dispatch_exit_ = true;
+    SetEvent(dispatch_event_);
+    // The thread exits after one more drain, once any callback returns.
+    // Closing the handles any earlier would break the running thread.
+    if (WAIT_OBJECT_0 != WaitForSingleObject(dispatch_thread_, INFINITE)) {
+        DEBUG_PRINTF("dispatch thread - not closed cleanly.\n");
+    }
+    CloseHandle(dispatch_thread_);
+    CloseHandle(dispatch_event_);
+    dispatch_thread_ = 0;
+    dispatch_event_ = 0;
+    dispatch_active_ = false;
+}
+
+/// Decode the fields of an update that are not yet decoded.
+static void update_decode(struct update_s * u, uint32_t fields) {
+    uint32_t todo = fields & ~u->fields;
+    if (todo) {
+        js110_status_decode(u->pkt, todo, &u->statistics);
+        u->fields |= todo;
+    }
+}
+
+static void statistics_deliver(int dev_id, struct update_s * u) {
+    if (!dispatch_active_) {
+        LARGE_INTEGER t_start;
+        LARGE_INTEGER t_end;
+        LARGE_INTEGER frequency;
+        QueryPerformanceCounter(&t_start);
+        if (cbk_fn_) {
+            JS110_TRACE_BEGIN(t_callback);
+            cbk_fn_(cbk_user_data_, &u->statistics);
+            JS110_TRACE_END(t_callback, TRACE_CALLBACK, u->statistics.serial_number);
+        }
+        QueryPerformanceCounter(&t_end);
+        QueryPerformanceFrequency(&frequency);
+        EnterCriticalSection(&lock_);
+        update_delivered();
+        LeaveCriticalSection(&lock_);
+        int64_t duration_ms = ((t_end.QuadPart - t_start.QuadPart) * 1000) / frequency.QuadPart;
+        if (duration_ms >= (int64_t) slow_threshold_ms_) {
+            DEBUG_PRINTF("slow consumer: %lld ms, start dispatcher\n", duration_ms);
+            dispatch_start();
+        }
+        return;
+    }
+
+    EnterCriticalSection(&lock_);
+    struct device_info_s * info = &device_info_[dev_id];
+    if (!info->pending_windows) {
+        info->pending = *u;
+    } else if (JS110_COALESCE_LATEST == coalesce_mode_) {
+        // Keep the instrument gap before the dropped window, which
+        // info->gap already counts.  The dropped window itself only
+        // counts in windows_dropped.
+        struct js110_statistics_s * p = &info->pending.statistics;
+        int64_t samples_missed = p->samples_missed;
+        uint32_t windows_missed = p->windows_missed;
+        uint32_t flags = p->flags;
+        info->pending = *u;
+        p->samples_missed += samples_missed;
+        p->windows_missed += windows_missed;
+        p->flags |= flags;
+        ++dispatch_status_.windows_dropped;
+    } else {
+        // The raw packet only describes a single window, so merge all fields.
+        update_decode(&info->pending, JS110_FIELD_ALL);
+        update_decode(u, JS110_FIELD_ALL);
+        statistics_merge(&info->pending.statistics, &u->statistics);
+        ++dispatch_status_.windows_merged;
+    }
+    ++info->pending_windows;
+    LeaveCriticalSection(&lock_);
+    SetEvent(dispatch_event_);
+}
+
+/**
+ * @brief Deliver the fill records for the windows missed before an update.
+ *
+ * @param dev_id The device index.
+ * @param u The update following the gap, with the adjusted totals.
+ * @param samples_total The samples_total of the previous update.
+ * @param charge The charge of the previous update.
+ * @param energy The energy of the previous update.
+ */
+static void gap_fill(int dev_id, struct update_s * u, int64_t samples_total, double charge, double energy) {
+    struct js110_statistics_s * s = &u->statistics;
+    struct js110_statistics_s * f = &fill_update_.statistics;
+    uint32_t windows = s->windows_missed;
+    double window_s = (double) s->samples_this / s->samples_per_second;
+    double gap_s = window_s * windows;
+
+    // charge and energy include the gap, so the gap means are exact.
+    double charge_gap = (s->charge - charge) - s->current_mean * window_s;
+    double energy_gap = (s->energy - energy) - s->power_mean * window_s;
+    memset(f, 0, sizeof(*f));
+    js110_status_decode(u->pkt, FIELDS_FILL_VOLTAGE | JS110_FIELD_SAMPLES_PER_UPDATE, f);
+    f->serial_number = s->serial_number;
+    f->samples_this = s->samples_this;
+    f->samples_per_second = s->samples_per_second;
+    f->current_mean = charge_gap / gap_s;
+    f->current_min = f->current_mean;
+    f->current_max = f->current_mean;
+    f->power_mean = energy_gap / gap_s;
+    f->power_min = f->power_mean;
+    f->power_max = f->power_mean;
+    f->flags = JS110_FLAG_FILL;
+    fill_update_.fields = JS110_FIELD_ALL;
+
+    for (uint32_t k = 1; k <= windows; ++k) {
+        if (dispatch_active_) {
+            break;  // the consumer became slow, see js110_gap_fill_set()
+        }
+        f->samples_total = samples_total + k * (int64_t) s->samples_this;
+        f->charge = charge + (charge_gap * k) / windows;
+        f->energy = energy + (energy_gap * k) / windows;
+        statistics_deliver(dev_id, &fill_update_);
+        EnterCriticalSection(&lock_);
+        ++device_info_[dev_id].gap.fills;
+        LeaveCriticalSection(&lock_);
+    }
+}
+
 int js110_statistics(int dev_id) {
     uint8_t pkt[128];
-    ULONG length_transferred = 0;
-    struct js110_statistics_s statistics;
-    memset(&statistics, 0, sizeof(statistics));
-    if ((dev_id <= 0) || (dev_id > DEVICE_COUNT_MAX)) {
+    uint32_t length_transferred = 0;
+    struct update_s * u = &update_;
+    struct js110_statistics_s * statistics = &u->statistics;
+    if (!dev_id_valid(dev_id)) {
         DEBUG_PRINTF("dev_id out of range: %d\n", dev_id);
         return 1;
     }
     struct device_s * d = &devices_[dev_id];
+    transfer_ms_ = 0;
     if (d->state != ST_OPEN) {
         return 0;
     }
 
-    // Request statistics from the Joulescope instrumnet
-    WINUSB_SETUP_PACKET setup_pkt;
-    setup_pkt.RequestType = USB_REQUEST_TYPE(DEVICE, VENDOR, IN);
-    setup_pkt.Request = JS110_USBREQ_STATUS;
-    setup_pkt.Value = 0;
-    setup_pkt.Index = 0;
-    setup_pkt.Length = 0;
-
-    if (!WinUsb_ControlTransfer(d->winusb, setup_pkt, pkt, sizeof(pkt), &length_transferred, 0)) {
-        DEBUG_PRINTF("WinUsb_ControlTransfer settings failed\n");
+    // Request statistics from the Joulescope instrument
+    JS110_TRACE_BEGIN(t_status);
+    uint64_t t_ms = GetTickCount64();
+    int rc = backend_->control_in(d->handle, JS110_USBREQ_STATUS, pkt, sizeof(pkt), &length_transferred);
+    transfer_ms_ = GetTickCount64() - t_ms;
+    JS110_TRACE_END(t_status, TRACE_STATUS, d->serial_number);
+    if (rc) {
+        DEBUG_PRINTF("status failed\n");
         return 1;
     }
-    if (104 != length_transferred) {
-        DEBUG_PRINTF("unexpected length = %lu\n", length_transferred);
+    if (JS110_STATUS_LENGTH != length_transferred) {
+        DEBUG_PRINTF("unexpected length = %u\n", length_transferred);
         return 1;
     }
 
-    statistics.samples_this = buf_decode_i32(pkt + 56);
-    if (0 == statistics.samples_this) {
+    js110_status_decode(pkt, JS110_FIELD_SAMPLES_THIS, statistics);
+    if (0 == statistics->samples_this) {
         return 0;  // no new statistics available
     }
 
-    // parse statistics message
-    statistics.serial_number = d->serial_number;
-    statistics.samples_total = buf_decode_u64(pkt + 24);
-    statistics.power_mean = ((double) buf_decode_i64(pkt + 32)) / (1LLU << 34);
-    statistics.charge = ((double) buf_decode_i64(pkt + 40)) / (1LLU << 27);
-    statistics.energy = ((double) buf_decode_i64(pkt + 48)) / (1LLU << 27);
-    statistics.samples_per_update = buf_decode_i32(pkt + 60);
-    statistics.samples_per_second = buf_decode_i32(pkt + 64);
-    statistics.current_mean = ((double) buf_decode_i32(pkt + 68)) / (1LU << 27);
-    statistics.current_min = ((double) buf_decode_i32(pkt + 72)) / (1LU << 27);
-    statistics.current_max = ((double) buf_decode_i32(pkt + 76)) / (1LU << 27);
-    statistics.voltage_mean = ((double) buf_decode_i32(pkt + 80)) / (1LU << 17);
-    statistics.voltage_min = ((double) buf_decode_i32(pkt + 84)) / (1LU << 17);
-    statistics.voltage_max = ((double) buf_decode_i32(pkt + 88)) / (1LU << 17);
-    statistics.power_min = ((double) buf_decode_i32(pkt + 92)) / (1LU << 21);
-    statistics.power_max = ((double) buf_decode_i32(pkt + 96)) / (1LU << 21);
+    // Parse the statistics message, but only the fields that are used.
+    JS110_TRACE_BEGIN(t_decode);
+    // Keep the packet to decode the other fields on demand.
+    memset(statistics, 0, sizeof(*statistics));
+    memcpy(u->pkt, pkt, JS110_STATUS_LENGTH);
+    u->fields = fields_ | FIELDS_INTERNAL;
+    js110_status_decode(pkt, u->fields, statistics);
+    statistics->serial_number = d->serial_number;
 
     // Adjust accumulated values.
     // Zero on first sample after program starts.
     // Continue accumulation following device reboot (disconnect / reconnect).
+    // Following a host restart, keep the restored offsets when the instrument
+    // kept running, which is when its samples_total advanced by the elapsed
+    // host time.  The totals then include the windows while the host was
+    // down.  Otherwise, continue from the restored accumulators.
+    int64_t samples_total_prev = d->samples_total_accum;
+    double charge_prev = d->charge_accum;
+    double energy_prev = d->energy_accum;
+    uint32_t flags = 0;
+    if (RESYNC_REOPENED == d->resync) {
+        // The instrument kept running unless samples_total advanced by
+        // less than this window.  After a reboot, continue with the
+        // samples since the boot.
+        if ((statistics->samples_total - d->samples_total_offset)
+                < (d->samples_total_accum + statistics->samples_this)) {
+            d->samples_total_offset = -d->samples_total_accum;
+            d->charge_offset = -d->charge_accum;
+            d->energy_offset = -d->energy_accum;
+            flags |= JS110_FLAG_RESYNC;
+        }
+        d->resync = RESYNC_NONE;
+    } else if (RESYNC_RESTORED == d->resync) {
+        int64_t elapsed_ms = js110_checkpoint_time_ms() - device_info_[dev_id].checkpoint_time_ms;
+        int64_t expected = d->samples_total_offset + d->samples_total_accum
+                + (elapsed_ms * statistics->samples_per_second) / 1000;
+        int64_t tolerance = (CHECKPOINT_TOLERANCE_MS * (int64_t) statistics->samples_per_second) / 1000;
+        int64_t error = statistics->samples_total - expected;
+        if ((elapsed_ms >= 0) && (error <= tolerance) && (error >= -tolerance)) {
+            d->resync = RESYNC_NONE;
+        } else {
+            d->resync = RESYNC_REQUIRED;
+            flags |= JS110_FLAG_RESYNC;
+        }
+    }
     if (d->resync) {
-        d->samples_total_offset = statistics.samples_total - d->samples_total_accum;
-        d->charge_offset = statistics.charge - d->charge_accum;
-        d->energy_offset = statistics.energy - d->energy_accum;
-        d->resync = 0;
-    }
-    statistics.samples_total -= d->samples_total_offset;
-    statistics.charge -= d->charge_offset;
-    statistics.energy -= d->energy_offset;
-    d->samples_total_accum = statistics.samples_total;
-    d->charge_accum = statistics.charge;
-    d->energy_accum = statistics.energy;
+        d->samples_total_offset = statistics->samples_total - d->samples_total_accum;
+        d->charge_offset = statistics->charge - d->charge_accum;
+        d->energy_offset = statistics->energy - d->energy_accum;
+        d->resync = RESYNC_NONE;
+    }
+    statistics->samples_total -= d->samples_total_offset;
+    statistics->charge -= d->charge_offset;
+    statistics->energy -= d->energy_offset;
+    d->samples_total_accum = statistics->samples_total;
+    d->charge_accum = statistics->charge;
+    d->energy_accum = statistics->energy;
 
-    if (cbk_fn_) {
-        cbk_fn_(cbk_user_data_, &statistics);
+    // Detect the windows that the instrument produced since the previous
+    // update, but that the library did not read.
+    int64_t samples_missed = statistics->samples_total - samples_total_prev - statistics->samples_this;
+    if (samples_missed > 0) {
+        statistics->samples_missed = samples_missed;
+        statistics->windows_missed = (uint32_t) ((samples_missed + statistics->samples_this / 2)
+                / statistics->samples_this);
+        flags |= JS110_FLAG_GAP;
+    }
+    statistics->flags = flags;
+    EnterCriticalSection(&lock_);
+    struct device_info_s * info = &device_info_[dev_id];
+    if (flags & JS110_FLAG_GAP) {
+        ++info->gap.gaps;
+        info->gap.windows_missed += statistics->windows_missed;
+        info->gap.samples_missed += statistics->samples_missed;
+    }
+    if (flags & JS110_FLAG_RESYNC) {
+        ++info->gap.resyncs;
+    }
+    if (!info->segments) {
+        info->segments = js110_segment_track_alloc(d->serial_number);
+    }
+    if (info->segments) {
+        if (js110_segment_track_active(info->segments)) {
+            update_decode(u, FIELDS_SEGMENT);
+        }
+        js110_segment_track_update(info->segments, statistics);
     }
+    LeaveCriticalSection(&lock_);
+    checkpoint_save(d);
+    sketch_update(d, statistics);
+    JS110_TRACE_END(t_decode, TRACE_DECODE, d->serial_number);
 
+    uint32_t windows_max = fill_windows_max_;
+    if (windows_max && (flags & JS110_FLAG_GAP) && (statistics->windows_missed <= windows_max)
+            && (samples_missed == (int64_t) statistics->windows_missed * statistics->samples_this)) {
+        gap_fill(dev_id, u, samples_total_prev, charge_prev, energy_prev);
+    }
+    statistics_deliver(dev_id, u);
     return 0;
 }
 
 static DWORD WINAPI js110_thread(LPVOID lpParam) {
     (void) lpParam;
     DEBUG_PRINTF("js110_thread start\n");
+    js110_trace_thread_name("js110 poll");
     device_change_ = 1;
     int rc = js110_device_change_notifier_initialize(on_device_change, 0);
     if (rc) {
         DEBUG_PRINTF("js110_device_change_notifier_initialize returned %d\n", rc);
     }
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER t_start;
+    LARGE_INTEGER t_poll;
+    LARGE_INTEGER t_end;
+    QueryPerformanceFrequency(&frequency);
     while (!thread_exit_) {
-        for (int i = 1; i < DEVICE_COUNT_MAX; ++i) {
-            if (devices_[i].state == ST_OPEN) {
-                js110_statistics(i);
+        uint32_t devices_open = 0;
+        uint32_t devices_quarantined = 0;
+        uint32_t retries = 0;
+        uint64_t degraded_ms = 0;
+        bool scan = false;
+        JS110_TRACE_BEGIN(t_cycle);
+        QueryPerformanceCounter(&t_start);
+        uint64_t now_ms = GetTickCount64();
+        for (uint32_t i = 1; i < device_count_; ++i) {
+            struct device_s * d = &devices_[i];
+            if (d->state == ST_OPEN) {
+                ++devices_open;
+                if (d->failures && (degraded_ms >= HEALTH_DEGRADED_BUDGET_MS)) {
+                    continue;  // bound the cycle duration, poll next cycle
+                }
+                rc = js110_statistics((int) i);
+                // Only the transfer counts, not the delivery and callback.
+                if (!rc && (transfer_ms_ >= HEALTH_TRANSFER_SLOW_MS)) {
+                    rc = 1;  // delivered, but too slow for the other devices
+                }
+                if (d->failures) {
+                    degraded_ms += transfer_ms_;
+                }
+                now_ms = GetTickCount64();
+                if (rc || d->failures) {
+                    device_health_update((int) i, rc, now_ms);
+                }
+            } else if (d->state == ST_QUARANTINED) {
+                ++devices_quarantined;
+                // Limit the retries to bound the cycle duration.
+                if ((now_ms >= d->retry_ms) && (retries < HEALTH_RETRIES_PER_CYCLE)) {
+                    ++retries;
+                    device_retry((int) i, now_ms);
+                }
             }
         }
+        QueryPerformanceCounter(&t_poll);
 
         if (device_change_) {
             DEBUG_PRINTF("js110_scan\n");
             device_change_ = 0;
+            scan = true;
             js110_scan();
         }
-        Sleep(100);
+        js110_checkpoint_flush();
+        QueryPerformanceCounter(&t_end);
+        JS110_TRACE_END(t_cycle, TRACE_CYCLE, 0);
+
+        uint64_t poll_us = ((t_poll.QuadPart - t_start.QuadPart) * 1000000) / frequency.QuadPart;
+        EnterCriticalSection(&lock_);
+        ++poll_status_.cycles;
+        poll_status_.devices_open = devices_open;
+        poll_status_.devices_quarantined = devices_quarantined;
+        poll_status_.cycle_duration_us_last = poll_us;
+        poll_status_.cycle_duration_us_total += poll_us;
+        if (poll_us > poll_status_.cycle_duration_us_max) {
+            poll_status_.cycle_duration_us_max = poll_us;
+        }
+        if (scan) {
+            ++poll_status_.scans;
+            poll_status_.scan_duration_us_total += ((t_end.QuadPart - t_poll.QuadPart) * 1000000) / frequency.QuadPart;
+        }
+        LeaveCriticalSection(&lock_);
+
+        // Wait for the next cycle.  Device changes, setting changes and
+        // js110_finalize() wake the thread immediately.
+        uint64_t cycle_ms = ((t_end.QuadPart - t_start.QuadPart) * 1000) / frequency.QuadPart;
+        uint32_t interval_ms = poll_interval_ms_;
+        DWORD wait_ms = (cycle_ms < interval_ms) ? (DWORD) (interval_ms - cycle_ms) : 0;
+        if (!thread_exit_) {
+            WaitForSingleObject(wake_event_, wait_ms);
+        }
     }
     js110_device_change_notifier_finalize();
+    js110_trace_thread_exit();
     DEBUG_PRINTF("js110_thread exit\n");
     return 0;
 }
@@ -450,9 +1245,29 @@ int js110_initialize(js110_statistics_cbk cbk_fn, void * cbk_user_data) {
         return 1;
     }
 
-    memset(devices_, 0, sizeof(devices_));
+    lock_initialize();
+    EnterCriticalSection(&lock_);
+    sketch_free_all();
+    device_table_free();
+    memset(&poll_status_, 0, sizeof(poll_status_));
+    LeaveCriticalSection(&lock_);
+    memset(&dispatch_status_, 0, sizeof(dispatch_status_));
+    backend_ = js110_backend_sim_active() ? &js110_backend_sim : &js110_backend_winusb;
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    health_rng_ = (uint32_t) counter.QuadPart | 1;  // never 0
+    thread_exit_ = false;
+    if (checkpoint_path_[0] && js110_checkpoint_open(checkpoint_path_, checkpoint_flush_interval_ms_)) {
+        DEBUG_PRINTF("js110_initialize could not open checkpoint\n");
+        return 1;
+    }
     cbk_user_data_ = cbk_user_data;
     cbk_fn_ = cbk_fn;
+    if (!slow_threshold_ms_ && dispatch_start()) {
+        js110_checkpoint_close();
+        cbk_fn_ = 0;
+        return 1;
+    }
     thread_ = CreateThread(
             NULL,                   // default security attributes
             0,                      // use default stack size
@@ -462,24 +1277,302 @@ int js110_initialize(js110_statistics_cbk cbk_fn, void * cbk_user_data) {
             &thread_id_);           // returns the thread identifier
     if (thread_ == NULL) {
         DEBUG_PRINTF("js110_initialize could not create thread\n");
+        dispatch_stop();
+        js110_checkpoint_close();
         cbk_fn_ = 0;
         return 1;
     }
-
+    EnterCriticalSection(&lock_);
+    running_ = true;
+    LeaveCriticalSection(&lock_);
     return 0;
 }
 
 int js110_finalize(void) {
     thread_exit_ = true;
+    poll_wake();
     if (thread_) {
-        if (WAIT_OBJECT_0 != WaitForSingleObject(thread_, 1000)) {
+        // The thread exits after the current polling cycle.  Join it
+        // before closing the devices that it polls.
+        if (WAIT_OBJECT_0 != WaitForSingleObject(thread_, INFINITE)) {
             DEBUG_PRINTF("thread - not closed cleanly.\n");
         }
         CloseHandle(thread_);
         thread_ = 0;
     }
+    dispatch_stop();  // delivers any pending updates
+    for (uint32_t i = 1; i < device_count_; ++i) {
+        device_close((int) i);
+    }
+    js110_checkpoint_close();
+    if (lock_initialized_) {
+        EnterCriticalSection(&lock_);
+        running_ = false;
+        WakeAllConditionVariable(&update_cv_);
+        LeaveCriticalSection(&lock_);
+    }
 
     cbk_fn_ = 0;
     cbk_user_data_ = 0;
     return 0;
 }
+
+int js110_checkpoint_set(const char * path, uint32_t flush_interval_ms) {
+    if (!path) {
+        checkpoint_path_[0] = 0;
+        return 0;
+    }
+    size_t sz = strlen(path);
+    if (!sz || (sz >= sizeof(checkpoint_path_))) {
+        return 1;
+    }
+    memcpy(checkpoint_path_, path, sz + 1);
+    checkpoint_flush_interval_ms_ = flush_interval_ms;
+    return 0;
+}
+
+int js110_coalesce_set(enum js110_coalesce_e mode, uint32_t slow_threshold_ms) {
+    switch (mode) {
+        case JS110_COALESCE_MERGE:  /* intentional fall-through */
+        case JS110_COALESCE_LATEST:
+            break;
+        default:
+            return 1;
+    }
+    coalesce_mode_ = mode;
+    slow_threshold_ms_ = slow_threshold_ms;
+    return 0;
+}
+
+int js110_fields_set(uint32_t fields) {
+    if (fields & ~JS110_FIELD_ALL) {
+        return 1;
+    }
+    fields_ = fields;
+    return 0;
+}
+
+int js110_statistics_decode(struct js110_statistics_s * statistics, uint32_t fields) {
+    struct update_s * u;
+    if (statistics == &update_.statistics) {
+        u = &update_;
+    } else if (statistics == &dispatch_update_.statistics) {
+        u = &dispatch_update_;
+    } else if (statistics == &fill_update_.statistics) {
+        u = &fill_update_;
+    } else {
+        return 1;  // not on loan to js110_statistics_cbk
+    }
+    update_decode(u, fields & JS110_FIELD_ALL);
+    return 0;
+}
+
+int js110_poll_interval_set(uint32_t interval_ms) {
+    if (!interval_ms) {
+        return 1;
+    }
+    poll_interval_ms_ = interval_ms;
+    poll_wake();  // apply now
+    return 0;
+}
+
+int js110_health_callback_set(js110_health_cbk cbk_fn, void * cbk_user_data) {
+    if (cbk_fn_) {
+        return 1;  // running
+    }
+    health_cbk_user_data_ = cbk_user_data;
+    health_cbk_fn_ = cbk_fn;
+    return 0;
+}
+
+int js110_gap_fill_set(uint32_t windows_max) {
+    fill_windows_max_ = windows_max;
+    return 0;
+}
+
+int js110_gap_get(uint32_t serial_number, struct js110_gap_s * gap) {
+    int rc = 1;
+    if (!gap || !lock_initialized_) {
+        return 1;
+    }
+    EnterCriticalSection(&lock_);
+    for (uint32_t i = 1; i < device_count_; ++i) {
+        if ((ST_EMPTY != devices_[i].state) && (devices_[i].serial_number == (int32_t) serial_number)) {
+            *gap = device_info_[i].gap;
+            rc = 0;
+            break;
+        }
+    }
+    LeaveCriticalSection(&lock_);
+    return rc;
+}
+
+int js110_segment_begin(uint32_t serial_number, uint32_t * handle) {
+    int rc = 1;
+    if (!handle || !lock_initialized_) {
+        return 1;
+    }
+    *handle = JS110_SEGMENT_HANDLE_INVALID;
+    EnterCriticalSection(&lock_);
+    for (uint32_t i = 1; i < device_count_; ++i) {
+        if ((ST_EMPTY != devices_[i].state) && (devices_[i].serial_number == (int32_t) serial_number)) {
+            rc = js110_segment_open(device_info_[i].segments, handle);
+            break;
+        }
+    }
+    LeaveCriticalSection(&lock_);
+    return rc;
+}
+
+int js110_segment_get(uint32_t handle, struct js110_segment_s * segment) {
+    if (!lock_initialized_) {
+        return 1;
+    }
+    EnterCriticalSection(&lock_);
+    int rc = js110_segment_result(handle, segment);
+    LeaveCriticalSection(&lock_);
+    return rc;
+}
+
+int js110_segment_end(uint32_t handle, struct js110_segment_s * segment) {
+    int rc = 0;
+    if (!lock_initialized_) {
+        return 1;
+    }
+    EnterCriticalSection(&lock_);
+    if (segment) {
+        rc = js110_segment_result(handle, segment);
+    }
+    if (!rc) {
+        rc = js110_segment_release(handle);
+    }
+    LeaveCriticalSection(&lock_);
+    return rc;
+}
+
+int js110_wait_for_update(uint32_t timeout_ms) {
+    int rc = 0;
+    if (!lock_initialized_) {
+        return 2;
+    }
+    ULONGLONG t_start = GetTickCount64();
+    EnterCriticalSection(&lock_);
+    uint64_t updates = dispatch_status_.updates_delivered;
+    ++update_waiters_;
+    while (1) {
+        if (!running_) {
+            rc = 2;
+            break;
+        } else if (updates != dispatch_status_.updates_delivered) {
+            rc = 0;
+            break;
+        }
+        DWORD wait_ms = INFINITE;
+        if (JS110_TIMEOUT_INFINITE != timeout_ms) {
+            ULONGLONG elapsed_ms = GetTickCount64() - t_start;
+            if (elapsed_ms >= timeout_ms) {
+                rc = 1;
+                break;
+            }
+            wait_ms = (DWORD) (timeout_ms - elapsed_ms);
+        }
+        SleepConditionVariableCS(&update_cv_, &lock_, wait_ms);
+    }
+    --update_waiters_;
+    LeaveCriticalSection(&lock_);
+    return rc;
+}
+
+int js110_dispatch_status(struct js110_dispatch_status_s * status) {
+    if (!status) {
+        return 1;
+    }
+    if (!lock_initialized_) {
+        memset(status, 0, sizeof(*status));
+        return 0;
+    }
+    EnterCriticalSection(&lock_);
+    *status = dispatch_status_;
+    LeaveCriticalSection(&lock_);
+    return 0;
+}
+
+int js110_poll_status(struct js110_poll_status_s * status) {
+    if (!status) {
+        return 1;
+    }
+    if (!lock_initialized_) {
+        memset(status, 0, sizeof(*status));
+        return 0;
+    }
+    EnterCriticalSection(&lock_);
+    *status = poll_status_;
+    LeaveCriticalSection(&lock_);
+    return 0;
+}
+
+int js110_sketch_get(uint32_t serial_number, enum js110_sketch_field_e field, struct js110_sketch_s * sketch) {
+    int rc = 1;
+    if (!sketch || (field < 0) || (field >= JS110_SKETCH_FIELD_COUNT) || !lock_initialized_) {
+        return 1;
+    }
+    EnterCriticalSection(&lock_);
+    for (uint32_t i = 1; i < device_count_; ++i) {
+        struct device_s * d = &devices_[i];
+        if ((ST_EMPTY != d->state) && (d->serial_number == (int32_t) serial_number)) {
+            if (d->sketch) {
+                *sketch = d->sketch[field];
+            } else {
+                js110_sketch_clear(sketch);
+            }
+            rc = 0;
+            break;
+        }
+    }
+    LeaveCriticalSection(&lock_);
+    return rc;
+}
+
+int js110_sketch_group_set(uint32_t serial_number, int32_t group) {
+    uint32_t i;
+    if ((group < -1) || (group >= JS110_SKETCH_GROUP_COUNT)) {
+        return 1;
+    }
+    lock_initialize();
+    EnterCriticalSection(&lock_);
+    for (i = 0; i < sketch_group_map_count_; ++i) {
+        if (sketch_group_map_[i].serial_number == serial_number) {
+            break;
+        }
+    }
+    if (i >= SKETCH_GROUP_MAP_SIZE) {
+        LeaveCriticalSection(&lock_);
+        return 1;
+    } else if (i == sketch_group_map_count_) {
+        ++sketch_group_map_count_;
+    }
+    sketch_group_map_[i].serial_number = serial_number;
+    sketch_group_map_[i].group = group;
+    for (uint32_t k = 1; k < device_count_; ++k) {
+        if (devices_[k].serial_number == (int32_t) serial_number) {
+            devices_[k].sketch_group = group;
+        }
+    }
+    LeaveCriticalSection(&lock_);
+    return 0;
+}
+
+int js110_sketch_group_get(int32_t group, enum js110_sketch_field_e field, struct js110_sketch_s * sketch) {
+    if (!sketch || (group < 0) || (group >= JS110_SKETCH_GROUP_COUNT)
+            || (field < 0) || (field >= JS110_SKETCH_FIELD_COUNT) || !lock_initialized_) {
+        return 1;
+    }
+    EnterCriticalSection(&lock_);
+    if (sketch_groups_[group]) {
+        *sketch = sketch_groups_[group][field];
+    } else {
+        js110_sketch_clear(sketch);
+    }
+    LeaveCriticalSection(&lock_);
+    return 0;
+}
@@ -15,46 +15,186 @@
  */
 
 #include "js110_statistics.h"
+#include "js110_forward.h"
+#include "js110_trace.h"
+#include "stats_writer.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <signal.h>
 #include <windows.h>
 
-static volatile int quit_ = 0;
+static HANDLE quit_event_ = NULL;
+static struct js110_forward_config_s forward_config_;
+static const char * trace_path_ = NULL;
+
+static const char USAGE[] =
+    "usage: js110_stats [options]\n"
+    "\n"
+    "Write statistics from all connected Joulescope instruments.\n"
+    "\n"
+    "options:\n"
+    "  --format FMT          The output format: csv (default), jsonl or bin.\n"
+    "  --output PATH         The output file path.  Default is stdout.\n"
+    "  --rotate-bytes N      Start a new output file after N bytes.\n"
+    "  --rotate-seconds N    Start a new output file after N seconds.\n"
+    "  --fields LIST         Comma-separated fields to write, such as\n"
+    "                        serial_number,samples_total,current_mean,charge\n"
+    "                        Default is all fields.\n"
+    "  --report-seconds N    Report records/second to stderr every N seconds.\n"
+    "                        0 disables.  Default is 10.\n"
+    "  --forward URL         Also forward to a collector at tcp://host:port\n"
+    "                        or udp://host:port.\n"
+    "  --spool PATH          The forwarder spool file.  Default is memory.\n"
+    "  --trace PATH          Record the library threads and write a Chrome\n"
+    "                        trace-event JSON file on exit.\n"
+    "  --help                Display this help and exit.\n";
 
 void sigint_handler(int event) {
     (void) event;
-    quit_ = 1;
+    SetEvent(quit_event_);  // Windows runs the handler on its own thread
+}
+
+void on_health(void * user_data, uint32_t serial_number, enum js110_health_e health, uint32_t retry_ms) {
+    // CAUTION: called from JS110 thread.
+    (void) user_data;
+    switch (health) {
+        case JS110_HEALTH_OK:
+            fprintf(stderr, "device %u: ok\n", serial_number);
+            break;
+        case JS110_HEALTH_DEGRADED:
+            fprintf(stderr, "device %u: degraded\n", serial_number);
+            break;
+        case JS110_HEALTH_QUARANTINED:
+            fprintf(stderr, "device %u: quarantined, retry in %u ms\n", serial_number, retry_ms);
+            break;
+        default:
+            break;
+    }
 }
 
 void on_statistics(void * user_data, struct js110_statistics_s * statistics) {
     // CAUTION: called from JS110 thread.
     (void) user_data;
-    printf("> %u: %llu samples, %f A, %f V, %f, W, %f C, %f J\n",
-           statistics->serial_number,
-           statistics->samples_total,
-           statistics->current_mean,
-           statistics->voltage_mean,
-           statistics->power_mean,
-           statistics->charge,
-           statistics->energy);
+    stats_writer_push(statistics);
+    js110_forward_push(statistics);
+}
+
+static int arg_u64(int argc, char * argv[], int * idx, uint64_t * value) {
+    char * end = NULL;
+    if ((*idx + 1) >= argc) {
+        fprintf(stderr, "%s requires a value\n", argv[*idx]);
+        return 1;
+    }
+    ++*idx;
+    *value = strtoull(argv[*idx], &end, 0);
+    if (!end || *end) {
+        fprintf(stderr, "invalid value: %s\n", argv[*idx]);
+        return 1;
+    }
+    return 0;
+}
+
+static int args_parse(int argc, char * argv[], struct stats_writer_config_s * config) {
+    uint64_t value = 0;
+    memset(config, 0, sizeof(*config));
+    config->format = STATS_WRITER_CSV;
+    config->fields = STATS_WRITER_FIELDS_ALL;
+    config->report_seconds = 10;
+    for (int i = 1; i < argc; ++i) {
+        const char * arg = argv[i];
+        if (0 == strcmp(arg, "--help")) {
+            printf("%s", USAGE);
+            exit(0);
+        } else if ((0 == strcmp(arg, "--format")) && ((i + 1) < argc)) {
+            if (stats_writer_format_parse(argv[++i], &config->format)) {
+                fprintf(stderr, "invalid format: %s\n", argv[i]);
+                return 1;
+            }
+        } else if ((0 == strcmp(arg, "--output")) && ((i + 1) < argc)) {
+            config->path = argv[++i];
+        } else if ((0 == strcmp(arg, "--forward")) && ((i + 1) < argc)) {
+            forward_config_.url = argv[++i];
+        } else if ((0 == strcmp(arg, "--spool")) && ((i + 1) < argc)) {
+            forward_config_.spool_path = argv[++i];
+        } else if ((0 == strcmp(arg, "--trace")) && ((i + 1) < argc)) {
+            trace_path_ = argv[++i];
+        } else if ((0 == strcmp(arg, "--fields")) && ((i + 1) < argc)) {
+            if (stats_writer_fields_parse(argv[++i], &config->fields)) {
+                return 1;
+            }
+        } else if (0 == strcmp(arg, "--rotate-bytes")) {
+            if (arg_u64(argc, argv, &i, &value)) {
+                return 1;
+            }
+            config->rotate_bytes = value;
+        } else if (0 == strcmp(arg, "--rotate-seconds")) {
+            if (arg_u64(argc, argv, &i, &value)) {
+                return 1;
+            }
+            config->rotate_seconds = (uint32_t) value;
+        } else if (0 == strcmp(arg, "--report-seconds")) {
+            if (arg_u64(argc, argv, &i, &value)) {
+                return 1;
+            }
+            config->report_seconds = (uint32_t) value;
+        } else {
+            fprintf(stderr, "invalid argument: %s\n\n%s", arg, USAGE);
+            return 1;
+        }
+    }
+    if ((config->rotate_bytes || config->rotate_seconds) && !config->path) {
+        fprintf(stderr, "file rotation requires --output\n");
+        return 1;
+    }
+    return 0;
 }
 
 int main(int argc, char * argv[]) {
-    (void) argc;
-    (void) argv;
     int rc;
+    struct stats_writer_config_s config;
+    if (args_parse(argc, argv, &config)) {
+        return 1;
+    }
+    quit_event_ = CreateEvent(NULL, TRUE, FALSE, NULL);  // manual reset, unsignalled
+    if (!quit_event_) {
+        return 1;
+    }
+    if (stats_writer_start(&config)) {
+        fprintf(stderr, "stats_writer_start failed\n");
+        return 1;
+    }
+    if (forward_config_.url && js110_forward_start(&forward_config_)) {
+        fprintf(stderr, "invalid forward URL: %s\n", forward_config_.url);
+        stats_writer_stop();
+        return 1;
+    }
+    // The writer uses the same field bits as the library, and the
+    // forwarder sends all fields.
+    js110_fields_set(forward_config_.url ? JS110_FIELD_ALL : config.fields);
+    js110_health_callback_set(on_health, NULL);
+    if (trace_path_) {
+        js110_trace_start(0);
+    }
     rc = js110_initialize(on_statistics, 0);
     if (rc) {
-        printf("js110_initialize failed with %d\n", rc);
+        fprintf(stderr, "js110_initialize failed with %d\n", rc);
+        js110_forward_stop();
+        stats_writer_stop();
         return 1;
     }
-    printf("Print statistics from all connected Joulescope instruments.\n");
+    fprintf(stderr, "Write statistics from all connected Joulescope instruments.\n");
     signal(SIGINT, sigint_handler);
-    printf("Press CTRL-C to exit\n");
-    while (!quit_) {
-        Sleep(10);
-    }
+    fprintf(stderr, "Press CTRL-C to exit\n");
+    WaitForSingleObject(quit_event_, INFINITE);
 
     js110_finalize();
-    return 0;
+    if (trace_path_) {
+        js110_trace_stop();
+        if (js110_trace_write(trace_path_)) {
+            fprintf(stderr, "could not write trace: %s\n", trace_path_);
+        }
+    }
+    js110_forward_stop();
+    return stats_writer_stop();
 }
@@ -0,0 +1,359 @@
+/*
+ * Copyright 2020 Jetperch LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "segment.h"
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A handle is the pool index in the low bits and the generation in the
+// high bits.  Index 0 is reserved, so handle 0 is never valid.
+#define HANDLE_INDEX_BITS (20)
+#define HANDLE_INDEX_MASK ((1U << HANDLE_INDEX_BITS) - 1)
+#define HANDLE_GENERATION_MASK ((1U << (32 - HANDLE_INDEX_BITS)) - 1)
+#define POOL_CAPACITY_MIN (64)
+#define DEQUE_CAPACITY_MIN (16)  // power of 2
+#define NIL (0U)
+
+/**
+ * @brief The extremum fields, which have the same name in
+ *      struct js110_statistics_s and struct js110_segment_s.
+ */
+struct extremum_s {
+    size_t statistics_offset;
+    size_t segment_offset;
+    bool max;
+};
+
+#define EXTREMUM(name_, max_) \
+    {offsetof(struct js110_statistics_s, name_), offsetof(struct js110_segment_s, name_), max_}
+static const struct extremum_s extrema_[] = {
+    EXTREMUM(current_min, false),
+    EXTREMUM(current_max, true),
+    EXTREMUM(voltage_min, false),
+    EXTREMUM(voltage_max, true),
+    EXTREMUM(power_min, false),
+    EXTREMUM(power_max, true),
+};
+#define EXTREMUM_COUNT (sizeof(extrema_) / sizeof(extrema_[0]))
+
+struct deque_entry_s {
+    int64_t window;
+    double value;
+};
+
+/// A ring buffer of windows with monotonic values, see segment.h.
+struct deque_s {
+    struct deque_entry_s * entries;
+    uint32_t capacity;  // power of 2
+    uint32_t head;      // the index of the front entry
+    uint32_t count;
+};
+
+/// The totals that a segment latches.
+struct mark_s {
+    int64_t window;  // the number of windows read
+    int64_t samples_total;
+    double charge;
+    double energy;
+    int64_t samples_missed;
+    uint64_t gaps;
+    uint64_t resyncs;
+};
+
+struct js110_segment_track_s {
+    uint32_t serial_number;
+    int32_t samples_per_second;
+    struct mark_s totals;  // the totals of the latest update
+    // The open segments in mark order, as pool indices.
+    uint32_t oldest;
+    uint32_t newest;
+    struct deque_s deques[EXTREMUM_COUNT];
+};
+
+/// A segment pool entry.
+struct entry_s {
+    uint32_t generation;
+    uint32_t prev;  // the previous open segment of the track
+    uint32_t next;  // the next open segment of the track, or the next free entry
+    struct js110_segment_track_s * track;  // NULL when free
+    struct mark_s mark;
+};
+
+static struct entry_s * pool_ = NULL;
+static uint32_t pool_count_ = 0;  // the used indices, including 0
+static uint32_t pool_capacity_ = 0;
+static uint32_t pool_free_ = NIL;  // the free list head
+static uint32_t pool_epoch_ = 0;  // the initial generation, so handles from a freed pool stay invalid
+
+
+static inline struct deque_entry_s * deque_at(struct deque_s * self, uint32_t idx) {
+    return &self->entries[(self->head + idx) & (self->capacity - 1)];
+}
+
+static int deque_grow(struct deque_s * self) {
+    uint32_t capacity = self->capacity ? (self->capacity * 2) : DEQUE_CAPACITY_MIN;
+    struct deque_entry_s * entries = malloc(capacity * sizeof(struct deque_entry_s));
+    if (!entries) {
+        return 1;
+    }
+    for (uint32_t i = 0; i < self->count; ++i) {
+        entries[i] = *deque_at(self, i);
+    }
+    free(self->entries);
+    self->entries = entries;
+    self->capacity = capacity;
+    self->head = 0;
+    return 0;
+}
+
+static void deque_push(struct deque_s * self, int64_t window, double value, bool max) {
+    if (isnan(value)) {
+        return;
+    }
+    // Pop the entries that the new value supersedes.
+    while (self->count) {
+        double back = deque_at(self, self->count - 1)->value;
+        if (max ? (back > value) : (back < value)) {
+            break;
+        }
+        --self->count;
+    }
+    if ((self->count >= self->capacity) && deque_grow(self)) {
+        return;  // out of memory, skip this window
+    }
+    struct deque_entry_s * entry = deque_at(self, self->count++);
+    entry->window = window;
+    entry->value = value;
+}
+
+/// Pop the front entries up to and including window.
+static void deque_prune(struct deque_s * self, int64_t window) {
+    while (self->count && (deque_at(self, 0)->window <= window)) {
+        self->head = (self->head + 1) & (self->capacity - 1);
+        --self->count;
+    }
+}
+
+/// Get the extremum over the windows after window, or NaN if none.
+static double deque_query(struct deque_s * self, int64_t window) {
+    uint32_t lo = 0;
+    uint32_t hi = self->count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (deque_at(self, mid)->window <= window) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return (lo < self->count) ? deque_at(self, lo)->value : NAN;
+}
+
+struct js110_segment_track_s * js110_segment_track_alloc(uint32_t serial_number) {
+    struct js110_segment_track_s * self = calloc(1, sizeof(struct js110_segment_track_s));
+    if (self) {
+        self->serial_number = serial_number;
+    }
+    return self;
+}
+
+void js110_segment_track_free(struct js110_segment_track_s * self) {
+    if (!self) {
+        return;
+    }
+    for (uint32_t i = 0; i < EXTREMUM_COUNT; ++i) {
+        free(self->deques[i].entries);
+    }
+    free(self);
+}
+
+bool js110_segment_track_active(const struct js110_segment_track_s * self) {
+    return self && (NIL != self->oldest);
+}
+
+void js110_segment_track_update(struct js110_segment_track_s * self, const struct js110_statistics_s * statistics) {
+    struct mark_s * t = &self->totals;
+    ++t->window;
+    t->samples_total = statistics->samples_total;
+    t->charge = statistics->charge;
+    t->energy = statistics->energy;
+    if (statistics->flags & JS110_FLAG_GAP) {
+        t->samples_missed += statistics->samples_missed;
+        ++t->gaps;
+    }
+    if (statistics->flags & JS110_FLAG_RESYNC) {
+        ++t->resyncs;
+    }
+    self->samples_per_second = statistics->samples_per_second;
+    if (NIL == self->oldest) {
+        return;  // no open segments
+    }
+    for (uint32_t i = 0; i < EXTREMUM_COUNT; ++i) {
+        const struct extremum_s * x = &extrema_[i];
+        double value = *((const double *) (((const uint8_t *) statistics) + x->statistics_offset));
+        deque_push(&self->deques[i], t->window, value, x->max);
+    }
+}
+
+static int pool_grow(void) {
+    uint32_t capacity = pool_capacity_ ? (pool_capacity_ * 2) : POOL_CAPACITY_MIN;
+    if (pool_capacity_ > HANDLE_INDEX_MASK) {
+        return 1;
+    }
+    struct entry_s * pool = realloc(pool_, capacity * sizeof(struct entry_s));
+    if (!pool) {
+        return 1;
+    }
+    memset(pool + pool_capacity_, 0, (capacity - pool_capacity_) * sizeof(struct entry_s));
+    for (uint32_t i = pool_capacity_; i < capacity; ++i) {
+        pool[i].generation = pool_epoch_;
+    }
+    pool_ = pool;
+    pool_capacity_ = capacity;
+    if (!pool_count_) {
+        pool_count_ = 1;  // reserve 0 for invalid
+    }
+    return 0;
+}
+
+static struct entry_s * entry_get(uint32_t handle) {
+    uint32_t idx = handle & HANDLE_INDEX_MASK;
+    if ((NIL == idx) || (idx >= pool_count_)) {
+        return NULL;
+    }
+    struct entry_s * e = &pool_[idx];
+    if (!e->track || (e->generation != (handle >> HANDLE_INDEX_BITS))) {
+        return NULL;
+    }
+    return e;
+}
+
+int js110_segment_open(struct js110_segment_track_s * track, uint32_t * handle) {
+    uint32_t idx;
+    if (!track || !handle) {
+        return 1;
+    }
+    if (NIL != pool_free_) {
+        idx = pool_free_;
+        pool_free_ = pool_[idx].next;
+    } else if ((pool_count_ < pool_capacity_) || (0 == pool_grow())) {
+        idx = pool_count_++;
+    } else {
+        return 1;
+    }
+    if (idx > HANDLE_INDEX_MASK) {
+        --pool_count_;
+        return 1;
+    }
+    struct entry_s * e = &pool_[idx];
+    e->generation = (e->generation + 1) & HANDLE_GENERATION_MASK;
+    if (!e->generation) {
+        e->generation = 1;
+    }
+    e->track = track;
+    e->mark = track->totals;
+
+    // Append, which keeps the open segments in mark order.
+    e->prev = track->newest;
+    e->next = NIL;
+    if (NIL != track->newest) {
+        pool_[track->newest].next = idx;
+    } else {
+        track->oldest = idx;
+    }
+    track->newest = idx;
+    *handle = (e->generation << HANDLE_INDEX_BITS) | idx;
+    return 0;
+}
+
+int js110_segment_result(uint32_t handle, struct js110_segment_s * segment) {
+    struct entry_s * e = entry_get(handle);
+    if (!e || !segment) {
+        return 1;
+    }
+    struct js110_segment_track_s * track = e->track;
+    const struct mark_s * m = &e->mark;
+    const struct mark_s * t = &track->totals;
+    memset(segment, 0, sizeof(*segment));
+    segment->serial_number = track->serial_number;
+    segment->windows = (uint32_t) (t->window - m->window);
+    segment->samples_per_second = track->samples_per_second;
+    segment->samples = t->samples_total - m->samples_total;
+    segment->samples_missed = t->samples_missed - m->samples_missed;
+    if (t->gaps != m->gaps) {
+        segment->flags |= JS110_FLAG_GAP;
+    }
+    if (t->resyncs != m->resyncs) {
+        segment->flags |= JS110_FLAG_RESYNC;
+    }
+    if (segment->samples_per_second) {
+        segment->duration = (double) segment->samples / segment->samples_per_second;
+    }
+    segment->charge = t->charge - m->charge;
+    segment->energy = t->energy - m->energy;
+    for (uint32_t i = 0; i < EXTREMUM_COUNT; ++i) {
+        double * value = (double *) (((uint8_t *) segment) + extrema_[i].segment_offset);
+        *value = deque_query(&track->deques[i], m->window);
+    }
+    return 0;
+}
+
+int js110_segment_release(uint32_t handle) {
+    struct entry_s * e = entry_get(handle);
+    if (!e) {
+        return 1;
+    }
+    uint32_t idx = handle & HANDLE_INDEX_MASK;
+    struct js110_segment_track_s * track = e->track;
+    bool oldest = (NIL == e->prev);
+    if (NIL != e->prev) {
+        pool_[e->prev].next = e->next;
+    } else {
+        track->oldest = e->next;
+    }
+    if (NIL != e->next) {
+        pool_[e->next].prev = e->prev;
+    } else {
+        track->newest = e->prev;
+    }
+    e->track = NULL;
+    e->prev = NIL;
+    e->next = pool_free_;
+    pool_free_ = idx;
+
+    // Drop the windows that no open segment needs.
+    for (uint32_t i = 0; oldest && (i < EXTREMUM_COUNT); ++i) {
+        struct deque_s * q = &track->deques[i];
+        if (NIL == track->oldest) {
+            q->head = 0;
+            q->count = 0;
+        } else {
+            deque_prune(q, pool_[track->oldest].mark.window);
+        }
+    }
+    return 0;
+}
+
+void js110_segment_pool_free(void) {
+    free(pool_);
+    pool_ = NULL;
+    pool_count_ = 0;
+    pool_capacity_ = 0;
+    pool_free_ = NIL;
+    pool_epoch_ = (pool_epoch_ + 1) & HANDLE_GENERATION_MASK;
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright 2020 Jetperch LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief The segment tracking for js110_segment.h.
+ *
+ * Each device has a track that holds its latest totals.  A segment
+ * latches the track totals into a mark, and the segment statistics are
+ * the difference to the current totals.
+ *
+ * The minimum and maximum over a segment are the extrema over the
+ * windows since its mark, which is a suffix of the window sequence.
+ * While segments are open, the track keeps a monotonic deque for each
+ * extremum.  The minimum deque holds the windows whose value is smaller
+ * than all later values, so its values increase from front to back.
+ * Each update pops the back entries that the new value supersedes and
+ * pushes the new value, which is amortized constant time.  The minimum
+ * since a mark is the first entry after the mark, found by binary
+ * search.  Entries before the oldest open mark are never used again and
+ * pop off the front.
+ *
+ * Segment handles index a pool of marks.  Each pool entry has a
+ * generation count, which the handle includes, so stale handles fail.
+ *
+ * The caller must serialize all calls.
+ */
+
+#ifndef JS110_SEGMENT_INTERNAL_H__
+#define JS110_SEGMENT_INTERNAL_H__
+
+#include "js110_segment.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/// The segment tracking state for a single device.
+struct js110_segment_track_s;
+
+/**
+ * @brief Allocate a track.
+ *
+ * @param serial_number The device serial number.
+ * @return The track or NULL when out of memory.
+ */
+struct js110_segment_track_s * js110_segment_track_alloc(uint32_t serial_number);
+
+/**
+ * @brief Free a track.
+ *
+ * @param self The track.  Call js110_segment_pool_free() first.
+ */
+void js110_segment_track_free(struct js110_segment_track_s * self);
+
+/**
+ * @brief Check if a track has open segments.
+ *
+ * @param self The track.
+ * @return true when the track needs the minimum and maximum fields.
+ */
+bool js110_segment_track_active(const struct js110_segment_track_s * self);
+
+/**
+ * @brief Add an update to a track.
+ *
+ * @param self The track.
+ * @param statistics The update with the adjusted totals.  When
+ *      js110_segment_track_active(), the update must include the
+ *      minimum and maximum fields.
+ */
+void js110_segment_track_update(struct js110_segment_track_s * self, const struct js110_statistics_s * statistics);
+
+/**
+ * @brief Begin a segment at the current track totals.
+ *
+ * @param track The track.
+ * @param[out] handle The segment handle.
+ * @return 0 or error code.
+ */
+int js110_segment_open(struct js110_segment_track_s * track, uint32_t * handle);
+
+/**
+ * @brief Compute the statistics of a segment.
+ *
+ * @param handle The segment handle.
+ * @param[out] segment The segment statistics.
+ * @return 0 or error code.
+ */
+int js110_segment_result(uint32_t handle, struct js110_segment_s * segment);
+
+/**
+ * @brief End a segment.
+ *
+ * @param handle The segment handle.
+ * @return 0 or error code.
+ */
+int js110_segment_release(uint32_t handle);
+
+/**
+ * @brief End all segments and free the pool.
+ */
+void js110_segment_pool_free(void);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif  /* JS110_SEGMENT_INTERNAL_H__ */
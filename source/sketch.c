@@ -0,0 +1,256 @@
+/*
+ * Copyright 2020 Jetperch LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "js110_sketch.h"
+#include <math.h>
+#include <string.h>
+
+
+/*
+ * Serialized format, all values little-endian
+ *
+ *   0: "JSKT" magic
+ *   4: u16 format version (1)
+ *   6: u16 bins (JS110_SKETCH_BINS)
+ *   8: u32 entry count
+ *  12: u32 reserved (0)
+ *  16: u64 count
+ *  24: u64 zero_count
+ *  32: f64 min
+ *  40: f64 max
+ *  48: entries, each u16 bin index (bit 15 set for negative) + u64 count
+ */
+
+#define MAGIC "JSKT"
+#define VERSION (1)
+#define HEADER_SIZE (48)
+#define ENTRY_SIZE (10)
+#define NEGATIVE_FLAG (0x8000U)
+
+// gamma = (1 + JS110_SKETCH_RELATIVE_ACCURACY) / (1 - JS110_SKETCH_RELATIVE_ACCURACY)
+static const double GAMMA = 1.0408163265306123;
+static const double LOG_GAMMA_INV = 24.996666311036567;  // 1 / ln(gamma)
+// ceil(ln(JS110_SKETCH_VALUE_MIN) / ln(gamma))
+static const int32_t INDEX_OFFSET = -690;
+
+
+static inline int32_t bin_index(double magnitude) {
+    int32_t k = (int32_t) ceil(log(magnitude) * LOG_GAMMA_INV) - INDEX_OFFSET;
+    if (k < 0) {
+        return 0;
+    } else if (k >= JS110_SKETCH_BINS) {
+        return JS110_SKETCH_BINS - 1;
+    }
+    return k;
+}
+
+static inline double bin_value(int32_t index) {
+    return 2.0 * pow(GAMMA, index + INDEX_OFFSET) / (GAMMA + 1.0);
+}
+
+static inline void u16_encode(uint8_t * p, uint16_t v) {
+    p[0] = (uint8_t) v;
+    p[1] = (uint8_t) (v >> 8);
+}
+
+static inline void u32_encode(uint8_t * p, uint32_t v) {
+    u16_encode(p, (uint16_t) v);
+    u16_encode(p + 2, (uint16_t) (v >> 16));
+}
+
+static inline void u64_encode(uint8_t * p, uint64_t v) {
+    u32_encode(p, (uint32_t) v);
+    u32_encode(p + 4, (uint32_t) (v >> 32));
+}
+
+static inline void f64_encode(uint8_t * p, double v) {
+    uint64_t u;
+    memcpy(&u, &v, sizeof(u));
+    u64_encode(p, u);
+}
+
+static inline uint16_t u16_decode(const uint8_t * p) {
+    return (uint16_t) (p[0] | (((uint16_t) p[1]) << 8));
+}
+
+static inline uint32_t u32_decode(const uint8_t * p) {
+    return ((uint32_t) u16_decode(p)) | (((uint32_t) u16_decode(p + 2)) << 16);
+}
+
+static inline uint64_t u64_decode(const uint8_t * p) {
+    return ((uint64_t) u32_decode(p)) | (((uint64_t) u32_decode(p + 4)) << 32);
+}
+
+static inline double f64_decode(const uint8_t * p) {
+    uint64_t u = u64_decode(p);
+    double v;
+    memcpy(&v, &u, sizeof(v));
+    return v;
+}
+
+void js110_sketch_clear(struct js110_sketch_s * self) {
+    memset(self, 0, sizeof(*self));
+    self->min = INFINITY;
+    self->max = -INFINITY;
+}
+
+void js110_sketch_add(struct js110_sketch_s * self, double value) {
+    if (isnan(value)) {
+        return;
+    }
+    ++self->count;
+    if (value < self->min) {
+        self->min = value;
+    }
+    if (value > self->max) {
+        self->max = value;
+    }
+    if (value >= JS110_SKETCH_VALUE_MIN) {
+        ++self->positive[bin_index(value)];
+    } else if (value <= -JS110_SKETCH_VALUE_MIN) {
+        ++self->negative[bin_index(-value)];
+    } else {
+        ++self->zero_count;
+    }
+}
+
+void js110_sketch_merge(struct js110_sketch_s * self, const struct js110_sketch_s * other) {
+    if (!other->count) {
+        return;
+    }
+    self->count += other->count;
+    self->zero_count += other->zero_count;
+    if (other->min < self->min) {
+        self->min = other->min;
+    }
+    if (other->max > self->max) {
+        self->max = other->max;
+    }
+    for (int32_t i = 0; i < JS110_SKETCH_BINS; ++i) {
+        self->positive[i] += other->positive[i];
+        self->negative[i] += other->negative[i];
+    }
+}
+
+double js110_sketch_quantile(const struct js110_sketch_s * self, double q) {
+    double v;
+    if (!self->count) {
+        return NAN;
+    } else if (q <= 0.0) {
+        return self->min;
+    } else if (q >= 1.0) {
+        return self->max;
+    }
+    uint64_t rank = (uint64_t) (q * (double) (self->count - 1));
+    uint64_t n = 0;
+    for (int32_t i = JS110_SKETCH_BINS - 1; i >= 0; --i) {
+        n += self->negative[i];
+        if (n > rank) {
+            v = -bin_value(i);
+            goto found;
+        }
+    }
+    n += self->zero_count;
+    if (n > rank) {
+        v = 0.0;
+        goto found;
+    }
+    for (int32_t i = 0; i < JS110_SKETCH_BINS; ++i) {
+        n += self->positive[i];
+        if (n > rank) {
+            v = bin_value(i);
+            goto found;
+        }
+    }
+    v = self->max;
+
+found:
+    if (v < self->min) {
+        v = self->min;
+    } else if (v > self->max) {
+        v = self->max;
+    }
+    return v;
+}
+
+int js110_sketch_serialize(const struct js110_sketch_s * self, uint8_t * buffer, uint32_t size, uint32_t * length) {
+    uint32_t entries = 0;
+    if (!self || !buffer || (size < HEADER_SIZE)) {
+        return 1;
+    }
+    uint8_t * p = buffer + HEADER_SIZE;
+    for (int sign = 0; sign < 2; ++sign) {
+        const uint64_t * bins = sign ? self->negative : self->positive;
+        for (uint32_t i = 0; i < JS110_SKETCH_BINS; ++i) {
+            if (!bins[i]) {
+                continue;
+            }
+            if ((uint32_t) (p - buffer + ENTRY_SIZE) > size) {
+                return 1;
+            }
+            u16_encode(p, (uint16_t) (i | (sign ? NEGATIVE_FLAG : 0)));
+            u64_encode(p + 2, bins[i]);
+            p += ENTRY_SIZE;
+            ++entries;
+        }
+    }
+    memcpy(buffer, MAGIC, 4);
+    u16_encode(buffer + 4, VERSION);
+    u16_encode(buffer + 6, JS110_SKETCH_BINS);
+    u32_encode(buffer + 8, entries);
+    u32_encode(buffer + 12, 0);
+    u64_encode(buffer + 16, self->count);
+    u64_encode(buffer + 24, self->zero_count);
+    f64_encode(buffer + 32, self->min);
+    f64_encode(buffer + 40, self->max);
+    if (length) {
+        *length = (uint32_t) (p - buffer);
+    }
+    return 0;
+}
+
+int js110_sketch_deserialize(struct js110_sketch_s * self, const uint8_t * buffer, uint32_t length) {
+    if (!self || !buffer || (length < HEADER_SIZE)) {
+        return 1;
+    }
+    if (memcmp(buffer, MAGIC, 4) || (VERSION != u16_decode(buffer + 4))
+            || (JS110_SKETCH_BINS != u16_decode(buffer + 6))) {
+        return 1;
+    }
+    uint32_t entries = u32_decode(buffer + 8);
+    if (((uint64_t) entries * ENTRY_SIZE) > (length - HEADER_SIZE)) {
+        return 1;
+    }
+    js110_sketch_clear(self);
+    self->count = u64_decode(buffer + 16);
+    self->zero_count = u64_decode(buffer + 24);
+    self->min = f64_decode(buffer + 32);
+    self->max = f64_decode(buffer + 40);
+    const uint8_t * p = buffer + HEADER_SIZE;
+    for (uint32_t k = 0; k < entries; ++k, p += ENTRY_SIZE) {
+        uint16_t idx = u16_decode(p);
+        uint16_t i = idx & ~NEGATIVE_FLAG;
+        if (i >= JS110_SKETCH_BINS) {
+            return 1;
+        }
+        if (idx & NEGATIVE_FLAG) {
+            self->negative[i] += u64_decode(p + 2);
+        } else {
+            self->positive[i] += u64_decode(p + 2);
+        }
+    }
+    return 0;
+}
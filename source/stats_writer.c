@@ -0,0 +1,598 @@
+/*
+ * Copyright 2020 Jetperch LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "stats_writer.h"
+#include <Windows.h>
+#include <fcntl.h>
+#include <io.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+
+/*
+ * Binary format
+ *
+ * Each file starts with a 16-byte header:
+ *   0: "JS110BIN" magic
+ *   8: u32 format version (1)
+ *  12: u32 field mask
+ *
+ * Each record then contains the selected fields in the order of
+ * struct js110_statistics_s.  All values are little-endian.  The
+ * 32-bit integer fields occupy 4 bytes and all other fields
+ * (int64_t, double) occupy 8 bytes.
+ */
+
+// #define DEBUG_PRINTF(...) fprintf(stderr, __VA_ARGS__)
+#define DEBUG_PRINTF(...)
+#define QUEUE_SIZE (1U << 16)           // power of 2
+#define OUT_BUFFER_SIZE (1U << 20)
+#define FLUSH_BYTES (1U << 18)          // write once this much output is pending
+#define WAKE_RECORDS (QUEUE_SIZE / 4)   // wake the writer before its timeout
+#define RECORD_SIZE_MAX (1024U)         // formatted record upper bound
+#define PATH_SIZE_MAX (1024U)
+static const DWORD WRITER_TIMEOUT_MS = 100;  // the maximum output delay
+static const uint32_t BINARY_VERSION = 1;
+
+enum field_type_e {
+    FT_U32,
+    FT_I32,
+    FT_I64,
+    FT_F64,
+};
+
+struct field_s {
+    const char * name;
+    enum field_type_e type;
+    size_t offset;
+};
+
+#define FIELD(name_, type_) {#name_, type_, offsetof(struct js110_statistics_s, name_)}
+static const struct field_s fields_[] = {
+    FIELD(serial_number, FT_U32),
+    FIELD(samples_this, FT_I32),
+    FIELD(samples_per_update, FT_I32),
+    FIELD(samples_per_second, FT_I32),
+    FIELD(samples_total, FT_I64),
+    FIELD(charge, FT_F64),
+    FIELD(energy, FT_F64),
+    FIELD(current_mean, FT_F64),
+    FIELD(current_min, FT_F64),
+    FIELD(current_max, FT_F64),
+    FIELD(voltage_mean, FT_F64),
+    FIELD(voltage_min, FT_F64),
+    FIELD(voltage_max, FT_F64),
+    FIELD(power_mean, FT_F64),
+    FIELD(power_min, FT_F64),
+    FIELD(power_max, FT_F64),
+    FIELD(samples_missed, FT_I64),
+    FIELD(windows_missed, FT_U32),
+    FIELD(flags, FT_U32),
+};
+#define FIELD_COUNT (sizeof(fields_) / sizeof(fields_[0]))
+
+static struct stats_writer_config_s config_;
+static CRITICAL_SECTION lock_;
+static CONDITION_VARIABLE cv_;
+static HANDLE thread_;
+static volatile bool thread_exit_ = false;
+
+// The queue, protected by lock_.  The writer thread owns the
+// entries from queue_tail_ up to queue_head_ without holding the lock.
+static struct js110_statistics_s queue_[QUEUE_SIZE];
+static uint32_t queue_head_;
+static uint32_t queue_tail_;
+static uint64_t queue_dropped_;
+
+// Owned by the writer thread.
+static char out_[OUT_BUFFER_SIZE];
+static uint32_t out_length_;
+static FILE * file_;
+static uint32_t file_index_;
+static uint64_t file_bytes_;
+static ULONGLONG file_start_ms_;
+static uint64_t records_written_;
+static int error_;
+
+
+/* ----- Hand-rolled formatting ----------------------------------------- */
+
+static char * fmt_u64(char * p, uint64_t v) {
+    char tmp[20];
+    int n = 0;
+    do {
+        tmp[n++] = (char) ('0' + (v % 10));
+        v /= 10;
+    } while (v);
+    while (n) {
+        *p++ = tmp[--n];
+    }
+    return p;
+}
+
+static char * fmt_i64(char * p, int64_t v) {
+    if (v < 0) {
+        *p++ = '-';
+        return fmt_u64(p, (uint64_t) 0 - (uint64_t) v);
+    }
+    return fmt_u64(p, (uint64_t) v);
+}
+
+static double pow10_(int n) {
+    static const double table[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+    };
+    double v = 1.0;
+    while (n > 22) {
+        v *= table[22];
+        n -= 22;
+    }
+    return v * table[n];
+}
+
+/**
+ * @brief Format a double in scientific notation with 7 significant digits.
+ *
+ * @param p The output buffer, which must have 16 bytes available.
+ * @param v The value.
+ * @param json true to emit null for non-finite values.
+ * @return The pointer to the end of the formatted value.
+ *
+ * Equivalent to printf("%.6e") within the last digit, but without the
+ * locale and varargs overhead.
+ */
+static char * fmt_f64(char * p, double v, bool json) {
+    if (!isfinite(v)) {
+        const char * s = json ? "null" : (isnan(v) ? "nan" : ((v < 0) ? "-inf" : "inf"));
+        size_t sz = strlen(s);
+        memcpy(p, s, sz);
+        return p + sz;
+    }
+    if (v < 0) {
+        *p++ = '-';
+        v = -v;
+    }
+    if (v == 0.0) {
+        *p++ = '0';
+        return p;
+    }
+
+    int e2 = 0;
+    frexp(v, &e2);
+    int e10 = (int) floor((e2 - 1) * 0.30102999566398120);
+    if (e10 > 0) {
+        v /= pow10_(e10);
+    } else if (e10 < 0) {
+        int n = -e10;
+        if (n > 300) {  // avoid overflow of the scale factor for denormals
+            v *= 1e300;
+            n -= 300;
+        }
+        v *= pow10_(n);
+    }
+    if (v >= 10.0) {
+        v /= 10.0;
+        ++e10;
+    } else if (v < 1.0) {
+        v *= 10.0;
+        --e10;
+    }
+    uint32_t m = (uint32_t) (v * 1e6 + 0.5);
+    if (m >= 10000000U) {
+        m /= 10;
+        ++e10;
+    }
+
+    char digits[7];
+    for (int i = 6; i >= 0; --i) {
+        digits[i] = (char) ('0' + (m % 10));
+        m /= 10;
+    }
+    *p++ = digits[0];
+    *p++ = '.';
+    memcpy(p, digits + 1, 6);
+    p += 6;
+    *p++ = 'e';
+    if (e10 < 0) {
+        *p++ = '-';
+        e10 = -e10;
+    } else {
+        *p++ = '+';
+    }
+    if (e10 < 10) {
+        *p++ = '0';
+    }
+    return fmt_u64(p, (uint64_t) e10);
+}
+
+static char * fmt_field(char * p, const struct js110_statistics_s * s, const struct field_s * f, bool json) {
+    const uint8_t * v = ((const uint8_t *) s) + f->offset;
+    switch (f->type) {
+        case FT_U32: return fmt_u64(p, *((const uint32_t *) v));
+        case FT_I32: return fmt_i64(p, *((const int32_t *) v));
+        case FT_I64: return fmt_i64(p, *((const int64_t *) v));
+        case FT_F64: return fmt_f64(p, *((const double *) v), json);
+        default: return p;
+    }
+}
+
+static char * fmt_csv_header(char * p) {
+    bool first = true;
+    for (uint32_t i = 0; i < FIELD_COUNT; ++i) {
+        if (config_.fields & (1U << i)) {
+            if (!first) {
+                *p++ = ',';
+            }
+            first = false;
+            size_t sz = strlen(fields_[i].name);
+            memcpy(p, fields_[i].name, sz);
+            p += sz;
+        }
+    }
+    *p++ = '\n';
+    return p;
+}
+
+static char * fmt_csv(char * p, const struct js110_statistics_s * s) {
+    bool first = true;
+    for (uint32_t i = 0; i < FIELD_COUNT; ++i) {
+        if (config_.fields & (1U << i)) {
+            if (!first) {
+                *p++ = ',';
+            }
+            first = false;
+            p = fmt_field(p, s, &fields_[i], false);
+        }
+    }
+    *p++ = '\n';
+    return p;
+}
+
+static char * fmt_jsonl(char * p, const struct js110_statistics_s * s) {
+    bool first = true;
+    *p++ = '{';
+    for (uint32_t i = 0; i < FIELD_COUNT; ++i) {
+        if (config_.fields & (1U << i)) {
+            if (!first) {
+                *p++ = ',';
+            }
+            first = false;
+            *p++ = '"';
+            size_t sz = strlen(fields_[i].name);
+            memcpy(p, fields_[i].name, sz);
+            p += sz;
+            *p++ = '"';
+            *p++ = ':';
+            p = fmt_field(p, s, &fields_[i], true);
+        }
+    }
+    *p++ = '}';
+    *p++ = '\n';
+    return p;
+}
+
+static char * fmt_binary_header(char * p) {
+    memcpy(p, "JS110BIN", 8);
+    memcpy(p + 8, &BINARY_VERSION, sizeof(uint32_t));
+    memcpy(p + 12, &config_.fields, sizeof(uint32_t));
+    return p + 16;
+}
+
+static char * fmt_binary(char * p, const struct js110_statistics_s * s) {
+    for (uint32_t i = 0; i < FIELD_COUNT; ++i) {
+        if (config_.fields & (1U << i)) {
+            const struct field_s * f = &fields_[i];
+            size_t sz = ((FT_U32 == f->type) || (FT_I32 == f->type)) ? 4 : 8;
+            memcpy(p, ((const uint8_t *) s) + f->offset, sz);
+            p += sz;
+        }
+    }
+    return p;
+}
+
+
+/* ----- Output files --------------------------------------------------- */
+
+static void out_flush(void) {
+    if (!out_length_) {
+        return;
+    }
+    size_t written = file_ ? fwrite(out_, 1, out_length_, file_) : 0;
+    if (file_ && (out_length_ != written)) {
+        DEBUG_PRINTF("stats_writer: write failed\n");
+        error_ = 1;
+    }
+    file_bytes_ += written;  // rotate on the bytes in the file
+    out_length_ = 0;
+}
+
+static void file_path(char * path, uint32_t index) {
+    if (!config_.rotate_bytes && !config_.rotate_seconds) {
+        snprintf(path, PATH_SIZE_MAX, "%s", config_.path);
+        return;
+    }
+    // Insert the index before the extension: stats.csv -> stats_00001.csv
+    const char * ext = strrchr(config_.path, '.');
+    const char * sep = strrchr(config_.path, '\\');
+    const char * sep2 = strrchr(config_.path, '/');
+    if (sep2 > sep) {
+        sep = sep2;
+    }
+    if (!ext || (sep && (ext < sep))) {
+        ext = config_.path + strlen(config_.path);
+    }
+    snprintf(path, PATH_SIZE_MAX, "%.*s_%05u%s",
+             (int) (ext - config_.path), config_.path, index, ext);
+}
+
+static int file_open(void) {
+    char path[PATH_SIZE_MAX];
+    if (!config_.path) {
+        file_ = stdout;
+        if (STATS_WRITER_BINARY == config_.format) {
+            _setmode(_fileno(stdout), _O_BINARY);
+        }
+    } else {
+        file_path(path, file_index_);
+        file_ = fopen(path, (STATS_WRITER_BINARY == config_.format) ? "wb" : "w");
+        if (!file_) {
+            fprintf(stderr, "stats_writer: could not open %s\n", path);
+            return 1;
+        }
+        setvbuf(file_, NULL, _IONBF, 0);  // out_ already batches writes
+    }
+    file_bytes_ = 0;
+    file_start_ms_ = GetTickCount64();
+
+    char * p = out_ + out_length_;
+    switch (config_.format) {
+        case STATS_WRITER_CSV: p = fmt_csv_header(p); break;
+        case STATS_WRITER_BINARY: p = fmt_binary_header(p); break;
+        default: break;
+    }
+    out_length_ = (uint32_t) (p - out_);
+    return 0;
+}
+
+static void file_close(void) {
+    out_flush();
+    if (file_ && (file_ != stdout)) {
+        fclose(file_);
+    } else if (file_) {
+        fflush(file_);
+    }
+    file_ = NULL;
+}
+
+static void file_rotate_check(uint64_t now_ms) {
+    if (!config_.path) {
+        return;
+    }
+    bool rotate = false;
+    if (config_.rotate_bytes && ((file_bytes_ + out_length_) >= config_.rotate_bytes)) {
+        rotate = true;
+    }
+    if (config_.rotate_seconds && ((now_ms - file_start_ms_) >= config_.rotate_seconds * 1000ULL)) {
+        rotate = true;
+    }
+    if (rotate) {
+        file_close();
+        ++file_index_;
+        if (file_open()) {
+            error_ = 1;
+        }
+    }
+}
+
+
+/* ----- Writer thread -------------------------------------------------- */
+
+static void records_write(uint32_t tail, uint32_t count) {
+    for (uint32_t i = 0; i < count; ++i) {
+        const struct js110_statistics_s * s = &queue_[(tail + i) & (QUEUE_SIZE - 1)];
+        if ((out_length_ + RECORD_SIZE_MAX) > OUT_BUFFER_SIZE) {
+            out_flush();
+        }
+        char * p = out_ + out_length_;
+        switch (config_.format) {
+            case STATS_WRITER_CSV: p = fmt_csv(p, s); break;
+            case STATS_WRITER_JSONL: p = fmt_jsonl(p, s); break;
+            case STATS_WRITER_BINARY: p = fmt_binary(p, s); break;
+            default: break;
+        }
+        out_length_ = (uint32_t) (p - out_);
+        if (config_.rotate_bytes) {
+            file_rotate_check(GetTickCount64());
+        }
+    }
+    records_written_ += count;
+}
+
+static void rate_report(uint64_t records, uint64_t duration_ms, const char * label) {
+    uint64_t dropped;
+    EnterCriticalSection(&lock_);
+    dropped = queue_dropped_;
+    LeaveCriticalSection(&lock_);
+    double rate = duration_ms ? (records * 1000.0 / duration_ms) : 0.0;
+    fprintf(stderr, "js110_stats: %s %.1f records/s (%llu written, %llu dropped)\n",
+            label, rate, (unsigned long long) records_written_, (unsigned long long) dropped);
+}
+
+static DWORD WINAPI writer_thread(LPVOID lpParam) {
+    (void) lpParam;
+    ULONGLONG t_start = GetTickCount64();
+    ULONGLONG t_report = t_start;
+    ULONGLONG t_flush = t_start;
+    uint64_t records_report = 0;
+    while (1) {
+        // stats_writer_push() only wakes the thread for a large backlog,
+        // so the output batches over WRITER_TIMEOUT_MS at normal rates.
+        ULONGLONG elapsed = GetTickCount64() - t_flush;
+        EnterCriticalSection(&lock_);
+        if (((queue_head_ - queue_tail_) < WAKE_RECORDS) && !thread_exit_ && (elapsed < WRITER_TIMEOUT_MS)) {
+            SleepConditionVariableCS(&cv_, &lock_, WRITER_TIMEOUT_MS - (DWORD) elapsed);
+        }
+        uint32_t tail = queue_tail_;
+        uint32_t count = queue_head_ - queue_tail_;
+        bool quit = thread_exit_;
+        LeaveCriticalSection(&lock_);
+
+        records_write(tail, count);
+
+        EnterCriticalSection(&lock_);
+        queue_tail_ += count;
+        LeaveCriticalSection(&lock_);
+
+        ULONGLONG now = GetTickCount64();
+        if (quit || (out_length_ >= FLUSH_BYTES) || ((now - t_flush) >= WRITER_TIMEOUT_MS)) {
+            out_flush();
+            t_flush = now;
+        }
+        if (config_.rotate_seconds) {
+            file_rotate_check(now);
+        }
+        if (config_.report_seconds && ((now - t_report) >= config_.report_seconds * 1000ULL)) {
+            rate_report(records_written_ - records_report, now - t_report, "sustained");
+            records_report = records_written_;
+            t_report = now;
+        }
+        if (quit && !count) {
+            break;
+        }
+    }
+    file_close();
+    if (config_.report_seconds) {
+        rate_report(records_written_, GetTickCount64() - t_start, "average");
+    }
+    return 0;
+}
+
+
+/* ----- Public API ----------------------------------------------------- */
+
+int stats_writer_fields_parse(const char * names, uint32_t * fields) {
+    uint32_t mask = 0;
+    if (!names || !fields) {
+        return 1;
+    }
+    while (*names) {
+        const char * end = strchr(names, ',');
+        size_t sz = end ? (size_t) (end - names) : strlen(names);
+        uint32_t i;
+        for (i = 0; i < FIELD_COUNT; ++i) {
+            if ((strlen(fields_[i].name) == sz) && (0 == strncmp(fields_[i].name, names, sz))) {
+                mask |= (1U << i);
+                break;
+            }
+        }
+        if (i >= FIELD_COUNT) {
+            fprintf(stderr, "unknown field: %.*s\n", (int) sz, names);
+            return 1;
+        }
+        names += sz;
+        if (*names == ',') {
+            ++names;
+        }
+    }
+    if (!mask) {
+        return 1;
+    }
+    *fields = mask;
+    return 0;
+}
+
+int stats_writer_format_parse(const char * name, enum stats_writer_format_e * format) {
+    if (!name || !format) {
+        return 1;
+    } else if (0 == strcmp(name, "csv")) {
+        *format = STATS_WRITER_CSV;
+    } else if (0 == strcmp(name, "jsonl")) {
+        *format = STATS_WRITER_JSONL;
+    } else if (0 == strcmp(name, "bin")) {
+        *format = STATS_WRITER_BINARY;
+    } else {
+        return 1;
+    }
+    return 0;
+}
+
+int stats_writer_start(const struct stats_writer_config_s * config) {
+    if (!config || thread_) {
+        return 1;
+    }
+    config_ = *config;
+    if (!config_.fields) {
+        config_.fields = STATS_WRITER_FIELDS_ALL;
+    }
+    InitializeCriticalSection(&lock_);
+    InitializeConditionVariable(&cv_);
+    queue_head_ = 0;
+    queue_tail_ = 0;
+    queue_dropped_ = 0;
+    out_length_ = 0;
+    file_index_ = 0;
+    records_written_ = 0;
+    error_ = 0;
+    thread_exit_ = false;
+    if (file_open()) {
+        DeleteCriticalSection(&lock_);
+        return 1;
+    }
+    thread_ = CreateThread(NULL, 0, writer_thread, NULL, 0, NULL);
+    if (!thread_) {
+        file_close();
+        DeleteCriticalSection(&lock_);
+        return 1;
+    }
+    return 0;
+}
+
+void stats_writer_push(const struct js110_statistics_s * statistics) {
+    bool wake;
+    EnterCriticalSection(&lock_);
+    uint32_t count = queue_head_ - queue_tail_;
+    if (count >= QUEUE_SIZE) {
+        ++queue_dropped_;
+        LeaveCriticalSection(&lock_);
+        return;
+    }
+    queue_[queue_head_ & (QUEUE_SIZE - 1)] = *statistics;
+    ++queue_head_;
+    wake = ((count + 1) == WAKE_RECORDS);  // otherwise, the writer wakes on its timeout
+    LeaveCriticalSection(&lock_);
+    if (wake) {
+        WakeConditionVariable(&cv_);
+    }
+}
+
+int stats_writer_stop(void) {
+    if (!thread_) {
+        return 0;
+    }
+    EnterCriticalSection(&lock_);
+    thread_exit_ = true;
+    LeaveCriticalSection(&lock_);
+    WakeConditionVariable(&cv_);
+    WaitForSingleObject(thread_, INFINITE);
+    CloseHandle(thread_);
+    thread_ = 0;
+    DeleteCriticalSection(&lock_);
+    return error_;
+}
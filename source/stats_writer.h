@@ -0,0 +1,116 @@
+/*
+ * Copyright 2020 Jetperch LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Buffered statistics writer for the js110_stats application.
+ *
+ * The library callback only copies each update into a queue.  A private
+ * writer thread formats the queued updates in batches and writes them
+ * using large writes, so that formatting and file I/O never stall the
+ * library's polling thread.  The writer holds the formatted output for
+ * up to 100 ms, or until it reaches 256 KiB.
+ */
+
+#ifndef STATS_WRITER_H__
+#define STATS_WRITER_H__
+
+#include "js110_statistics.h"
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/// The output file format.
+enum stats_writer_format_e {
+    /// Comma-separated values with a header row.
+    STATS_WRITER_CSV,
+    /// One JSON object per line.
+    STATS_WRITER_JSONL,
+    /// Little-endian binary records, see stats_writer.c for the layout.
+    STATS_WRITER_BINARY,
+};
+
+/// The writer configuration.
+struct stats_writer_config_s {
+    /// The output format.
+    enum stats_writer_format_e format;
+    /// The output path or NULL for stdout.
+    const char * path;
+    /// Start a new file after this many bytes, 0 to disable.
+    uint64_t rotate_bytes;
+    /// Start a new file after this many seconds, 0 to disable.
+    uint32_t rotate_seconds;
+    /// The bit mask of fields to write, see stats_writer_fields_parse().
+    uint32_t fields;
+    /// Report the sustained record rate to stderr at this interval, 0 to disable.
+    uint32_t report_seconds;
+};
+
+/// The field mask that selects all fields.  The bits match js110_field_e.
+#define STATS_WRITER_FIELDS_ALL (JS110_FIELD_ALL)
+
+/**
+ * @brief Parse a comma-separated list of field names.
+ *
+ * @param names The field names, which match the members of
+ *      struct js110_statistics_s.
+ * @param[out] fields The resulting field bit mask.
+ * @return 0 or error code.
+ */
+int stats_writer_fields_parse(const char * names, uint32_t * fields);
+
+/**
+ * @brief Parse a format name.
+ *
+ * @param name One of "csv", "jsonl" or "bin".
+ * @param[out] format The resulting format.
+ * @return 0 or error code.
+ */
+int stats_writer_format_parse(const char * name, enum stats_writer_format_e * format);
+
+/**
+ * @brief Start the writer thread.
+ *
+ * @param config The writer configuration.  The path must remain valid
+ *      until stats_writer_stop().
+ * @return 0 or error code.
+ */
+int stats_writer_start(const struct stats_writer_config_s * config);
+
+/**
+ * @brief Queue a statistics update for writing.
+ *
+ * @param statistics The statistics update, which is copied.
+ *
+ * Safe to call from the js110_statistics_cbk.  When the queue is full,
+ * the update is discarded and counted.
+ */
+void stats_writer_push(const struct js110_statistics_s * statistics);
+
+/**
+ * @brief Write all queued updates and stop the writer thread.
+ *
+ * @return 0 or error code.
+ */
+int stats_writer_stop(void);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif  /* STATS_WRITER_H__ */
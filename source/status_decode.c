@@ -0,0 +1,136 @@
+/*
+ * Copyright 2020 Jetperch LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "status_decode.h"
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+static inline uint16_t buf_decode_u16(const uint8_t * buffer) {
+    return (((uint16_t) buffer[0])     ) |
+           (((uint16_t) buffer[1]) << 8);
+}
+static inline uint32_t buf_decode_u32(const uint8_t * buffer) {
+    return (((uint32_t) buf_decode_u16(buffer))          ) |
+           (((uint32_t) buf_decode_u16(buffer + 2)) << 16);
+}
+static inline uint64_t buf_decode_u64(const uint8_t * buffer) {
+    return (((uint64_t) buf_decode_u32(buffer))          ) |
+           (((uint64_t) buf_decode_u32(buffer + 4)) << 32);
+}
+#define buf_decode_i32(buffer)  ((int32_t) buf_decode_u32(buffer))
+#define buf_decode_i64(buffer)  ((int64_t) buf_decode_u64(buffer))
+
+// The fixed-point conversions.  The scales are powers of 2, so the
+// multiplication gives the same result as the division.
+#define Q27(buffer) (((double) buf_decode_i32(buffer)) * (1.0 / (1LU << 27)))
+#define Q17(buffer) (((double) buf_decode_i32(buffer)) * (1.0 / (1LU << 17)))
+#define Q21(buffer) (((double) buf_decode_i32(buffer)) * (1.0 / (1LU << 21)))
+#define Q27_64(buffer) (((double) buf_decode_i64(buffer)) * (1.0 / (1LLU << 27)))
+#define Q34_64(buffer) (((double) buf_decode_i64(buffer)) * (1.0 / (1LLU << 34)))
+
+/// Get the index of the least significant set bit, v != 0.
+static inline uint32_t bit_index(uint32_t v) {
+#if defined(_MSC_VER)
+    unsigned long idx;
+    _BitScanForward(&idx, v);
+    return (uint32_t) idx;
+#else
+    return (uint32_t) __builtin_ctz(v);
+#endif
+}
+
+/// Decode a single field by its js110_field_e bit index.
+static inline void field_decode(const uint8_t * pkt, uint32_t idx, struct js110_statistics_s * s) {
+    switch (idx) {
+        case 1: s->samples_this = buf_decode_i32(pkt + 56); break;
+        case 2: s->samples_per_update = buf_decode_i32(pkt + 60); break;
+        case 3: s->samples_per_second = buf_decode_i32(pkt + 64); break;
+        case 4: s->samples_total = (int64_t) buf_decode_u64(pkt + 24); break;
+        case 5: s->charge = Q27_64(pkt + 40); break;
+        case 6: s->energy = Q27_64(pkt + 48); break;
+        case 7: s->current_mean = Q27(pkt + 68); break;
+        case 8: s->current_min = Q27(pkt + 72); break;
+        case 9: s->current_max = Q27(pkt + 76); break;
+        case 10: s->voltage_mean = Q17(pkt + 80); break;
+        case 11: s->voltage_min = Q17(pkt + 84); break;
+        case 12: s->voltage_max = Q17(pkt + 88); break;
+        case 13: s->power_mean = Q34_64(pkt + 32); break;
+        case 14: s->power_min = Q21(pkt + 92); break;
+        case 15: s->power_max = Q21(pkt + 96); break;
+        default: break;
+    }
+}
+
+void js110_status_decode(const uint8_t * pkt, uint32_t fields, struct js110_statistics_s * s) {
+    fields &= JS110_STATUS_FIELDS & ~JS110_FIELD_SERIAL_NUMBER;
+    uint32_t rest = fields & (fields - 1);
+    if (!(rest & (rest - 1))) {
+        // One or two fields: visit only the selected fields.  A test and
+        // branch for every field costs more than these conversions.
+        while (fields) {
+            field_decode(pkt, bit_index(fields), s);
+            fields &= fields - 1;
+        }
+        return;
+    }
+    // Wider projections: a predictable test for each field.
+    if (fields & JS110_FIELD_SAMPLES_THIS) {
+        s->samples_this = buf_decode_i32(pkt + 56);
+    }
+    if (fields & JS110_FIELD_SAMPLES_PER_UPDATE) {
+        s->samples_per_update = buf_decode_i32(pkt + 60);
+    }
+    if (fields & JS110_FIELD_SAMPLES_PER_SECOND) {
+        s->samples_per_second = buf_decode_i32(pkt + 64);
+    }
+    if (fields & JS110_FIELD_SAMPLES_TOTAL) {
+        s->samples_total = (int64_t) buf_decode_u64(pkt + 24);
+    }
+    if (fields & JS110_FIELD_CHARGE) {
+        s->charge = Q27_64(pkt + 40);
+    }
+    if (fields & JS110_FIELD_ENERGY) {
+        s->energy = Q27_64(pkt + 48);
+    }
+    if (fields & JS110_FIELD_CURRENT_MEAN) {
+        s->current_mean = Q27(pkt + 68);
+    }
+    if (fields & JS110_FIELD_CURRENT_MIN) {
+        s->current_min = Q27(pkt + 72);
+    }
+    if (fields & JS110_FIELD_CURRENT_MAX) {
+        s->current_max = Q27(pkt + 76);
+    }
+    if (fields & JS110_FIELD_VOLTAGE_MEAN) {
+        s->voltage_mean = Q17(pkt + 80);
+    }
+    if (fields & JS110_FIELD_VOLTAGE_MIN) {
+        s->voltage_min = Q17(pkt + 84);
+    }
+    if (fields & JS110_FIELD_VOLTAGE_MAX) {
+        s->voltage_max = Q17(pkt + 88);
+    }
+    if (fields & JS110_FIELD_POWER_MEAN) {
+        s->power_mean = Q34_64(pkt + 32);
+    }
+    if (fields & JS110_FIELD_POWER_MIN) {
+        s->power_min = Q21(pkt + 92);
+    }
+    if (fields & JS110_FIELD_POWER_MAX) {
+        s->power_max = Q21(pkt + 96);
+    }
+}
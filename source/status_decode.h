@@ -0,0 +1,59 @@
+/*
+ * Copyright 2020 Jetperch LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Decode the JS110 status packet.
+ *
+ * The status packet holds fixed-point values.  The decoder only converts
+ * the requested fields, so consumers that use a few fields do not pay
+ * for the rest.  See js110_fields_set().
+ */
+
+#ifndef JS110_STATUS_DECODE_H__
+#define JS110_STATUS_DECODE_H__
+
+#include "js110_statistics.h"
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/// The status packet length, in bytes.
+#define JS110_STATUS_LENGTH (104)
+
+/// The js110_field_e fields that the status packet contains.
+#define JS110_STATUS_FIELDS (0xffffU)
+
+/**
+ * @brief Decode fields from a status packet.
+ *
+ * @param pkt The JS110_STATUS_LENGTH byte status packet.
+ * @param fields The js110_field_e bit mask of the fields to decode.
+ *      JS110_FIELD_SERIAL_NUMBER and the fields outside
+ *      JS110_STATUS_FIELDS are ignored, since the packet does not
+ *      contain them.
+ * @param[out] statistics The statistics.  The function only writes the
+ *      selected fields.
+ */
+void js110_status_decode(const uint8_t * pkt, uint32_t fields, struct js110_statistics_s * statistics);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif  /* JS110_STATUS_DECODE_H__ */
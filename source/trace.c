@@ -0,0 +1,341 @@
+/*
+ * Copyright 2020 Jetperch LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "trace.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+
+/*
+ * Each thread owns a ring buffer, allocated on its first event and then
+ * kept for the life of the process.  When a thread exits, the next new
+ * thread reuses its buffer and continues the ring, so starting and
+ * stopping the library does not allocate again.  Only the owner writes
+ * its buffer.
+ * It fills an event and then publishes it by incrementing head with
+ * release semantics, so js110_trace_write() can read any buffer at any
+ * time and skip the events that were overwritten during the read.
+ * js110_trace_start() discards the events by incrementing generation_,
+ * and each thread resets its buffer on its next event.
+ */
+
+// #define DEBUG_PRINTF(...) fprintf(stderr, __VA_ARGS__)
+#define DEBUG_PRINTF(...)
+#define NAME_SIZE (32)
+
+struct buffer_s;
+
+#if defined(_MSC_VER)
+static inline uint64_t load_acquire_u64(volatile uint64_t * p) {
+    uint64_t v = *p;
+    MemoryBarrier();
+    return v;
+}
+static inline void store_release_u64(volatile uint64_t * p, uint64_t v) {
+    MemoryBarrier();
+    *p = v;
+}
+static inline uint32_t load_acquire_u32(volatile uint32_t * p) {
+    uint32_t v = *p;
+    MemoryBarrier();
+    return v;
+}
+static inline void store_release_u32(volatile uint32_t * p, uint32_t v) {
+    MemoryBarrier();
+    *p = v;
+}
+static inline struct buffer_s * load_acquire_buffer(struct buffer_s * volatile * p) {
+    struct buffer_s * v = *p;
+    MemoryBarrier();
+    return v;
+}
+#else
+#define load_acquire_u64(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release_u64(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define load_acquire_u32(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release_u32(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define load_acquire_buffer(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#endif
+
+struct event_s {
+    int64_t start;
+    int64_t duration;
+    uint32_t span;
+    uint32_t serial_number;
+};
+
+struct buffer_s {
+    struct buffer_s * next;     // the registry list
+    uint32_t tid;               // the trace thread id
+    uint32_t capacity;          // power of 2
+    volatile uint32_t owned;    // 1 while a thread owns the buffer
+    volatile uint32_t generation;
+    volatile uint64_t head;     // the number of events written
+    char name[NAME_SIZE];
+    struct event_s events[];
+};
+
+static const char * const SPAN_NAMES[TRACE_SPAN_COUNT] = {
+    "cycle",
+    "scan",
+    "enumerate",
+    "open",
+    "status",
+    "decode",
+    "callback",
+};
+
+volatile int32_t js110_trace_enabled_ = 0;
+static struct buffer_s * volatile buffers_ = NULL;
+static volatile uint32_t generation_ = 0;
+static volatile uint32_t capacity_ = JS110_TRACE_EVENTS_DEFAULT;
+static volatile uint32_t tid_next_ = 0;
+static int64_t start_time_ = 0;
+static THREAD_LOCAL struct buffer_s * buffer_ = NULL;
+static THREAD_LOCAL const char * thread_name_ = NULL;
+
+
+#if defined(_WIN32)
+int64_t js110_trace_now(void) {
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (int64_t) counter.QuadPart;
+}
+
+static double ticks_per_us(void) {
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    return frequency.QuadPart / 1e6;
+}
+
+static uint32_t tid_allocate(void) {
+    return (uint32_t) InterlockedIncrement((volatile LONG *) &tid_next_);
+}
+
+static bool buffer_claim(struct buffer_s * b) {
+    return 0 == InterlockedCompareExchange((volatile LONG *) &b->owned, 1, 0);
+}
+
+static void registry_push(struct buffer_s * b) {
+    do {
+        b->next = buffers_;
+    } while (InterlockedCompareExchangePointer((PVOID volatile *) &buffers_, b, b->next) != b->next);
+}
+#else
+int64_t js110_trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec + 1;  // never 0
+}
+
+static double ticks_per_us(void) {
+    return 1000.0;
+}
+
+static uint32_t tid_allocate(void) {
+    return __atomic_add_fetch(&tid_next_, 1, __ATOMIC_RELAXED);
+}
+
+static bool buffer_claim(struct buffer_s * b) {
+    uint32_t expected = 0;
+    return __atomic_compare_exchange_n(&b->owned, &expected, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static void registry_push(struct buffer_s * b) {
+    b->next = __atomic_load_n(&buffers_, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&buffers_, &b->next, b, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        // b->next updated, retry
+    }
+}
+#endif
+
+static void name_set(struct buffer_s * b, const char * name) {
+    snprintf(b->name, sizeof(b->name), "%s", name ? name : "thread");
+}
+
+static struct buffer_s * buffer_allocate(void) {
+    uint32_t capacity = capacity_;
+    for (struct buffer_s * b = load_acquire_buffer(&buffers_); b; b = b->next) {
+        if ((b->capacity == capacity) && !b->owned && buffer_claim(b)) {
+            name_set(b, thread_name_);
+            DEBUG_PRINTF("trace buffer %u reused: %s\n", b->tid, b->name);
+            return b;
+        }
+    }
+    struct buffer_s * b = calloc(1, sizeof(struct buffer_s) + capacity * sizeof(struct event_s));
+    if (!b) {
+        return NULL;
+    }
+    b->tid = tid_allocate();
+    b->capacity = capacity;
+    b->owned = 1;
+    b->generation = load_acquire_u32(&generation_);
+    name_set(b, thread_name_);
+    registry_push(b);
+    DEBUG_PRINTF("trace buffer %u: %s\n", b->tid, b->name);
+    return b;
+}
+
+void js110_trace_record(enum trace_span_e span, int64_t start, uint32_t serial_number) {
+    int64_t now = js110_trace_now();
+    struct buffer_s * b = buffer_;
+    if (!b) {
+        b = buffer_allocate();
+        if (!b) {
+            return;
+        }
+        buffer_ = b;
+    }
+    uint32_t generation = load_acquire_u32(&generation_);
+    if (b->generation != generation) {
+        store_release_u64(&b->head, 0);
+        store_release_u32(&b->generation, generation);
+    }
+    uint64_t head = b->head;
+    struct event_s * e = &b->events[head & (b->capacity - 1)];
+    e->start = start;
+    e->duration = now - start;
+    e->span = (uint32_t) span;
+    e->serial_number = serial_number;
+    store_release_u64(&b->head, head + 1);
+}
+
+void js110_trace_thread_name(const char * name) {
+    thread_name_ = name;
+    if (buffer_) {
+        name_set(buffer_, name);
+    }
+}
+
+void js110_trace_thread_exit(void) {
+    struct buffer_s * b = buffer_;
+    buffer_ = NULL;
+    thread_name_ = NULL;
+    if (b) {
+        store_release_u32(&b->owned, 0);
+    }
+}
+
+int js110_trace_start(uint32_t events_per_thread) {
+    uint32_t capacity = 1;
+    if (!events_per_thread) {
+        events_per_thread = JS110_TRACE_EVENTS_DEFAULT;
+    }
+    if (events_per_thread > (1U << 24)) {
+        return 1;
+    }
+    while (capacity < events_per_thread) {
+        capacity <<= 1;
+    }
+    capacity_ = capacity;
+    start_time_ = js110_trace_now();
+    store_release_u32(&generation_, generation_ + 1);
+    js110_trace_enabled_ = 1;
+    return 0;
+}
+
+int js110_trace_stop(void) {
+    js110_trace_enabled_ = 0;
+    return 0;
+}
+
+/// Copy the valid events of a buffer, and return the number of events.
+static uint32_t buffer_copy(struct buffer_s * b, struct event_s * events) {
+    uint32_t generation = load_acquire_u32(&generation_);
+    if (load_acquire_u32(&b->generation) != generation) {
+        return 0;  // stale, the thread has not recorded since js110_trace_start()
+    }
+    uint64_t head = load_acquire_u64(&b->head);
+    uint64_t first = (head > b->capacity) ? (head - b->capacity) : 0;
+    for (uint64_t i = first; i < head; ++i) {
+        events[i - first] = b->events[i & (b->capacity - 1)];
+    }
+    // The owner may have overwritten the oldest events during the copy,
+    // including the slot that it is writing now.
+    uint64_t head_after = load_acquire_u64(&b->head);
+    if ((load_acquire_u32(&b->generation) != generation) || (head_after < head)) {
+        return 0;  // restarted during the copy
+    }
+    uint64_t valid = (head_after >= b->capacity) ? (head_after - b->capacity + 1) : 0;
+    if (valid <= first) {
+        return (uint32_t) (head - first);
+    } else if (valid >= head) {
+        return 0;
+    }
+    uint32_t skip = (uint32_t) (valid - first);
+    memmove(events, events + skip, (size_t) (head - valid) * sizeof(struct event_s));
+    return (uint32_t) (head - valid);
+}
+
+int js110_trace_write(const char * path) {
+    FILE * f = fopen(path, "w");
+    if (!f) {
+        return 1;
+    }
+    double scale = 1.0 / ticks_per_us();
+    int64_t t0 = start_time_;
+    struct event_s * events = NULL;
+    uint32_t events_size = 0;
+    int rc = 0;
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"js110\"}}");
+    for (struct buffer_s * b = load_acquire_buffer(&buffers_); b; b = b->next) {
+        if (events_size < b->capacity) {
+            free(events);
+            events_size = b->capacity;
+            events = malloc(events_size * sizeof(struct event_s));
+            if (!events) {
+                rc = 1;
+                break;
+            }
+        }
+        uint32_t count = buffer_copy(b, events);
+        fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                b->tid, b->name);
+        for (uint32_t i = 0; i < count; ++i) {
+            const struct event_s * e = &events[i];
+            const char * name = (e->span < TRACE_SPAN_COUNT) ? SPAN_NAMES[e->span] : "unknown";
+            fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"js110\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+                       "\"ts\":%.3f,\"dur\":%.3f",
+                    name, b->tid, (e->start - t0) * scale, e->duration * scale);
+            if (e->serial_number) {
+                fprintf(f, ",\"args\":{\"serial_number\":%u}", e->serial_number);
+            }
+            fprintf(f, "}");
+        }
+    }
+    fprintf(f, "\n]}\n");
+    free(events);
+    if (fclose(f)) {
+        rc = 1;
+    }
+    return rc;
+}
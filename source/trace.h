@@ -0,0 +1,97 @@
+/*
+ * Copyright 2020 Jetperch LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Record trace spans from the library threads, see js110_trace.h.
+ *
+ *     JS110_TRACE_BEGIN(t);
+ *     ... work ...
+ *     JS110_TRACE_END(t, TRACE_STATUS, serial_number);
+ */
+
+#ifndef JS110_TRACE_INTERNAL_H__
+#define JS110_TRACE_INTERNAL_H__
+
+#include "js110_trace.h"
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/// The span types.
+enum trace_span_e {
+    TRACE_CYCLE,
+    TRACE_SCAN,
+    TRACE_ENUMERATE,
+    TRACE_OPEN,
+    TRACE_STATUS,
+    TRACE_DECODE,
+    TRACE_CALLBACK,
+    TRACE_SPAN_COUNT,
+};
+
+/// Nonzero while recording.
+extern volatile int32_t js110_trace_enabled_;
+
+/**
+ * @brief Get the trace time.
+ *
+ * @return The monotonic time in ticks, which is never 0.
+ */
+int64_t js110_trace_now(void);
+
+/**
+ * @brief Record a span that ends now in the calling thread's buffer.
+ *
+ * @param span The trace_span_e span type.
+ * @param start The js110_trace_now() time at the span start.
+ * @param serial_number The device serial number, or 0 for none.
+ */
+void js110_trace_record(enum trace_span_e span, int64_t start, uint32_t serial_number);
+
+/**
+ * @brief Name the calling thread in the trace.
+ *
+ * @param name The thread name, which must remain valid.
+ */
+void js110_trace_thread_name(const char * name);
+
+/**
+ * @brief Release the calling thread's buffer for reuse by a new thread.
+ *
+ * Call at the end of each library thread.  The recorded events remain
+ * in the trace.
+ */
+void js110_trace_thread_exit(void);
+
+/// Start a span, which only reads the clock while recording.
+#define JS110_TRACE_BEGIN(var_) \
+    int64_t var_ = js110_trace_enabled_ ? js110_trace_now() : 0
+
+/// End a span started with JS110_TRACE_BEGIN().
+#define JS110_TRACE_END(var_, span_, serial_number_) do { \
+    if (var_) { \
+        js110_trace_record((span_), (var_), (uint32_t) (serial_number_)); \
+    } \
+} while (0)
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif  /* JS110_TRACE_INTERNAL_H__ */
@@ -0,0 +1,660 @@
+/*
+ * Copyright 2020 Jetperch LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "js110_tsz.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+
+/*
+ * Block format, all values little-endian
+ *
+ * Header (JS110_TSZ_HEADER_SIZE bytes):
+ *   0: "JTSZ" magic
+ *   4: u8 format version (2)
+ *   5: u8 column count (COLUMN_COUNT)
+ *   6: u16 record count
+ *   8: u32 total block size, in bytes, including this header
+ *  12: u32 reserved (0)
+ *
+ * Followed by one column for each field of js110_statistics_s, in order:
+ *   0: u8 encoding (enum encoding_e)
+ *   1: u32 payload size, in bytes
+ *   5: payload
+ *
+ * Payloads:
+ *   ENC_CONST: 8-byte value.
+ *   ENC_RLE: repeated (8-byte value, u16 run length) pairs.
+ *   ENC_DOD: 8-byte first value, then a bitstream with one entry for each
+ *      following record.  The entry is the zigzag encoded delta-of-delta:
+ *      '0' for zero, '10' + 7 bits, '110' + 9 bits, '1110' + 12 bits,
+ *      '11110' + 32 bits, '11111' + 64 bits.
+ *   ENC_XOR: 8-byte first value, then a bitstream with one entry for each
+ *      following record.  The entry is the XOR with the previous value:
+ *      '0' for zero, '10' + the meaningful bits using the previous
+ *      leading/trailing zero window, or '11' + 5-bit leading zero count
+ *      + 6-bit (meaningful bit count - 1) + meaningful bits.
+ *
+ * Version 1 blocks have 16 columns, up to power_max, and the decoder
+ * sets the later fields to 0.
+ *
+ * Bitstreams are MSB first and padded to a byte boundary.
+ * Integer fields are sign extended to 64 bits.  Double fields use the
+ * IEEE 754 bit pattern.
+ */
+
+#define MAGIC "JTSZ"
+#define VERSION (2)  // 2 added samples_missed, windows_missed and flags
+#define VERSION_1 (1)
+#define COLUMN_COUNT_V1 (16)  // the version 1 columns, up to power_max
+#define COLUMN_HEADER_SIZE (5)
+#define RLE_ENTRY_SIZE (10)
+#define RUN_LENGTH_MAX (0xffffU)
+
+enum encoding_e {
+    ENC_CONST = 0,
+    ENC_RLE = 1,
+    ENC_DOD = 2,
+    ENC_XOR = 3,
+};
+
+enum column_type_e {
+    CT_U32,
+    CT_I32,
+    CT_I64,
+    CT_F64,
+};
+
+struct column_s {
+    enum column_type_e type;
+    size_t offset;
+};
+
+#define COLUMN(name_, type_) {type_, offsetof(struct js110_statistics_s, name_)}
+static const struct column_s columns_[] = {
+    COLUMN(serial_number, CT_U32),
+    COLUMN(samples_this, CT_I32),
+    COLUMN(samples_per_update, CT_I32),
+    COLUMN(samples_per_second, CT_I32),
+    COLUMN(samples_total, CT_I64),
+    COLUMN(charge, CT_F64),
+    COLUMN(energy, CT_F64),
+    COLUMN(current_mean, CT_F64),
+    COLUMN(current_min, CT_F64),
+    COLUMN(current_max, CT_F64),
+    COLUMN(voltage_mean, CT_F64),
+    COLUMN(voltage_min, CT_F64),
+    COLUMN(voltage_max, CT_F64),
+    COLUMN(power_mean, CT_F64),
+    COLUMN(power_min, CT_F64),
+    COLUMN(power_max, CT_F64),
+    COLUMN(samples_missed, CT_I64),
+    COLUMN(windows_missed, CT_U32),
+    COLUMN(flags, CT_U32),
+};
+#define COLUMN_COUNT (sizeof(columns_) / sizeof(columns_[0]))
+
+// JS110_TSZ_BLOCK_SIZE_MAX() must cover every column.
+typedef char column_count_check_[(COLUMN_COUNT == JS110_TSZ_COLUMN_COUNT) ? 1 : -1];
+
+struct js110_tsz_encoder_s {
+    js110_tsz_write_fn write_fn;
+    void * user_data;
+    uint32_t block_records;
+    uint32_t count;
+    struct js110_statistics_s records[JS110_TSZ_BLOCK_RECORDS_MAX];
+    uint8_t block[JS110_TSZ_BLOCK_SIZE_MAX(JS110_TSZ_BLOCK_RECORDS_MAX)];
+};
+
+
+static inline uint32_t clz64(uint64_t x) {  // x != 0
+#if defined(_MSC_VER)
+    unsigned long idx;
+    _BitScanReverse64(&idx, x);
+    return 63 - idx;
+#else
+    return (uint32_t) __builtin_clzll(x);
+#endif
+}
+
+static inline uint32_t ctz64(uint64_t x) {  // x != 0
+#if defined(_MSC_VER)
+    unsigned long idx;
+    _BitScanForward64(&idx, x);
+    return idx;
+#else
+    return (uint32_t) __builtin_ctzll(x);
+#endif
+}
+
+static inline uint64_t bits_mask(uint32_t bits) {
+    return (bits >= 64) ? ~0ULL : ((1ULL << bits) - 1);
+}
+
+static inline void u16_encode(uint8_t * p, uint16_t v) {
+    p[0] = (uint8_t) v;
+    p[1] = (uint8_t) (v >> 8);
+}
+
+static inline void u32_encode(uint8_t * p, uint32_t v) {
+    u16_encode(p, (uint16_t) v);
+    u16_encode(p + 2, (uint16_t) (v >> 16));
+}
+
+static inline void u64_encode(uint8_t * p, uint64_t v) {
+    u32_encode(p, (uint32_t) v);
+    u32_encode(p + 4, (uint32_t) (v >> 32));
+}
+
+static inline uint16_t u16_decode(const uint8_t * p) {
+    return (uint16_t) (p[0] | (((uint16_t) p[1]) << 8));
+}
+
+static inline uint32_t u32_decode(const uint8_t * p) {
+    return ((uint32_t) u16_decode(p)) | (((uint32_t) u16_decode(p + 2)) << 16);
+}
+
+static inline uint64_t u64_decode(const uint8_t * p) {
+    return ((uint64_t) u32_decode(p)) | (((uint64_t) u32_decode(p + 4)) << 32);
+}
+
+static inline uint64_t zigzag_encode(int64_t v) {
+    return (((uint64_t) v) << 1) ^ (uint64_t) (v >> 63);
+}
+
+static inline int64_t zigzag_decode(uint64_t v) {
+    return (int64_t) (v >> 1) ^ -((int64_t) (v & 1));
+}
+
+static inline uint64_t column_get(const struct js110_statistics_s * s, const struct column_s * c) {
+    const uint8_t * p = ((const uint8_t *) s) + c->offset;
+    uint64_t v;
+    switch (c->type) {
+        case CT_U32: return *((const uint32_t *) p);
+        case CT_I32: return (uint64_t) (int64_t) *((const int32_t *) p);
+        default:
+            memcpy(&v, p, sizeof(v));
+            return v;
+    }
+}
+
+static inline void column_set(struct js110_statistics_s * s, const struct column_s * c, uint64_t v) {
+    uint8_t * p = ((uint8_t *) s) + c->offset;
+    switch (c->type) {
+        case CT_U32: *((uint32_t *) p) = (uint32_t) v; break;
+        case CT_I32: *((int32_t *) p) = (int32_t) v; break;
+        default: memcpy(p, &v, sizeof(v)); break;
+    }
+}
+
+
+/* ----- Bitstream ------------------------------------------------------ */
+
+struct bit_writer_s {
+    uint8_t * buf;
+    uint32_t size;
+    uint32_t pos;
+    uint64_t acc;
+    uint32_t acc_bits;
+    bool overflow;
+};
+
+static inline void bw_put_(struct bit_writer_s * w, uint64_t value, uint32_t bits) {  // bits <= 32
+    w->acc = (w->acc << bits) | (value & bits_mask(bits));
+    w->acc_bits += bits;
+    while (w->acc_bits >= 8) {
+        w->acc_bits -= 8;
+        if (w->pos < w->size) {
+            w->buf[w->pos++] = (uint8_t) (w->acc >> w->acc_bits);
+        } else {
+            w->overflow = true;
+        }
+    }
+}
+
+static inline void bw_put(struct bit_writer_s * w, uint64_t value, uint32_t bits) {
+    if (bits > 32) {
+        bw_put_(w, value >> 32, bits - 32);
+        bits = 32;
+    }
+    bw_put_(w, value, bits);
+}
+
+static void bw_flush(struct bit_writer_s * w) {
+    if (w->acc_bits) {
+        bw_put_(w, 0, 8 - w->acc_bits);
+    }
+}
+
+struct bit_reader_s {
+    const uint8_t * buf;
+    uint32_t size;
+    uint32_t pos;
+    uint64_t acc;
+    uint32_t acc_bits;
+    bool underflow;
+};
+
+static inline uint64_t br_get_(struct bit_reader_s * r, uint32_t bits) {  // bits <= 32
+    while (r->acc_bits < bits) {
+        uint8_t b = 0;
+        if (r->pos < r->size) {
+            b = r->buf[r->pos++];
+        } else {
+            r->underflow = true;
+        }
+        r->acc = (r->acc << 8) | b;
+        r->acc_bits += 8;
+    }
+    r->acc_bits -= bits;
+    return (r->acc >> r->acc_bits) & bits_mask(bits);
+}
+
+static inline uint64_t br_get(struct bit_reader_s * r, uint32_t bits) {
+    if (bits > 32) {
+        uint64_t hi = br_get_(r, bits - 32);
+        return (hi << 32) | br_get_(r, 32);
+    }
+    return br_get_(r, bits);
+}
+
+/// Count the leading '1' bits of a unary prefix, up to max.
+static inline uint32_t br_prefix(struct bit_reader_s * r, uint32_t max) {
+    uint32_t n = 0;
+    while ((n < max) && br_get_(r, 1)) {
+        ++n;
+    }
+    return n;
+}
+
+
+/* ----- Column encoders ------------------------------------------------ */
+
+static uint32_t encode_rle(const uint64_t * v, uint32_t count, uint8_t * p, uint32_t size) {
+    uint32_t sz = 0;
+    uint32_t i = 0;
+    while (i < count) {
+        uint32_t run = 1;
+        while (((i + run) < count) && (v[i + run] == v[i]) && (run < RUN_LENGTH_MAX)) {
+            ++run;
+        }
+        if ((sz + RLE_ENTRY_SIZE) > size) {
+            return 0;
+        }
+        u64_encode(p + sz, v[i]);
+        u16_encode(p + sz + 8, (uint16_t) run);
+        sz += RLE_ENTRY_SIZE;
+        i += run;
+    }
+    return sz;
+}
+
+static uint32_t encode_dod(const uint64_t * v, uint32_t count, uint8_t * p, uint32_t size) {
+    struct bit_writer_s w = {p + 8, size - 8, 0, 0, 0, false};
+    int64_t delta_prev = 0;
+    u64_encode(p, v[0]);
+    for (uint32_t i = 1; i < count; ++i) {
+        int64_t delta = (int64_t) (v[i] - v[i - 1]);
+        uint64_t zz = zigzag_encode((int64_t) ((uint64_t) delta - (uint64_t) delta_prev));
+        delta_prev = delta;
+        if (0 == zz) {
+            bw_put(&w, 0, 1);
+        } else if (zz < (1U << 7)) {
+            bw_put(&w, 0x2, 2);
+            bw_put(&w, zz, 7);
+        } else if (zz < (1U << 9)) {
+            bw_put(&w, 0x6, 3);
+            bw_put(&w, zz, 9);
+        } else if (zz < (1U << 12)) {
+            bw_put(&w, 0xe, 4);
+            bw_put(&w, zz, 12);
+        } else if (zz < (1ULL << 32)) {
+            bw_put(&w, 0x1e, 5);
+            bw_put(&w, zz, 32);
+        } else {
+            bw_put(&w, 0x1f, 5);
+            bw_put(&w, zz, 64);
+        }
+    }
+    bw_flush(&w);
+    return w.overflow ? 0 : (8 + w.pos);
+}
+
+static uint32_t encode_xor(const uint64_t * v, uint32_t count, uint8_t * p, uint32_t size) {
+    struct bit_writer_s w = {p + 8, size - 8, 0, 0, 0, false};
+    uint32_t lead_prev = 65;  // no window yet
+    uint32_t trail_prev = 0;
+    u64_encode(p, v[0]);
+    for (uint32_t i = 1; i < count; ++i) {
+        uint64_t x = v[i] ^ v[i - 1];
+        if (!x) {
+            bw_put(&w, 0, 1);
+            continue;
+        }
+        uint32_t lead = clz64(x);
+        uint32_t trail = ctz64(x);
+        if (lead > 31) {
+            lead = 31;
+        }
+        if ((lead_prev <= 64) && (lead >= lead_prev) && (trail >= trail_prev)) {
+            uint32_t bits = 64 - lead_prev - trail_prev;
+            bw_put(&w, 0x2, 2);
+            bw_put(&w, x >> trail_prev, bits);
+        } else {
+            uint32_t bits = 64 - lead - trail;
+            bw_put(&w, 0x3, 2);
+            bw_put(&w, lead, 5);
+            bw_put(&w, bits - 1, 6);
+            bw_put(&w, x >> trail, bits);
+            lead_prev = lead;
+            trail_prev = trail;
+        }
+    }
+    bw_flush(&w);
+    return w.overflow ? 0 : (8 + w.pos);
+}
+
+static uint32_t column_encode(const uint64_t * v, uint32_t count, enum column_type_e type,
+                              uint8_t * p, uint32_t size, uint8_t * scratch) {
+    uint32_t payload_size = 0;
+    uint8_t encoding = ENC_CONST;
+    uint32_t runs = 1;
+    for (uint32_t i = 1; i < count; ++i) {
+        if (v[i] != v[i - 1]) {
+            ++runs;
+        }
+    }
+    if (size < (COLUMN_HEADER_SIZE + 8)) {
+        return 0;
+    }
+    uint8_t * payload = p + COLUMN_HEADER_SIZE;
+    size -= COLUMN_HEADER_SIZE;
+
+    if (1 == runs) {
+        u64_encode(payload, v[0]);
+        payload_size = 8;
+    } else {
+        uint32_t scratch_size = JS110_TSZ_BLOCK_SIZE_MAX(JS110_TSZ_BLOCK_RECORDS_MAX);
+        if (CT_F64 == type) {
+            payload_size = encode_xor(v, count, scratch, scratch_size);
+            encoding = ENC_XOR;
+        } else {
+            payload_size = encode_dod(v, count, scratch, scratch_size);
+            encoding = ENC_DOD;
+        }
+        if ((runs * RLE_ENTRY_SIZE) < payload_size) {
+            payload_size = encode_rle(v, count, payload, size);
+            encoding = ENC_RLE;
+        } else if (payload_size && (payload_size <= size)) {
+            memcpy(payload, scratch, payload_size);
+        } else {
+            return 0;
+        }
+        if (!payload_size) {
+            return 0;
+        }
+    }
+    p[0] = encoding;
+    u32_encode(p + 1, payload_size);
+    return COLUMN_HEADER_SIZE + payload_size;
+}
+
+
+/* ----- Column decoders ------------------------------------------------ */
+
+static int decode_rle(const uint8_t * p, uint32_t size, const struct column_s * c,
+                      struct js110_statistics_s * records, uint32_t count) {
+    uint32_t i = 0;
+    for (uint32_t k = 0; (k + RLE_ENTRY_SIZE) <= size; k += RLE_ENTRY_SIZE) {
+        uint64_t v = u64_decode(p + k);
+        uint32_t run = u16_decode(p + k + 8);
+        if ((i + run) > count) {
+            return 1;
+        }
+        for (uint32_t j = 0; j < run; ++j) {
+            column_set(&records[i++], c, v);
+        }
+    }
+    return (i == count) ? 0 : 1;
+}
+
+static int decode_dod(const uint8_t * p, uint32_t size, const struct column_s * c,
+                      struct js110_statistics_s * records, uint32_t count) {
+    static const uint32_t BITS[] = {0, 7, 9, 12, 32, 64};
+    if (size < 8) {
+        return 1;
+    }
+    struct bit_reader_s r = {p + 8, size - 8, 0, 0, 0, false};
+    uint64_t v = u64_decode(p);
+    int64_t delta = 0;
+    column_set(&records[0], c, v);
+    for (uint32_t i = 1; i < count; ++i) {
+        uint32_t prefix = br_prefix(&r, 5);
+        if (prefix) {
+            delta = (int64_t) ((uint64_t) delta + (uint64_t) zigzag_decode(br_get(&r, BITS[prefix])));
+        }
+        v += (uint64_t) delta;
+        column_set(&records[i], c, v);
+    }
+    return r.underflow ? 1 : 0;
+}
+
+static int decode_xor(const uint8_t * p, uint32_t size, const struct column_s * c,
+                      struct js110_statistics_s * records, uint32_t count) {
+    if (size < 8) {
+        return 1;
+    }
+    struct bit_reader_s r = {p + 8, size - 8, 0, 0, 0, false};
+    uint64_t v = u64_decode(p);
+    uint32_t lead = 0;
+    uint32_t bits = 64;
+    column_set(&records[0], c, v);
+    for (uint32_t i = 1; i < count; ++i) {
+        if (br_get_(&r, 1)) {
+            if (br_get_(&r, 1)) {
+                lead = (uint32_t) br_get_(&r, 5);
+                bits = (uint32_t) br_get_(&r, 6) + 1;
+                if ((lead + bits) > 64) {
+                    return 1;
+                }
+            }
+            v ^= br_get(&r, bits) << (64 - lead - bits);
+        }
+        column_set(&records[i], c, v);
+    }
+    return r.underflow ? 1 : 0;
+}
+
+
+/* ----- Public API ----------------------------------------------------- */
+
+int js110_tsz_encode(const struct js110_statistics_s * records, uint32_t count,
+                     uint8_t * block, uint32_t size, uint32_t * block_size) {
+    uint64_t values[JS110_TSZ_BLOCK_RECORDS_MAX];
+    uint8_t * scratch;
+    uint32_t offset = JS110_TSZ_HEADER_SIZE;
+    if (!records || !block || !count || (count > JS110_TSZ_BLOCK_RECORDS_MAX) || (size < JS110_TSZ_HEADER_SIZE)) {
+        return 1;
+    }
+    scratch = malloc(JS110_TSZ_BLOCK_SIZE_MAX(JS110_TSZ_BLOCK_RECORDS_MAX));
+    if (!scratch) {
+        return 1;
+    }
+    for (uint32_t k = 0; k < COLUMN_COUNT; ++k) {
+        const struct column_s * c = &columns_[k];
+        for (uint32_t i = 0; i < count; ++i) {
+            values[i] = column_get(&records[i], c);
+        }
+        uint32_t sz = column_encode(values, count, c->type, block + offset, size - offset, scratch);
+        if (!sz) {
+            free(scratch);
+            return 1;
+        }
+        offset += sz;
+    }
+    free(scratch);
+
+    memcpy(block, MAGIC, 4);
+    block[4] = VERSION;
+    block[5] = (uint8_t) COLUMN_COUNT;
+    u16_encode(block + 6, (uint16_t) count);
+    u32_encode(block + 8, offset);
+    u32_encode(block + 12, 0);
+    if (block_size) {
+        *block_size = offset;
+    }
+    return 0;
+}
+
+int js110_tsz_block_info(const uint8_t * block, uint32_t size,
+                         uint32_t * block_size, uint32_t * record_count) {
+    if (!block || (size < JS110_TSZ_HEADER_SIZE)) {
+        return 1;
+    }
+    if (memcmp(block, MAGIC, 4)) {
+        return 1;
+    }
+    if (!((VERSION == block[4]) && (COLUMN_COUNT == block[5]))
+            && !((VERSION_1 == block[4]) && (COLUMN_COUNT_V1 == block[5]))) {
+        return 1;
+    }
+    uint32_t count = u16_decode(block + 6);
+    uint32_t sz = u32_decode(block + 8);
+    if (!count || (count > JS110_TSZ_BLOCK_RECORDS_MAX) || (sz < JS110_TSZ_HEADER_SIZE)) {
+        return 1;
+    }
+    if (block_size) {
+        *block_size = sz;
+    }
+    if (record_count) {
+        *record_count = count;
+    }
+    return 0;
+}
+
+int js110_tsz_decode(const uint8_t * block, uint32_t size,
+                     struct js110_statistics_s * records, uint32_t records_max,
+                     uint32_t * record_count) {
+    uint32_t block_size = 0;
+    uint32_t count = 0;
+    if (js110_tsz_block_info(block, size, &block_size, &count) || (block_size > size)) {
+        return 1;
+    }
+    if (!records || (count > records_max)) {
+        return 1;
+    }
+    // Version 1 blocks end at power_max, so the later fields are 0.
+    uint32_t column_count = block[5];
+    for (uint32_t k = column_count; k < COLUMN_COUNT; ++k) {
+        for (uint32_t i = 0; i < count; ++i) {
+            column_set(&records[i], &columns_[k], 0);
+        }
+    }
+    uint32_t offset = JS110_TSZ_HEADER_SIZE;
+    for (uint32_t k = 0; k < column_count; ++k) {
+        const struct column_s * c = &columns_[k];
+        if ((offset + COLUMN_HEADER_SIZE) > block_size) {
+            return 1;
+        }
+        uint8_t encoding = block[offset];
+        uint32_t sz = u32_decode(block + offset + 1);
+        const uint8_t * p = block + offset + COLUMN_HEADER_SIZE;
+        offset += COLUMN_HEADER_SIZE;
+        if (sz > (block_size - offset)) {
+            return 1;
+        }
+        int rc;
+        switch (encoding) {
+            case ENC_CONST:
+                rc = (sz < 8) ? 1 : 0;
+                if (!rc) {
+                    uint64_t v = u64_decode(p);
+                    for (uint32_t i = 0; i < count; ++i) {
+                        column_set(&records[i], c, v);
+                    }
+                }
+                break;
+            case ENC_RLE: rc = decode_rle(p, sz, c, records, count); break;
+            case ENC_DOD: rc = decode_dod(p, sz, c, records, count); break;
+            case ENC_XOR: rc = decode_xor(p, sz, c, records, count); break;
+            default: rc = 1; break;
+        }
+        if (rc) {
+            return rc;
+        }
+        offset += sz;
+    }
+    if (record_count) {
+        *record_count = count;
+    }
+    return 0;
+}
+
+struct js110_tsz_encoder_s * js110_tsz_encoder_alloc(
+        uint32_t block_records, js110_tsz_write_fn write_fn, void * user_data) {
+    if (!block_records) {
+        block_records = JS110_TSZ_BLOCK_RECORDS_MAX;
+    }
+    if ((block_records > JS110_TSZ_BLOCK_RECORDS_MAX) || !write_fn) {
+        return NULL;
+    }
+    struct js110_tsz_encoder_s * self = malloc(sizeof(struct js110_tsz_encoder_s));
+    if (!self) {
+        return NULL;
+    }
+    self->write_fn = write_fn;
+    self->user_data = user_data;
+    self->block_records = block_records;
+    self->count = 0;
+    return self;
+}
+
+void js110_tsz_encoder_free(struct js110_tsz_encoder_s * self) {
+    free(self);
+}
+
+int js110_tsz_encoder_add(struct js110_tsz_encoder_s * self, const struct js110_statistics_s * statistics) {
+    if (!self || !statistics) {
+        return 1;
+    }
+    self->records[self->count++] = *statistics;
+    if (self->count >= self->block_records) {
+        return js110_tsz_encoder_flush(self);
+    }
+    return 0;
+}
+
+int js110_tsz_encoder_flush(struct js110_tsz_encoder_s * self) {
+    uint32_t block_size = 0;
+    if (!self) {
+        return 1;
+    }
+    if (!self->count) {
+        return 0;
+    }
+    int rc = js110_tsz_encode(self->records, self->count, self->block, sizeof(self->block), &block_size);
+    self->count = 0;
+    if (rc) {
+        return rc;
+    }
+    self->write_fn(self->user_data, self->block, block_size);
+    return 0;
+}